@@ -0,0 +1,74 @@
+#ifndef ATMOSPHERE_H
+#define ATMOSPHERE_H
+
+#include <cstddef>
+
+#include "math.hpp"
+
+class ThreadPool;
+
+// Optical depth table of one planet's atmosphere, read by atmosphere() in main.frag instead of an inner ray march.
+// Texel (i, j) is the integral of the density from a point at height h = j / (size - 1) above the sea (in atmosphere radii)
+// towards a direction whose cosine with the vertical is cosTheta = 2 * i / (size - 1) - 1, up to the edge of the atmosphere.
+// Rays going through the planet integrate through it too, like the old inner loop did, which gives the shadow of the planet.
+// Values are in atmosphere radii : multiply them by atmosRadius to get world units
+struct OpticalDepthParams
+{
+    float planetRadius = 60.; // at sea level, in world units
+    float atmosRadius = 14.;  // thickness of the atmosphere, in world units
+    float falloff = 4.;
+};
+
+constexpr size_t OPTICAL_DEPTH_LUT_SIZE = 256;
+// midpoint samples per texel, more don't change the result visibly (see solar_texturegen --bench-atmosphere)
+constexpr int OPTICAL_DEPTH_STEPS = 64;
+// rays crossing the planet are clamped there, the transmittance is already 0 and it keeps the bilinear filter sane
+constexpr float OPTICAL_DEPTH_MAX = 1000.;
+
+// density of the atmosphere at height h (in atmosphere radii), 1 at sea level and 0 at its edge
+float atmosphereDensity(float h, float falloff);
+
+// integral of the density with nbSteps samples, each one taken at its own height
+float integrateOpticalDepth(const OpticalDepthParams& params, float h, float cosTheta, int nbSteps = OPTICAL_DEPTH_STEPS);
+
+// fills size * size floats, one row per cosTheta, rows are spread over the pool
+void bakeOpticalDepthLUT(ThreadPool& pool, const OpticalDepthParams& params, size_t size, float* out);
+
+// bilinear fetch with the same addressing as the shader
+float sampleOpticalDepthLUT(const float* lut, size_t size, float h, float cosTheta);
+
+// Precomputed scattering of one planet's atmosphere, after Bruneton and Neyret, "Precomputed Atmospheric Scattering" (2008),
+// with the multiple scattering approximation of Hillaire, "A Scalable and Production Ready Sky and Atmosphere Rendering Technique" (2020).
+// The atmosphere only has one kind of particles, scattering (and absorbing) beta = atmosColor per unit of density, without any phase function :
+// single scattering is the same as what the old ray march of main.frag computed. The ground is black
+struct ScatteringParams
+{
+    OpticalDepthParams atmosphere;
+    vec3 beta; // atmosColor in main.frag, in world units
+};
+
+// Multiple scattering table psi(h, muS), MULTIPLE_SCATTERING_SIZE x MULTIPLE_SCATTERING_SIZE, only used while baking :
+// light scattered 2 times or more reaching a point at height h = j / (size - 1) with the sun at cos(zenith angle) muS = 2 * i / (size - 1) - 1,
+// per unit of scattering coefficient. Computed from second order scattering assuming an isotropic sky, see Hillaire (2020)
+constexpr size_t MULTIPLE_SCATTERING_SIZE = 32;
+constexpr int MULTIPLE_SCATTERING_DIRECTIONS = 64;
+
+// In-scattering table S(h, mu, muS, nu) : light scattered towards a point at height h, coming from the direction whose cosine with the vertical is mu,
+// integrated up to the edge of the atmosphere or the sea. The sun is at cos(zenith angle) muS and nu = cos(view, sun).
+// Every coordinate is linear in [-1, 1] (texel centers on the bounds) except h = (k / (SCATTERING_R - 1))^2 which is denser near the sea.
+// Stored as [h][mu][nu][muS] so that it can be uploaded as a 3D texture of (SCATTERING_NU * SCATTERING_MU_S) x SCATTERING_MU x SCATTERING_R texels
+// (main.frag interpolates nu by hand)
+constexpr size_t SCATTERING_R = 32, SCATTERING_MU = 64, SCATTERING_MU_S = 32, SCATTERING_NU = 8;
+constexpr size_t SCATTERING_LUT_TEXELS = SCATTERING_R * SCATTERING_MU * SCATTERING_MU_S * SCATTERING_NU;
+constexpr int SCATTERING_STEPS = 32;
+
+// opticalDepth is the table of bakeOpticalDepthLUT() with OPTICAL_DEPTH_LUT_SIZE, out has MULTIPLE_SCATTERING_SIZE^2 entries
+void bakeMultipleScatteringLUT(ThreadPool& pool, const ScatteringParams& params, const float* opticalDepth, vec3* out);
+
+// multipleScattering can be nullptr for single scattering only, out has SCATTERING_LUT_TEXELS entries
+void bakeScatteringLUT(ThreadPool& pool, const ScatteringParams& params, const float* opticalDepth, const vec3* multipleScattering, vec3* out);
+
+// same addressing as scattering() in main.frag, sun is a unit vector
+vec3 sampleScatteringLUT(const vec3* lut, const ScatteringParams& params, const vec3& p, const vec3& dir, const vec3& sun);
+
+#endif // ATMOSPHERE_H
@@ -0,0 +1,35 @@
+#ifndef BC4_H
+#define BC4_H
+
+#include <cstddef>
+#include <cstdint>
+
+class ThreadPool;
+
+// BC4 (GL_COMPRESSED_RED_RGTC1) : one channel, every 4x4 block of texels in 8 bytes, half the size of R8.
+// A block is two endpoints r0, r1 then a 3 bits index per texel (texel 0 in the lowest bits, row after row) into a palette :
+// - r0 > r1 : r0, r1 and 6 values evenly spaced between them
+// - r0 <= r1 : r0, r1, 4 values between them, 0 and 255
+// Images whose size isn't a multiple of 4 (the last mips) are padded by repeating their last row and column, like GL expects
+constexpr size_t BC4_BLOCK_BYTES = 8;
+constexpr uint32_t BC4_GL_INTERNAL_FORMAT = 0x8DBB; // GL_COMPRESSED_RED_RGTC1
+
+constexpr size_t bc4Size(size_t width, size_t height) { return (width + 3) / 4 * ((height + 3) / 4) * BC4_BLOCK_BYTES; }
+
+// The fast encoder takes the min and the max of the block as endpoints. The high quality one searches endpoints around them in both modes
+// for the smallest squared error, about 20 times slower (see solar_texturegen --bench-bc4)
+void encodeBC4Block(const unsigned char texels[16], unsigned char block[BC4_BLOCK_BYTES], bool highQuality = false);
+
+// Texels rounded to the closest byte, the GPU keeps the exact fraction : they differ by half a step at most
+void decodeBC4Block(const unsigned char block[BC4_BLOCK_BYTES], unsigned char texels[16]);
+
+// width x height texels (rows rowStride bytes apart) into bc4Size(width, height) bytes of blocks, block rows one after the other.
+// Returns the largest difference between a texel and its decoded value
+int compressBC4(const unsigned char* texels, size_t width, size_t height, size_t rowStride, unsigned char* blocks, bool highQuality = false);
+// same, rows of blocks spread over the pool
+int compressBC4(ThreadPool& pool, const unsigned char* texels, size_t width, size_t height, size_t rowStride, unsigned char* blocks, bool highQuality = false);
+
+// width x height texels, tightly packed
+void decompressBC4(const unsigned char* blocks, size_t width, size_t height, unsigned char* texels);
+
+#endif // BC4_H
@@ -6,15 +6,17 @@
 #include <vector>
 #include <deque>
 #include <memory>
+#include <array>
 
 #include "math.hpp"
 #include "planet.hpp"
+#include "noise.hpp"
 
 class Camera
 {
 public:
     Camera(GLFWwindow* __window, vec3 spawn);
-    void update(float& dt, const float& __time, const std::vector<PlanetData>& planets);
+    void update(float& dt, const float& __time, const PlanetSystem& planets);
 
     vec3 getPos() { return pos; }
     vec2 getAngle() { return theta; }
@@ -33,6 +35,13 @@ public:
         portalBasis2.coefs(pb2);
     }
 
+    // fbm and normalization range of the heightmaps of a planet (see terrain.hpp), the ground the camera collides with
+    void setTerrain(size_t planet, const FBMParams& params, float minValue, float maxValue)
+    {
+        terrainParams[planet] = params;
+        terrainRange[planet] = vec2(minValue, maxValue);
+    }
+
     void setSpeedRef(const float& v) { speedRef = v; }
     void setJumpStrength(const float& v) { jumpStrength = v; }
 
@@ -50,11 +59,11 @@ private:
     void jump(const float dt);
     void dash();
     void updateMouse();
-    PlanetData findClosest(const std::vector<PlanetData>& planets);
+    PlanetData findClosest(const PlanetSystem& planets);
     void applyGravity(const float& dt, const PlanetData& closest);
     void updatePlanetBasis(const PlanetData& closest);
     float heightHere(const PlanetData& pl) const;
-    float noise(const vec3& uvw) const;
+    float noise(const vec3& uvw, const FBMParams& params, const vec2& range) const;
     void teleportThroughPortal(const PlanetData& closest);
     bool wentThroughPortal(const vec3& plane, const vec3& center, const float& size) const;
     void bluePortal();
@@ -75,6 +84,8 @@ private:
     float jumpStrength{};
 
     float mountainAmplitude{}, seaLevel{};
+    std::array<FBMParams, NB_PLANETS> terrainParams{};
+    std::array<vec2, NB_PLANETS> terrainRange{};
 
     vec3 normal = vec3(0., 1., 0.), backRef = vec3(0., 0., 1.), leftRef = vec3(-1., 0., 0.);
     vec3 up = normal, back = backRef, left = leftRef;
@@ -0,0 +1,124 @@
+#ifndef HEIGHTMAP_H
+#define HEIGHTMAP_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <chrono>
+
+#include <vector>
+
+#include "noise.hpp"
+
+class ThreadPool;
+
+// wall-clock seconds spent in each stage of a bake
+struct BakeTimings
+{
+    double compute = 0.;   // evaluating the function (first pass for the heightmap : global range)
+    double normalize = 0.; // second pass : normalizing and quantizing the texels into the output
+    double mips = 0.;      // filtering the mip chain
+    double write = 0.;     // flushing the output to disk
+    double normals = 0.;   // the whole normal map
+    double compress = 0.;  // BC4 copy of the heightmap (solar_texturegen --compress)
+};
+
+double secondsSince(std::chrono::high_resolution_clock::time_point start);
+
+// Bump this whenever a change of the generator modifies the baked texels (noise, normalization, mip filter, layout...)
+// so that the heightmaps cached by an older version are baked again instead of being reused
+constexpr unsigned int HEIGHTMAP_BAKE_VERSION = 1;
+
+// Bakes the heightmap as a cube map (faces in the order GL expects them : +X, -X, +Y, -Y, +Z, -Z) with its whole mip chain,
+// into a KTX file whose levels can be uploaded as they are, without asking the driver to generate anything.
+// Compared with the old equirectangular map, texels are spread evenly over the sphere instead of piling up at the poles
+// (same equator density for 6 * (N/4)^2 texels instead of N^2) and the shader doesn't need any trigonometry to sample it.
+// Level 0 is cut in TILE_SIZE x TILE_SIZE tiles (the faces being stacked vertically) which are spread over a work-stealing pool,
+// in two streaming passes :
+// - the first one only reduces the min/max of every tile, nothing is stored
+// - the second one recomputes the tiles and writes them, normalized with the global range, into the mapped output file.
+//   It goes one band of tiles at a time and releases each band once written, so the resident memory stays around
+//   one band (TILE_SIZE rows) whatever the resolution
+// Every texel only depends on its position and on the global range : the output is byte-identical whatever the number of threads.
+// The parameters are written in the KTX key/value data ("SolarSystem.bake"), so every file says what made it.
+// If normalPath isn't null, the normal map (see below) is baked there too, and so is the max-height pyramid (see below) if maxPath isn't null
+bool generateSphericalFBMnoise(ThreadPool& pool, size_t faceSize, const FBMParams& params, const char* path, BakeTimings& timings, const char* normalPath = nullptr,
+                               const char* maxPath = nullptr);
+
+// Writes the heightmap baked above at path again as BC4 (see bc4.hpp) into bc4Path : the same levels and key/value data,
+// every face of every level compressed on the pool, ready for glCompressedTexImage2D.
+// Returns the largest difference between a texel and its decoded value, -1 if it failed
+int compressHeightmapBC4(ThreadPool& pool, const char* path, const char* bc4Path, bool highQuality = false);
+
+// Normal maps : main.frag shades the terrain with one tap in them instead of 4 heightmap samples for central differences.
+// A texel is the gradient of the normalized height (in [0, 1]) along the unit sphere, computed from the analytic derivatives of fbmd(),
+// divided by HEIGHTMAP_SLOPE_SCALE and stored as RGBA8 snorm (w unused). The normal of a planet whose surface is at radius + amplitude * height is
+// normalize(d - amplitude / radius * slope) : it depends on the planet, only the slope is baked.
+// They have half the resolution of their heightmap, shading doesn't need more
+constexpr float HEIGHTMAP_SLOPE_SCALE = 32.;
+constexpr size_t normalMapFaceSize(size_t faceSize) { return faceSize > 1 ? faceSize / 2 : 1; }
+
+// Max-height pyramids : main.frag marches the terrain in large steps wherever the ray is far above it and only takes small ones near the surface.
+// A texel of level k of the pyramid is the max of the 2^k x 2^k texels of the heightmap under it (not their average like the mips),
+// so a bilinear max-reduced tap of level k bounds the heights within half a texel of level k around the direction.
+// The pyramid starts at level HEIGHTMAP_MAX_BASE_LEVEL of the heightmap : the finer levels are too small to skip anything
+constexpr int HEIGHTMAP_MAX_BASE_LEVEL = 2;
+
+// Heightmaps are baked in tiles of HEIGHTMAP_TILE_SIZE x HEIGHTMAP_TILE_SIZE texels of a face
+constexpr size_t HEIGHTMAP_TILE_SIZE = 256;
+// levels of a tile with its mips, down to 1x1
+constexpr int HEIGHTMAP_TILE_LEVELS = 9;
+// bytes of the output of bakeHeightmapTile()
+constexpr size_t HEIGHTMAP_TILE_BYTES = (4 * HEIGHTMAP_TILE_SIZE * HEIGHTMAP_TILE_SIZE - 1) / 3;
+// same for the normal map of a tile, which has half its size
+constexpr size_t NORMAL_TILE_SIZE = HEIGHTMAP_TILE_SIZE / 2;
+constexpr int NORMAL_TILE_LEVELS = HEIGHTMAP_TILE_LEVELS - 1;
+constexpr size_t NORMAL_TILE_BYTES = 4 * (4 * NORMAL_TILE_SIZE * NORMAL_TILE_SIZE - 1) / 3;
+// and for its max-height pyramid, levels HEIGHTMAP_MAX_BASE_LEVEL ... HEIGHTMAP_TILE_LEVELS - 1
+constexpr size_t MAX_HEIGHT_TILE_SIZE = HEIGHTMAP_TILE_SIZE >> HEIGHTMAP_MAX_BASE_LEVEL;
+constexpr int MAX_HEIGHT_TILE_LEVELS = HEIGHTMAP_TILE_LEVELS - HEIGHTMAP_MAX_BASE_LEVEL;
+constexpr size_t MAX_HEIGHT_TILE_BYTES = (4 * MAX_HEIGHT_TILE_SIZE * MAX_HEIGHT_TILE_SIZE - 1) / 3;
+
+// Direction of the texel (i, j) of a face of a cube map, following the GL convention :
+// faces are +X, -X, +Y, -Y, +Z, -Z and row 0 is t = 0 (see the cube map face selection table of the GL spec)
+vec3 cubeDirection(size_t face, size_t i, size_t j, size_t faceSize);
+
+// Whole heightmap and its normal map in memory (the 6 faces one after the other, no mips), for the small ones.
+// Also returns the range it was normalized with
+void bakeHeightmapFaces(ThreadPool& pool, size_t faceSize, const FBMParams& params, std::vector<unsigned char>& texels, std::vector<signed char>& normals,
+                        float& minValue, float& maxValue);
+
+// Max-height pyramid of the faces given by bakeHeightmapFaces() : its levels HEIGHTMAP_MAX_BASE_LEVEL ... log2(faceSize) one after the other,
+// each one with its 6 faces
+void maxHeightPyramid(const std::vector<unsigned char>& texels, size_t faceSize, std::vector<unsigned char>& pyramid);
+
+// One tile of a heightmap of faceSize (a multiple of HEIGHTMAP_TILE_SIZE), the one whose first texel is (i0, j0) in face,
+// normalized with [minValue, maxValue] instead of the range of the whole map so that tiles can be baked in any order.
+// out gets HEIGHTMAP_TILE_BYTES : level 0 then every mip, each one a 2x2 box filter of the previous one like in the KTX bakes,
+// normals gets NORMAL_TILE_BYTES : the same for the matching tile of the normal map,
+// maxHeights gets MAX_HEIGHT_TILE_BYTES : the levels of the max-height pyramid over the tile
+void bakeHeightmapTile(size_t faceSize, const FBMParams& params, size_t face, size_t i0, size_t j0, float minValue, float maxValue,
+                       unsigned char* out, signed char* normals, unsigned char* maxHeights);
+
+// Page of a virtual heightmap (see virtualheightmap.hpp) : the size x size texels of a heightmap of faceSize from (i0, j0) in face
+// with a border of one texel on every side (clamped to the face), normalized with [minValue, maxValue].
+// heights gets (size + 2)^2 texels, normals the normal map at the same resolution (4 times as many bytes). size is at most HEIGHTMAP_TILE_SIZE - 2
+void bakeHeightmapPage(size_t faceSize, const FBMParams& params, size_t face, size_t i0, size_t j0, size_t size, float minValue, float maxValue,
+                       unsigned char* heights, signed char* normals);
+
+// Bake cache : a heightmap is stored as <cacheDir>/heightmap-<key>.ktx, the key being a hash of everything that changes its texels
+// (face size, fbm parameters and HEIGHTMAP_BAKE_VERSION), so a cached file is reused as long as it is what a new bake would give
+uint64_t heightmapKey(size_t faceSize, const FBMParams& params);
+// same, for texels normalized with [minValue, maxValue] instead of the range of the whole map (streamed tiles, virtual pages)
+uint64_t heightmapKey(size_t faceSize, const FBMParams& params, float minValue, float maxValue);
+std::string heightmapCachePath(const std::string& cacheDir, size_t faceSize, const FBMParams& params);
+// <cacheDir>/normals-<key>.ktx, baked with the heightmap
+std::string normalMapCachePath(const std::string& cacheDir, size_t faceSize, const FBMParams& params);
+// <cacheDir>/maxheight-<key>.ktx, same
+std::string maxHeightCachePath(const std::string& cacheDir, size_t faceSize, const FBMParams& params);
+
+// Returns the path of the cached heightmap, baking it (and its normal map and max-height pyramid) first if it is missing. The bake is written under a temporary name
+// then renamed, so that another process never reads a partial file. Returns an empty string if the bake failed
+std::string bakeHeightmapCached(ThreadPool& pool, const std::string& cacheDir, size_t faceSize, const FBMParams& params, BakeTimings* timings = nullptr);
+
+#endif // HEIGHTMAP_H
@@ -2,6 +2,7 @@
 #define INIT_H
 
 #include <GLFW/glfw3.h>
+#include <stddef.h>
 
 #define RESOLUTION_W 1366
 #define RESOLUTION_H 768
@@ -19,16 +20,20 @@
 extern "C" {
 #endif
 
-unsigned char *read_ppm(int is_pgm, const char *filename_ppm, int *width, int *height);
+// Contenu d'un fichier dans le pack d'assets (voir pack.h) s'il y en a un, suivi d'un '\0'. NULL sinon, il faut alors lire le fichier
+const void *find_asset(const char *path, size_t *size);
 
-unsigned int init_texture(const char* path);
-
-// Renvoie un shader en c_str à partir de son fichier source
+// Renvoie le contenu d'un fichier source en c_str (à free), NULL s'il n'existe pas. Les #include sont gérés par load_shader (voir shaderloader.h)
 char *read_shader(const char *filename);
 // Compile un shader (donc l'envoie à OpenGL) à partir du code source en c_str
 unsigned int compile_shader(unsigned int type, const char *source);
-// Compile deux shaders envoyés en param et renvoie un programme OpenGL
+// Compile deux shaders envoyés en param et renvoie un programme OpenGL, rechargé depuis son binaire s'il a déjà été compilé (voir programcache.h)
 int create_program(const char *vertex_shader, const char *fragment_shader);
+// create_program en deux temps : start_program lance la compilation et l'édition de liens (ou charge le binaire, *from_binary vaut alors 1)
+// sans attendre le driver, finish_program attend la fin, affiche les erreurs (renvoie 0) ou sauve le binaire.
+// Avec KHR_parallel_shader_compile le driver compile en arrière-plan entre les deux (voir shaderreload.hpp)
+unsigned int start_program(const char *vertex_shader, const char *fragment_shader, int *from_binary);
+int finish_program(unsigned int program, int from_binary, const char *vertex_shader, const char *fragment_shader);
 
 // Initialise le contexte OpenGL, compile les shaders et renvoie le program ID
 unsigned int init(GLFWwindow** window);
@@ -36,6 +41,8 @@ unsigned int init(GLFWwindow** window);
 // first render pass will be in a low res texture
 void generateLowResBuf(unsigned int* frameBuf, unsigned int* outTexture);
 unsigned int initUI();
+// programmes dont framebuffer_size_callback met à jour l'aspect ratio, après leur rechargement
+void set_global_programs(unsigned int program, unsigned int ui_program);
 
 #ifdef __cplusplus
 }
@@ -18,8 +18,6 @@ struct InputData {
     float cameraSpeed;
     float jumpStrength;
 
-    float nb_steps_i;
-    float nb_steps_j;
     float atmosRadius[NB_PLANETS];
     float atmosFalloff[NB_PLANETS];
     float atmosScattering;
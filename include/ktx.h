@@ -0,0 +1,37 @@
+#ifndef KTX_H
+#define KTX_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// KTX 1.1 texture container, see https://registry.khronos.org/KTX/specs/1.0/ktxspec.v1.html
+// The header is followed by bytesOfKeyValueData bytes of metadata, then for every mip level :
+//   uint32 imageSize (size of one face for cube maps), then each face padded to 4 bytes.
+// Rows are padded to 4 bytes (GL_UNPACK_ALIGNMENT = 4) for uncompressed formats
+
+#define KTX_IDENTIFIER_SIZE 12
+#define KTX_ENDIANNESS 0x04030201
+
+static const unsigned char KTX_IDENTIFIER[KTX_IDENTIFIER_SIZE] = { 0xAB, 0x4B, 0x54, 0x58, 0x20, 0x31, 0x31, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A };
+
+typedef struct
+{
+    unsigned char identifier[KTX_IDENTIFIER_SIZE];
+    uint32_t endianness;
+    uint32_t glType;                // 0 for compressed formats
+    uint32_t glTypeSize;
+    uint32_t glFormat;              // 0 for compressed formats
+    uint32_t glInternalFormat;
+    uint32_t glBaseInternalFormat;
+    uint32_t pixelWidth;
+    uint32_t pixelHeight;
+    uint32_t pixelDepth;
+    uint32_t numberOfArrayElements;
+    uint32_t numberOfFaces;         // 6 for cube maps
+    uint32_t numberOfMipmapLevels;  // 0 means the loader should generate them
+    uint32_t bytesOfKeyValueData;
+} KTXHeader;
+
+static inline size_t ktx_align4(size_t n) { return (n + 3) & ~(size_t)3; }
+
+#endif // KTX_H
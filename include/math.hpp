@@ -54,6 +54,7 @@ struct vec3 {
 
     static float dot(const vec3& x, const vec3& y) { return x.dot(y); }
     static vec3 floor(const vec3& p) { return vec3((float)(int)p.x - (p.x < 0. ? 1. : 0.), (float)(int)p.y - (p.y < 0. ? 1. : 0.), (float)(int)p.z - (p.z < 0. ? 1. : 0.)); }
+    static vec3 exp(const vec3& p) { return vec3(expf(p.x), expf(p.y), expf(p.z)); }
 
     // rotates any vector around any axis
     // I spent hours deriving this function for it not to be useful at all bruh
@@ -0,0 +1,50 @@
+#ifndef NOISE_H
+#define NOISE_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "math.hpp"
+
+// 3D value noise, found on https://gist.github.com/patriciogonzalezvivo/670c22f3966e662d2f83
+// same function as noise() in main.frag's ancestor, used by the texture baker and for the camera collisions
+float noise(vec3 p);
+
+constexpr int FBM_MAX_OCTAVES = 16;
+
+struct FBMParams
+{
+    int octaves = 6;
+    float frequency = 8.0;      // of the first octave, doubled at every octave
+    float gain = 1.0 / 2.71828; // amplitude ratio between two octaves
+    unsigned int seed = 0;
+    // added to the scaled position of each octave, derived from the seed (all zeros for seed 0)
+    vec3 offsets[FBM_MAX_OCTAVES]{};
+
+    void setSeed(unsigned int s);
+};
+
+// sum of value noise octaves for yellow noise (fractional brownian motion) : see https://iquilezles.org/articles/fbm/
+float fbm(vec3 x, const FBMParams& params = FBMParams());
+
+// noise() and its gradient, from the derivative of the smoothstep between the corners of the cell (see https://iquilezles.org/articles/gradientnoise/)
+float noised(vec3 p, vec3& gradient);
+
+// fbm() and its gradient with respect to x, exact where the finite differences of fbm() are only close
+float fbmd(vec3 x, vec3& gradient, const FBMParams& params = FBMParams());
+
+// Evaluates fbm for n directions given as separate x, y, z arrays (struct of arrays).
+// 8 (AVX2) or 4 (SSE2) directions go through the octaves together in registers,
+// the kernel is picked at runtime from what the CPU supports and the tail falls back to the scalar fbm
+void fbmBatch(const float* x, const float* y, const float* z, float* out, size_t n, const FBMParams& params = FBMParams());
+
+// "avx2", "sse2" or "scalar"
+const char* fbmBatchKernelName();
+
+// forces a kernel ("avx2", "sse2", "scalar"), returns false if the CPU can't run it
+bool fbmBatchSelectKernel(const char* name);
+
+// number of representable floats between a and b, used to compare the kernels with the scalar fbm
+int64_t ulpDistance(float a, float b);
+
+#endif // NOISE_H
@@ -0,0 +1,76 @@
+#ifndef PACK_H
+#define PACK_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Asset pack : every shader the renderer loads at startup in one file, written by solar_pack (src/packer.cpp).
+// Layout, little endian :
+//   PackHeader
+//   PackEntry[entryCount]       sorted by name, so that a lookup is a binary search
+//   blobs                       each one starts on a PACK_ALIGNMENT boundary and is followed by a '\0' (not counted in its size),
+//                               so that shaders can be given to glShaderSource as they are
+// The pack is mapped once and pack_find() hands out pointers into the mapping, nothing is copied or allocated
+
+#define PACK_MAGIC "SOLARPAK"
+#define PACK_VERSION 1
+#define PACK_ALIGNMENT 64
+#define PACK_NAME_SIZE 48
+// default name, next to the executable (see pack_open_default)
+#define PACK_FILE_NAME "solar.pack"
+
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t entryCount;
+    uint64_t tocChecksum;   // pack_checksum of the entries
+    uint64_t reserved;
+} PackHeader;
+
+typedef struct
+{
+    char name[PACK_NAME_SIZE];  // path relative to the repository ("shaders/main.frag"), '\0' terminated
+    uint64_t offset;            // from the start of the file
+    uint64_t size;
+    uint64_t checksum;          // pack_checksum of the size bytes
+} PackEntry;
+
+typedef struct
+{
+    const unsigned char *data;
+    size_t size;
+    const PackEntry *entries;
+    uint32_t entryCount;
+    unsigned char *verified;    // one flag per entry, blobs are checked the first time they are found
+} AssetPack;
+
+// FNV-1a 64 bits
+uint64_t pack_checksum(const void *data, size_t size);
+
+static inline size_t pack_align(size_t n) { return (n + PACK_ALIGNMENT - 1) & ~(size_t)(PACK_ALIGNMENT - 1); }
+
+// Maps path and checks its header and table of contents. Returns 0 (and says why) if it isn't a valid pack
+int pack_open(const char *path, AssetPack *pack);
+// PACK_FILE_NAME in the directory of the executable, so that the working directory doesn't matter. Returns 0 quietly if there is none
+int pack_open_default(AssetPack *pack);
+void pack_close(AssetPack *pack);
+
+// The repository, parent of the directory of the executable (the build directory), '/' terminated. The shaders and the caches are
+// found from it rather than from the working directory
+const char *asset_root(void);
+// asset_root() followed by relative ("shaders/main.frag", named like the pack entries) in path. 0 if it doesn't fit
+int asset_path(const char *relative, char *path, size_t size);
+
+// Blob called name, its size in *size (can be NULL). NULL if the pack has no such entry or its checksum doesn't match
+const void *pack_find(AssetPack *pack, const char *name, size_t *size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // PACK_H
@@ -1,6 +1,8 @@
 #ifndef PLANET_H
 #define PLANET_H
 
+#include <array>
+
 #include "math.hpp"
 #include "input.hpp"
 
@@ -22,39 +24,43 @@ struct PlanetData
     vec3 peakColor;
 };
 
-class Planet
+// The planets as a structure of arrays, one array per field : the hot arrays (position, radius, mass) are read every frame
+// by the orbits, the camera and the heightmaps without pulling the cold ones (colors, atmosphere) into the cache, which are
+// only read to pack the PlanetBlock and when a planet is wanted as a whole
+struct PlanetSystem
 {
-public:
-    Planet(const vec3& __pos, const float& __mass, const float& __radius, 
+    // hot
+    std::array<vec3, NB_PLANETS> pos{};
+    std::array<float, NB_PLANETS> radius{};
+    std::array<float, NB_PLANETS> mass{};
+    std::array<float, NB_PLANETS> periodDuration{};
+
+    // cold
+    std::array<float, NB_PLANETS> mountainAmplitude{};
+    std::array<float, NB_PLANETS> seaLevel{};
+    std::array<vec4, NB_PLANETS> waterColor{};
+    std::array<float, NB_PLANETS> atmosFalloff{};
+    std::array<float, NB_PLANETS> atmosRadius{};
+    std::array<vec3, NB_PLANETS> atmosColor{};
+
+    std::array<vec3, NB_PLANETS> beachColor{};
+    std::array<vec3, NB_PLANETS> grassColor{};
+    std::array<vec3, NB_PLANETS> peakColor{};
+
+    static constexpr size_t size() { return NB_PLANETS; }
+
+    // planet i starts at __pos turned by __phase around the sun, and goes around it in __periodDuration seconds
+    void set(size_t i, const vec3& __pos, const float& __mass, const float& __radius, 
         const float& __mountainAmplitude, const float& __seaLevel, const vec4& __waterColor, 
         const float& __atmosFalloff, const float& __atmosRadius, const vec3& __atmosColor, 
         const vec3& __beachColor, const vec3& __grassColor, const vec3& __peakColor, 
         const float& __periodDuration, const float& __phase);
-    
-    PlanetData getInfo() const;
 
-    void update(const float& dt);
-
-private:
-    vec3 pos{};
-    float mass = 1.;
-    float radius = 1.;
-
-    const vec3 sunPos = vec3(0.,30.,10360.);
-    vec3 otherFocal{};
-    float periodDuration{};
-    float phase{};
+    PlanetData getInfo(size_t i) const;
+    // index of the planet whose center is the closest to p
+    size_t closest(const vec3& p) const;
 
-    float mountainAmplitude;
-    float seaLevel;
-    vec4 waterColor;
-    float atmosFalloff;
-    float atmosRadius;
-    vec3 atmosColor;
-
-    vec3 beachColor;
-    vec3 grassColor;
-    vec3 peakColor;
+    void update(const float& dt);
 };
 
 #endif
\ No newline at end of file
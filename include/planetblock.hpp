@@ -0,0 +1,86 @@
+#ifndef PLANETBLOCK_H
+#define PLANETBLOCK_H
+
+#include <cstddef>
+
+#include "input.hpp"
+
+// Mirror of the PlanetBlock uniform block of main.frag (std140) : every element of an array is rounded up to 16 bytes,
+// so floats and vec3s carry their padding
+struct alignas(16) Std140Float
+{
+    float value;
+    float pad[3];
+};
+
+struct alignas(16) Std140Vec3
+{
+    float x, y, z;
+    float pad;
+};
+
+struct alignas(16) Std140Vec4
+{
+    float x, y, z, w;
+};
+
+struct PlanetBlock
+{
+    Std140Vec3 planetPos[NB_PLANETS];
+    Std140Float uPlanetRadius[NB_PLANETS];
+    Std140Float mountainAmplitude[NB_PLANETS];
+    Std140Float seaLevel[NB_PLANETS];
+    Std140Vec4 waterColor[NB_PLANETS];
+    Std140Float atmosFalloff[NB_PLANETS];
+    Std140Float atmosRadius[NB_PLANETS];
+    Std140Vec3 atmosColor[NB_PLANETS];
+    Std140Vec3 beachColor[NB_PLANETS];
+    Std140Vec3 grassColor[NB_PLANETS];
+    Std140Vec3 peakColor[NB_PLANETS];
+};
+
+// the offsets std140 gives to the members of the block, one 16 bytes slot per element
+static_assert(sizeof(Std140Float) == 16 && sizeof(Std140Vec3) == 16 && sizeof(Std140Vec4) == 16);
+static_assert(offsetof(PlanetBlock, uPlanetRadius) == 16 * NB_PLANETS);
+static_assert(offsetof(PlanetBlock, mountainAmplitude) == 2 * 16 * NB_PLANETS);
+static_assert(offsetof(PlanetBlock, seaLevel) == 3 * 16 * NB_PLANETS);
+static_assert(offsetof(PlanetBlock, waterColor) == 4 * 16 * NB_PLANETS);
+static_assert(offsetof(PlanetBlock, atmosFalloff) == 5 * 16 * NB_PLANETS);
+static_assert(offsetof(PlanetBlock, atmosRadius) == 6 * 16 * NB_PLANETS);
+static_assert(offsetof(PlanetBlock, atmosColor) == 7 * 16 * NB_PLANETS);
+static_assert(offsetof(PlanetBlock, beachColor) == 8 * 16 * NB_PLANETS);
+static_assert(offsetof(PlanetBlock, grassColor) == 9 * 16 * NB_PLANETS);
+static_assert(offsetof(PlanetBlock, peakColor) == 10 * 16 * NB_PLANETS);
+static_assert(sizeof(PlanetBlock) == 11 * 16 * NB_PLANETS);
+
+// binding point of the block, set in main.frag
+constexpr unsigned int PLANET_BLOCK_BINDING = 0;
+
+// The block lives in a persistently mapped buffer with one copy per frame in flight : a frame writes its copy while the GPU
+// still reads the ones of the previous frames, the fence of a copy tells when it can be written again (it always can be,
+// unless the GPU is more than two frames behind)
+class PlanetUniformBuffer
+{
+public:
+    PlanetUniformBuffer();
+    ~PlanetUniformBuffer();
+
+    PlanetUniformBuffer(const PlanetUniformBuffer&) = delete;
+    PlanetUniformBuffer& operator=(const PlanetUniformBuffer&) = delete;
+
+    // copies block into the copy of this frame and binds it to PLANET_BLOCK_BINDING
+    void update(const PlanetBlock& block);
+    // once per frame after the draws reading the block
+    void endFrame();
+
+private:
+    static constexpr int NB_COPIES = 3;
+
+    unsigned int buffer = 0;
+    unsigned char* mapped = nullptr;
+    size_t stride = 0; // sizeof(PlanetBlock) rounded up to GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+    void* fences[NB_COPIES] = {}; // GLsync
+    unsigned int frame = 0;
+};
+
+#endif // PLANETBLOCK_H
@@ -0,0 +1,35 @@
+#ifndef PNM_H
+#define PNM_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Binary PPM (P6, RGB) and PGM (P5, grey) images mapped in memory : pixels points straight into the page cache,
+// so the texture upload reads the file without any copy in between
+typedef struct
+{
+    const unsigned char *pixels; // width * height * channels bytes, rows from top to bottom without padding
+    int width, height, channels;
+    void *mapping;
+    size_t mapping_size;
+} PNMImage;
+
+// Header of a binary PPM/PGM in the size bytes of data : magic, width, height and maxval separated by whitespace,
+// with # comments (up to the end of their line) anywhere between them or right after maxval, then exactly one whitespace
+// before the pixels.
+// Only 8 bits images (maxval 255) are accepted, they are the ones GL can take as is.
+// Returns the offset of the pixels, 0 if the header is invalid or the file too short for its pixels
+size_t pnm_parse_header(const unsigned char *data, size_t size, int *width, int *height, int *channels);
+
+// Returns 0 (and says why) if path can't be mapped or isn't a valid image
+int pnm_map(const char *path, PNMImage *image);
+void pnm_unmap(PNMImage *image);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // PNM_H
@@ -0,0 +1,35 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Startup profiler : nested phases timed on the CPU and, once there is a GL context, on the GPU with timestamp queries
+// (what the GL calls of a phase cost the GPU, which runs behind the CPU). profile_write_trace() saves them as a Chrome trace
+// (chrome://tracing or https://ui.perfetto.dev), the CPU phases on one track and the GPU ones on another.
+// Main thread only, and at most PROFILE_MAX_EVENTS phases : it is meant for the startup, not for every frame
+#define PROFILE_MAX_EVENTS 256
+
+// name is copied
+void profile_begin(const char *name);
+void profile_end(void);
+
+// waits for the GPU timestamps, then writes the trace to path and the top level phases to stdout. Returns 0 if path can't be written.
+// The phases after it aren't recorded
+int profile_write_trace(const char *path);
+
+#ifdef __cplusplus
+}
+
+// a phase as long as the scope
+struct ProfileScope
+{
+    explicit ProfileScope(const char* name) { profile_begin(name); }
+    ~ProfileScope() { profile_end(); }
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+};
+#endif
+
+#endif // PROFILER_H
@@ -0,0 +1,22 @@
+#ifndef PROGRAMCACHE_H
+#define PROGRAMCACHE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Linked programs saved with glGetProgramBinary as <asset_root()><PROGRAM_CACHE_DIR>/program-<key>.bin (see pack.h), the key being a hash of the expanded sources
+// and of GL_VENDOR, GL_RENDERER and GL_VERSION : a binary is only valid for the driver which made it, a new driver or an edited
+// shader just misses the cache. Next to the bake cache of the heightmaps (see heightmap.hpp)
+#define PROGRAM_CACHE_DIR "assets/cache"
+
+// Program linked from the binary saved for these sources, 0 if there is none or the driver refuses it (then it is removed)
+unsigned int load_program_binary(const char *vertex_shader, const char *fragment_shader);
+// program must be linked, with GL_PROGRAM_BINARY_RETRIEVABLE_HINT set before linking. Does nothing if the driver has no binary format
+void save_program_binary(unsigned int program, const char *vertex_shader, const char *fragment_shader);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // PROGRAMCACHE_H
@@ -0,0 +1,31 @@
+#ifndef SHADERLOADER_H
+#define SHADERLOADER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// GLSL sources with #include "file" resolved, relative to the directory of the file that includes it. A file is only pasted
+// once per shader (like #pragma once), so that shared modules can include each other. Every pasted file is framed with #line
+// directives : compile errors give the line in the file itself, and the source string number is the file in
+// shader_file_name().
+// Files are read whole, from the asset pack when there is one (see find_asset), and kept : a module shared by several shaders
+// is only read once, and a shader expanded again (the same program rebuilt) comes straight from the cache
+
+// Expanded source of the shader at path, owned by the cache. NULL (and says why) if it or one of its includes is missing
+const char *load_shader(const char *path);
+
+// Path of the file with source string number n in the #line directives, NULL if there is none
+const char *shader_file_name(int n);
+
+// reads the files even when they are in the asset pack, which only has them as they were when it was built (for shaderreload.hpp)
+void shader_read_files(int on);
+
+// forgets every file and expansion, the next load_shader reads them again (after the shaders are edited)
+void shader_cache_clear(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SHADERLOADER_H
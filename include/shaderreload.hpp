@@ -0,0 +1,68 @@
+#ifndef SHADERRELOAD_H
+#define SHADERRELOAD_H
+
+#include <string>
+#include <vector>
+#include <set>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <functional>
+
+// Shader hot-reload : a thread watches the directories of every shader file (includes too, see shaderloader.h) with inotify.
+// After a change the programs are rebuilt from the files on the GL thread, a frame at a time :
+// - with KHR_parallel_shader_compile (or ARB_), start_program() returns at once and the driver compiles on its own threads,
+//   update() polls GL_COMPLETION_STATUS_KHR every frame and the frames go on with the old program meanwhile
+// - without it, the rebuild blocks the frame it starts in
+// A program which fails to compile or link is dropped and the old one stays, the errors are printed (see finish_program in init.h)
+class ShaderReloader
+{
+public:
+    ShaderReloader();
+    ~ShaderReloader();
+
+    ShaderReloader(const ShaderReloader&) = delete;
+    ShaderReloader& operator=(const ShaderReloader&) = delete;
+
+    // program is replaced in place by the new one, between two frames. onSwap is then called with the new program bound,
+    // to get its uniform locations again and set the uniforms which aren't set every frame
+    void watch(unsigned int& program, const std::string& vertexPath, const std::string& fragmentPath, std::function<void()> onSwap);
+
+    // once per frame on the GL thread, before drawing
+    void update();
+
+private:
+    struct Watched
+    {
+        unsigned int* program;
+        std::string vertexPath, fragmentPath;
+        std::function<void()> onSwap;
+        // rebuild in flight, 0 if none
+        unsigned int pending = 0;
+        int fromBinary = 0;
+        std::string vertexSource, fragmentSource;
+    };
+
+    void watchLoop();
+    // watches the directories of the files in the shader cache
+    void watchShaderFiles();
+    void startRebuilds();
+    bool finishRebuild(Watched& w);
+
+    int inotifyFd = -1;
+    int stopFd = -1;
+    std::thread watcher;
+    bool parallelCompile = false;
+
+    std::mutex mutex;
+    std::map<int, std::string> watchDirs; // inotify watch -> directory
+    std::set<std::string> files;
+
+    std::atomic<bool> changed{ false };
+    std::atomic<long long> lastChange{ 0 }; // steady clock nanoseconds of the last event
+
+    std::vector<Watched> programs;
+};
+
+#endif // SHADERRELOAD_H
@@ -0,0 +1,141 @@
+#ifndef TERRAIN_H
+#define TERRAIN_H
+
+#include <vector>
+#include <string>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <memory>
+
+#include "planet.hpp"
+#include "noise.hpp"
+#include "pack.h"
+
+class ThreadPool;
+struct MainUniforms;
+struct UploadStats;
+class VirtualHeightmaps;
+class UploadRing;
+
+// the terrain of planet i : the same fbm for every planet, with its own seed
+FBMParams planetHeightmapParams(size_t planet);
+
+struct TerrainStreamingParams
+{
+    size_t faceSize = 2048;                // of the full resolution heightmaps, a multiple of HEIGHTMAP_TILE_SIZE
+    size_t placeholderFaceSize = 64;       // baked for every planet at startup
+    size_t residencyBudget = 320u << 20;   // bytes of full resolution heightmaps, normal maps and max-height pyramids on the GPU (about 52 MB per planet at 2048)
+    int maxUploadsPerFrame = 8;            // tiles sent to the GPU per frame, the rest waits for the next frames
+    size_t uploadRingSize = 8u << 20;      // bytes of the pixel buffer the tiles go through (see uploadring.hpp), a few frames of uploads
+    bool compressHeightmaps = true;        // full resolution heightmaps in BC4 (see bc4.hpp), half the memory of R8
+    size_t virtualFaceSize = 65536;        // of the virtual heightmaps of the resident planets (see virtualheightmap.hpp), faceSize to disable them
+    size_t pageBudget = 64u << 20;         // bytes of their resident pages
+    int maxPageUploadsPerFrame = 16;
+    std::string cacheDir = std::string(asset_root()) + "assets/cache"; // of the tile files and of the page files
+};
+
+// Per-planet heightmaps and their normal maps (see heightmap.hpp), generated on demand in the background.
+// At startup every planet gets a placeholder heightmap (placeholderFaceSize, a few ms for all of them), stored in a cube map array.
+// The full resolution heightmaps live in the layers of another cube map array, which only has residencyBudget / (bytes of one layer) layers :
+// they are given to the planets closest to the camera, a planet which loses its layer goes back to its placeholder.
+// The tiles of the resident planets are loaded by the pool, always the one closest to the camera first, and uploaded a few per frame
+// through a persistently mapped pixel buffer, so that neither the startup nor the frames wait for the full resolution heightmaps.
+// A third array (one texel per tile) tells main.frag which tiles are there, the others still sample the placeholder.
+// Both kinds of heightmaps come with their max-height pyramid, read with max-reduced bilinear filtering (GL_ARB_texture_filter_minmax) by the terrain march.
+// A tile is read from the tile file of its planet (<cacheDir>/tiles-<key>.bin, one record per tile at a fixed offset, the key
+// from heightmapKey() with the range of the tiles), or baked and written there for the next launches when it isn't there yet.
+// Tiles are normalized with the range of the placeholder so that both match. Compressed tiles raise their max-height pyramid by their BC4 error,
+// which keeps it a bound of what main.frag samples.
+// Closer than a texel of the layers, main.frag samples the virtual heightmap of the planet instead
+class PlanetHeightmaps
+{
+public:
+    PlanetHeightmaps(ThreadPool& __pool, const PlanetSystem& planets, const TerrainStreamingParams& __params = TerrainStreamingParams());
+    ~PlanetHeightmaps(); // waits for the tiles being baked
+
+    PlanetHeightmaps(const PlanetHeightmaps&) = delete;
+    PlanetHeightmaps& operator=(const PlanetHeightmaps&) = delete;
+
+    // once per frame : hands the layers to the closest planets, queues their tiles and uploads the baked ones
+    void update(const vec3& cameraPos, const PlanetSystem& planets);
+
+    // sets the uniforms of main.frag which only change with the program (locations resolved for the program in use) : the samplers
+    // of unit ... unit + 9 and the sizes. After every link, it also makes the next bind() send the layers of the planets again
+    void setUniforms(const MainUniforms& uniforms, int unit);
+    // binds the arrays to unit ... unit + 9 and sends the layers of the planets if they changed, counted in uploads
+    void bind(const MainUniforms& uniforms, int unit, UploadStats& uploads);
+    // once per frame after drawing with them
+    void endFrame();
+
+    // every layer has a planet and all their tiles are there
+    bool fullDetail() const;
+
+    // the fbm a planet is baked from and the range its heights are normalized with
+    const FBMParams& terrainParams(size_t planet) const { return states[planet].params; }
+    void terrainRange(size_t planet, float& minValue, float& maxValue) const { minValue = states[planet].minValue; maxValue = states[planet].maxValue; }
+
+private:
+    struct Tile
+    {
+        size_t planet, face, i0, j0;
+        unsigned int generation; // of the planet's residency when it was queued
+    };
+
+    struct BakedTile
+    {
+        Tile tile;
+        std::vector<unsigned char> texels; // or its BC4 blocks, level after level
+        std::vector<signed char> normals;
+        std::vector<unsigned char> maxHeights;
+    };
+
+    struct PlanetState
+    {
+        FBMParams params;
+        float minValue = 0., maxValue = 1.; // range of the placeholder
+        int layer = -1;
+        unsigned int generation = 0;
+        size_t tilesLeft = 0;
+        std::chrono::high_resolution_clock::time_point residentSince;
+    };
+
+    void makeResident(size_t planet, int layer);
+    void evict(size_t planet);
+    void bakeNextTile();
+    int tileFile(size_t planet); // opened on first use, -1 if it can't be
+    size_t tileRecordBytes() const;
+    bool uploadTile(const BakedTile& baked); // false if the upload ring is full, the tile waits for the next frame
+    void setMaxHeightFilter() const; // of the bound max-height pyramid
+
+private:
+    ThreadPool& pool;
+    TerrainStreamingParams params;
+    size_t tilesPerFace = 0;
+    int nbLayers = 0;
+
+    unsigned int placeholderTexture = 0, heightmapTexture = 0, tileMaskTexture = 0;
+    unsigned int placeholderNormalTexture = 0, normalTexture = 0;
+    unsigned int placeholderMaxTexture = 0, maxHeightTexture = 0;
+    bool maxReduction = false;
+    std::unique_ptr<VirtualHeightmaps> pages;
+    std::unique_ptr<UploadRing> ring;
+    std::vector<PlanetState> states;
+    std::vector<int> layerPlanet; // -1 when the layer is free
+    bool layersChanged = true; // since heightmapLayer was last sent
+
+    // shared with the jobs
+    std::mutex mutex;
+    std::condition_variable idle;
+    std::vector<Tile> pending;
+    std::vector<BakedTile> baked;
+    std::vector<vec3> tileDirections; // center of every tile of a face, face after face
+    std::vector<int> tileFiles; // per planet, -1 until opened
+    // where the planets were at the last update
+    std::array<vec3, NB_PLANETS> snapshotPos{};
+    std::array<float, NB_PLANETS> snapshotRadius{};
+    vec3 camera;
+    unsigned int inFlight = 0;
+};
+
+#endif // TERRAIN_H
@@ -0,0 +1,54 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+
+// Work-stealing thread pool : every worker owns a deque, pops its own jobs from the back
+// and steals from the front of the other deques when it runs out of work
+class ThreadPool
+{
+public:
+    explicit ThreadPool(unsigned int nbThreads = 0); // 0 means one worker per core
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void submit(std::function<void()> job);
+
+    // runs job(0) ... job(n - 1) on the pool and blocks until all of them are done
+    // the calling thread also runs jobs while it waits, so it is safe to call it from a job
+    void parallelFor(size_t n, const std::function<void(size_t)>& job);
+
+    unsigned int size() const { return static_cast<unsigned int>(workers.size()); }
+
+private:
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<std::function<void()>> jobs;
+    };
+
+    void workerLoop(unsigned int id);
+    bool popOwn(unsigned int id, std::function<void()>& job);
+    bool steal(unsigned int thief, std::function<void()>& job);
+
+private:
+    std::vector<std::thread> workers;
+    std::vector<std::unique_ptr<Queue>> queues;
+
+    std::mutex sleepMutex;
+    std::condition_variable wakeUp;
+    std::atomic<size_t> queued{ 0 };
+    std::atomic<unsigned int> nextQueue{ 0 };
+    bool stopping = false;
+};
+
+#endif // THREADPOOL_H
@@ -0,0 +1,76 @@
+#ifndef UNIFORMS_H
+#define UNIFORMS_H
+
+#include <array>
+#include <cstddef>
+
+// Locations of the uniforms of the programs, looked up by name once with resolve() after linking (and after every reload,
+// see shaderreload.hpp) : the frames only pass these integers to glUniform*, without a string lookup in the driver.
+// A uniform the compiler optimized out gets -1, which glUniform* ignores
+
+// main.frag, but for the per-planet values of its PlanetBlock (see planetblock.hpp)
+struct MainUniforms
+{
+    int time = -1, fov = -1, pixelAngle = -1, aspectRatio = -1;
+    int cameraPos = -1, cameraRotation = -1, planetBasis = -1;
+    int sunPos = -1, sunRadius = -1, sunColor = -1, sunCoronaStrength = -1;
+
+    int ambientCoef = -1, diffuseCoef = -1, minDiffuse = -1, penumbraCoef = -1;
+    int refractionindex = -1, fresnel = -1;
+    int opticalDepthLUT = -1, scatteringLUT = -1;
+
+    int nbStars = -1, starsDisplacement = -1, starSize = -1, starSizeVariation = -1, starVoidThreshold = -1, starFlickering = -1;
+
+    int portalPlane1 = -1, portalPlane2 = -1, portalPos1 = -1, portalPos2 = -1;
+    int portalSize1 = -1, portalSize2 = -1, portalBasis1 = -1, portalBasis2 = -1;
+
+    // terrain.hpp
+    int heightmap = -1, heightmapTiles = -1, placeholderHeightmap = -1, normalMap = -1, placeholderNormalMap = -1;
+    int maxHeight = -1, placeholderMaxHeight = -1, maxReduction = -1;
+    int heightmapFaceSize = -1, placeholderFaceSize = -1, heightmapLayer = -1;
+
+    // virtualheightmap.hpp
+    int virtualLevels = -1, pageTable = -1, pageHeights = -1, pageNormals = -1;
+    int virtualFaceSize = -1, feedbackWidth = -1, virtualSlack = -1;
+
+    void resolve(unsigned int program);
+};
+
+// ui.frag
+struct UIUniforms
+{
+    int time = -1, aspectRatio = -1, tCharge = -1, tBulletTime = -1, tRewind = -1;
+
+    void resolve(unsigned int program);
+};
+
+// GL calls and bytes a frame spends on its parameters (uniforms and PlanetBlock), averaged in the per-second log of main.cpp
+struct UploadStats
+{
+    unsigned int calls = 0;
+    size_t bytes = 0;
+
+    void add(unsigned int nbCalls, size_t nbBytes) { calls += nbCalls; bytes += nbBytes; }
+};
+
+// Values of a group of uniforms as they were last sent : changed() is true, and keeps the new values, only when they differ.
+// A relinked program has its uniforms back to their defaults, its groups must then be invalidate()d
+template<size_t N>
+class UniformGroup
+{
+public:
+    bool changed(const std::array<float, N>& values)
+    {
+        if(valid && values == sent) return false;
+        sent = values;
+        valid = true;
+        return true;
+    }
+    void invalidate() { valid = false; }
+
+private:
+    std::array<float, N> sent{};
+    bool valid = false;
+};
+
+#endif // UNIFORMS_H
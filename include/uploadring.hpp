@@ -0,0 +1,44 @@
+#ifndef UPLOADRING_H
+#define UPLOADRING_H
+
+#include <cstddef>
+#include <deque>
+
+// Ring of pixel unpack buffer, persistently and coherently mapped (GL_ARB_buffer_storage, core since 4.4) : the texels of an upload are
+// copied into it, then glTexSubImage* read them from the buffer (an offset instead of a pointer). The call returns at once and
+// the transfer overlaps with the rendering, where a client pointer makes the driver copy the texels or wait for the GPU.
+// The allocations of each frame are fenced in endFrame() and their space is reused once the GPU went past the fence
+class UploadRing
+{
+public:
+    explicit UploadRing(size_t __size);
+    ~UploadRing();
+
+    UploadRing(const UploadRing&) = delete;
+    UploadRing& operator=(const UploadRing&) = delete;
+
+    // size bytes to write the texels into, at offset in the buffer. nullptr if the GPU is still reading all the space (try again next frame)
+    unsigned char* allocate(size_t size, size_t& offset);
+
+    // as GL_PIXEL_UNPACK_BUFFER, unbind it before uploading from client memory again
+    void bind() const;
+    void unbind() const;
+
+    // once per frame after the uploads
+    void endFrame();
+
+private:
+    struct Fence
+    {
+        void* sync; // GLsync
+        size_t end; // head of the ring when it was fenced
+    };
+
+    unsigned int buffer = 0;
+    unsigned char* mapped = nullptr;
+    size_t size = 0, head = 0, tail = 0;
+    bool allocatedThisFrame = false;
+    std::deque<Fence> fences;
+};
+
+#endif // UPLOADRING_H
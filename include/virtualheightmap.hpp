@@ -0,0 +1,127 @@
+#ifndef VIRTUALHEIGHTMAP_H
+#define VIRTUALHEIGHTMAP_H
+
+#include <vector>
+#include <string>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_map>
+#include <unordered_set>
+#include <cstdint>
+
+#include "noise.hpp"
+
+class ThreadPool;
+struct MainUniforms;
+struct UploadStats;
+
+// texels of a page, without its border of one texel on every side
+constexpr size_t VIRTUAL_PAGE_SIZE = 128;
+constexpr size_t VIRTUAL_PAGE_STRIDE = VIRTUAL_PAGE_SIZE + 2;
+// bytes of a resident page : its heights (R8) and its normals (RGBA8 snorm, see heightmap.hpp)
+constexpr size_t VIRTUAL_PAGE_BYTES = 5 * VIRTUAL_PAGE_STRIDE * VIRTUAL_PAGE_STRIDE;
+// main.frag writes the page it needed for one pixel of every block of FEEDBACK_BLOCK x FEEDBACK_BLOCK pixels
+constexpr int FEEDBACK_BLOCK = 4;
+
+// Virtual heightmaps : the terrain of the planets with a full resolution layer (see terrain.hpp), at virtualFaceSize (64k) instead of faceSize,
+// for the mountains close to the camera. Only the levels finer than faceSize are virtual, the layer takes over after them.
+// Every level is cut in pages of VIRTUAL_PAGE_SIZE texels, and only the pages main.frag actually sampled are resident :
+// - main.frag writes the page it wanted for the terrain it hit into a feedback buffer (one pixel per block), read back a few frames later
+//   without waiting for the GPU
+// - the missing pages are loaded by the pool, coarse levels first, from a page file on disk (<pageCacheDir>/pages-<key>.bin, one record per page
+//   at a fixed offset, sparse so only the pages ever seen take space). A page which isn't there yet is baked and written there for the next time
+// - they are uploaded a few per frame into a 2D array (the atlas) of pageBudget bytes, evicting the pages which were seen the longest time ago
+// - the page table (one texel per page of every level, 0 or 1 + the layer of the atlas) tells main.frag where they are.
+//   A missing page falls back to the closest coarser one, then to the layer
+// Pages use more fbm octaves than the layers (one more per level), normalized with the same range : a virtual height stays within
+// slack(planet) of the heights of the layer around it, which keeps the max-height pyramids of the layers a bound of the terrain
+class VirtualHeightmaps
+{
+public:
+    VirtualHeightmaps(ThreadPool& __pool, size_t __faceSize, size_t __virtualFaceSize, size_t pageBudget, int nbLayers, size_t nbPlanets,
+                      const std::string& __pageCacheDir);
+    ~VirtualHeightmaps(); // waits for the pages being loaded
+
+    VirtualHeightmaps(const VirtualHeightmaps&) = delete;
+    VirtualHeightmaps& operator=(const VirtualHeightmaps&) = delete;
+
+    // the virtual heightmap of planet (params of its layer, normalized with [minValue, maxValue]) goes to layer, which forgets its old pages
+    void attach(int layer, size_t planet, const FBMParams& params, float minValue, float maxValue);
+    void detach(int layer);
+
+    // once per frame before drawing : reads the feedback of an old frame, queues the pages it asks for and uploads the loaded ones
+    void update(int maxUploads);
+    // once per frame after drawing
+    void endFrame();
+
+    // sets the uniforms of main.frag which only change with the program : the samplers of unit ... unit + 2 and the sizes.
+    // After every link, it also makes the next bind() send the slacks again
+    void setUniforms(const MainUniforms& uniforms, int unit);
+    // binds the page table and the atlases to unit ... unit + 2 and the feedback buffer, sends the slacks if they changed, counted in uploads
+    void bind(const MainUniforms& uniforms, int unit, UploadStats& uploads);
+
+    // fbm parameters of the virtual heightmap of a planet whose layer uses params
+    static FBMParams virtualParams(const FBMParams& params, size_t faceSize, size_t virtualFaceSize);
+
+private:
+    struct Request
+    {
+        uint32_t key; // see pageKey() in virtualheightmap.cpp
+        size_t planet;
+        FBMParams params;
+        float minValue, maxValue;
+        unsigned int generation; // of the layer when it was queued
+        uint64_t frame;          // when it was last asked for
+    };
+
+    struct LoadedPage
+    {
+        Request request;
+        std::vector<unsigned char> heights;
+        std::vector<signed char> normals;
+    };
+
+    struct LayerState
+    {
+        int planet = -1;
+        FBMParams params;
+        float minValue = 0., maxValue = 1.;
+        unsigned int generation = 0;
+    };
+
+    void loadNextPage();
+    void uploadPage(const LoadedPage& page);
+    void readFeedback(const uint32_t* requests, size_t count);
+    int pageFile(const Request& request); // of the planet, opened on first use
+
+private:
+    ThreadPool& pool;
+    size_t faceSize, virtualFaceSize;
+    int levels = 0, nbLayers = 0, nbSlots = 0;
+    std::string pageCacheDir;
+
+    unsigned int pageTable = 0, heightAtlas = 0, normalAtlas = 0;
+    static constexpr int NB_FEEDBACK_BUFFERS = 3;
+    unsigned int feedbackBuffers[NB_FEEDBACK_BUFFERS]{};
+    void* fences[NB_FEEDBACK_BUFFERS]{}; // GLsync
+    int feedbackWidth = 0, feedbackHeight = 0;
+    uint64_t frame = 0;
+
+    std::vector<LayerState> layers;
+    std::vector<float> slack; // per planet, in normalized heights
+    bool slackChanged = true; // since virtualSlack was last sent
+    std::vector<uint32_t> slotKeys;  // page in every layer of the atlas, UINT32_MAX if free
+    std::vector<uint64_t> slotFrames; // last frame it was seen
+    std::unordered_map<uint32_t, int> resident;
+    std::unordered_set<uint32_t> requested; // queued, being loaded or loaded and waiting for its upload
+
+    // shared with the jobs
+    std::mutex mutex;
+    std::condition_variable idle;
+    std::vector<Request> pending;
+    std::vector<LoadedPage> loaded;
+    std::vector<int> files; // per planet, -1 until opened
+    unsigned int inFlight = 0;
+};
+
+#endif // VIRTUALHEIGHTMAP_H
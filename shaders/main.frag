@@ -7,6 +7,7 @@ layout(location = 0) out vec4 outColor;
 
 uniform float time;
 uniform float fov;
+uniform float pixelAngle; // of a pixel of the render target, at the center of the screen
 uniform float aspectRatio;
 
 uniform vec3 cameraPos;
@@ -18,29 +19,62 @@ uniform float sunRadius;
 uniform vec3 sunColor;
 uniform float sunCoronaStrength;
 
-uniform vec3 planetPos[NB_PLANETS];
-uniform float uPlanetRadius[NB_PLANETS];
-uniform vec3 beachColor[NB_PLANETS];
-uniform vec3 grassColor[NB_PLANETS];
-uniform vec3 peakColor[NB_PLANETS];
+// everything per planet, written by the CPU in one copy every frame (see planetblock.hpp). In std140 every element
+// of these arrays takes 16 bytes, the C++ struct has the same layout
+layout(std140, binding = 0) uniform PlanetBlock
+{
+    vec3 planetPos[NB_PLANETS];
+    float uPlanetRadius[NB_PLANETS];
+    float mountainAmplitude[NB_PLANETS];
+    float seaLevel[NB_PLANETS];
+    vec4 waterColor[NB_PLANETS];
+    float atmosFalloff[NB_PLANETS];
+    float atmosRadius[NB_PLANETS];
+    vec3 atmosColor[NB_PLANETS];
+    vec3 beachColor[NB_PLANETS];
+    vec3 grassColor[NB_PLANETS];
+    vec3 peakColor[NB_PLANETS];
+};
 
 uniform float ambientCoef;
 uniform float diffuseCoef;
 uniform float minDiffuse;
 uniform float penumbraCoef;
 
-uniform sampler2D heightmap;
-uniform float mountainAmplitude[NB_PLANETS];
-uniform float seaLevel[NB_PLANETS];
-uniform vec4 waterColor[NB_PLANETS];
+// see terrain.hpp : full resolution heightmaps of the closest planets (layer heightmapLayer[i], -1 if it has none),
+// which tiles of them are baked, and the placeholder heightmap of every planet (layer i). Same layers for the normal maps
+uniform samplerCubeArray heightmap;
+uniform samplerCubeArray heightmapTiles;
+uniform samplerCubeArray placeholderHeightmap;
+uniform samplerCubeArray normalMap;
+uniform samplerCubeArray placeholderNormalMap;
+uniform int heightmapLayer[NB_PLANETS];
+uniform float heightmapFaceSize;
+uniform float placeholderFaceSize;
+// max-height pyramids of both (see heightmap.hpp), read with max-reduced bilinear filtering. Without it (maxReduction false) they bound nothing
+// and the terrain is marched with fixed steps
+uniform samplerCubeArray maxHeight;
+uniform samplerCubeArray placeholderMaxHeight;
+uniform bool maxReduction;
+// virtual heightmaps of the planets with a layer (see virtualheightmap.hpp) : the page table (per page of every level, 0 or 1 + its layer in the atlases)
+// and the atlases of the resident pages. Level l has virtualFaceSize / 2^l texels per face, the layer takes over after virtualLevels of them
+uniform usampler2DArray pageTable;
+uniform sampler2DArray pageHeights;
+uniform sampler2DArray pageNormals;
+uniform int virtualLevels;
+uniform float virtualFaceSize;
+uniform float virtualSlack[NB_PLANETS]; // how far above the max-height pyramid of its layer the virtual heightmap of a planet can go
+// 1 + the key of the page each block of FEEDBACK_BLOCK x FEEDBACK_BLOCK pixels wanted, read back by virtualheightmap.cpp
+uniform int feedbackWidth;
+layout(std430, binding = 0) buffer PageFeedback { uint pageRequests[]; };
+
 uniform float refractionindex;
 uniform float fresnel;
 
-uniform float NB_STEPS_i;
-uniform float NB_STEPS_j;
-uniform float atmosFalloff[NB_PLANETS];
-uniform float atmosRadius[NB_PLANETS];
-uniform vec3 atmosColor[NB_PLANETS];
+// one layer per planet, see atmosphere.hpp
+uniform sampler2DArray opticalDepthLUT;
+// 4D tables of every planet stacked along z, see atmosphere.hpp
+uniform sampler3D scatteringLUT;
 
 uniform float nbStars;
 uniform float starsDisplacement;
@@ -61,49 +95,136 @@ mat2 rot2D(float theta)
     return mat2(vec2(cos(theta), -sin(theta)), vec2(sin(theta), cos(theta)));
 }
 
-// see texturegen.cpp for yellow noise generation
-float noise(vec3 d, bool underwater, int i)
+// see virtualheightmap.hpp
+const float VIRTUAL_PAGE_SIZE = 128.;
+const float VIRTUAL_PAGE_STRIDE = 130.;
+const int FEEDBACK_BLOCK = 4;
+
+// face of d (GL order) and its coordinates in [0, 1] on it, following the cube map face selection table of the GL spec like cubeDirection() in heightmap.cpp
+int cubeFaceCoords(vec3 d, out vec2 st)
 {
-    vec2 uv = vec2(0.5 + atan(d.z, d.x) / (2. * 3.14159265), 0.5 - asin(d.y) / 3.14159265);
-    float x = texture(heightmap, uv).r;
-    return max(x, underwater ? 0. : seaLevel[i]);
+    vec3 a = abs(d);
+    int face;
+    vec3 stm;
+    if(a.x >= a.y && a.x >= a.z) { face = d.x > 0. ? 0 : 1; stm = vec3(d.x > 0. ? -d.z : d.z, -d.y, a.x); }
+    else if(a.y >= a.z)          { face = d.y > 0. ? 2 : 3; stm = vec3(d.x, d.y > 0. ? d.z : -d.z, a.y); }
+    else                         { face = d.z > 0. ? 4 : 5; stm = vec3(d.z > 0. ? d.x : -d.x, -d.y, a.z); }
+    st = clamp(0.5 * (stm.xy / stm.z + 1.), 0., 1.);
+    return face;
 }
 
-// Returns .x > .y if no intersection
-vec2 raySphere(vec3 rayPos, vec3 rayDir, vec3 sphPos, float radius)
+// level of the virtual heightmap whose texels are as large as the ones of mip in the full resolution heightmap
+float virtualMip(float mip)
 {
-    vec3 p = rayPos - sphPos;
-    float delta = 4. * (dot(p, rayDir) * dot(p, rayDir) - dot(rayDir, rayDir) * (dot(p, p) - radius * radius));
-    if(delta < 0.) return vec2(1e5, -1e5);
-    return vec2((-2. * dot(p, rayDir) - sqrt(delta)) / (2. * dot(rayDir, rayDir)), 
-                (-2. * dot(p, rayDir) + sqrt(delta)) / (2. * dot(rayDir, rayDir)));
+    return mip + log2(virtualFaceSize / heightmapFaceSize);
 }
 
-// returns 1e6 if no intersection
-float rayCircle(vec3 rayPos, vec3 rayDir, vec3 cPos, vec3 cPlane, float radius)
+// The finest resident page of the virtual heightmap of layer with d, at the level of mip or coarser : .xyz its coordinates in the atlases, .w its level.
+// .w is -1 if none is resident or if mip is coarse enough for the layer
+vec4 virtualPage(vec3 d, float mip, int layer)
 {
-    if(abs(dot(rayDir, cPlane)) <= 1e-6 || radius < 0.) return 1e6;
+    vec2 st;
+    int face = cubeFaceCoords(d, st);
+    for(int level = int(max(0., floor(virtualMip(mip)))); level < virtualLevels; level++)
+    {
+        float pages = virtualFaceSize / (VIRTUAL_PAGE_SIZE * exp2(level));
+        vec2 p = min(st * pages, pages - 0.001);
+        uint entry = texelFetch(pageTable, ivec3(p, 6 * layer + face), level).r;
+        // the page starts one texel into its layer of the atlas, after its border
+        if(entry > 0u) return vec4((1. + fract(p) * VIRTUAL_PAGE_SIZE) / VIRTUAL_PAGE_STRIDE, float(entry - 1u), float(level));
+    }
+    return vec4(-1.);
+}
 
-    float t = (dot(cPos, cPlane) - dot(rayPos, cPlane)) / dot(rayDir, cPlane);
-    vec3 p = rayPos + t * rayDir - cPos;
-    // p.y *= 0.75;
-    if(length(p) > radius) return 1e6;
+// asks virtualheightmap.cpp for the page of the virtual heightmap planet i needs at d, if any
+void requestPage(vec3 d, float mip, int i)
+{
+    int layer = heightmapLayer[i];
+    int level = int(max(0., floor(virtualMip(mip))));
+    if(layer < 0 || level >= virtualLevels) return;
+    vec2 st;
+    int face = cubeFaceCoords(d, st);
+    float pages = virtualFaceSize / (VIRTUAL_PAGE_SIZE * exp2(level));
+    uvec2 p = uvec2(min(st * pages, pages - 0.001));
+    // every pixel of the block writes, any of them will do
+    ivec2 block = ivec2(gl_FragCoord.xy) / FEEDBACK_BLOCK;
+    pageRequests[block.y * feedbackWidth + block.x] = 1u + (uint(layer) << 27 | uint(face) << 24 | uint(level) << 20 | p.y << 10 | p.x);
+}
 
-    return t;
+// see heightmap.cpp for yellow noise generation, the heightmaps are cube maps so any direction (even not normalized) can sample them.
+// mip is the level of detail in the levels of the full resolution heightmap (see terrainMip()), explicit since the marches sample it in loops.
+// Where the tile of the layer is there and the pixels are smaller than its texels, the virtual heightmap has the details
+float noise(vec3 d, bool underwater, float mip, int i)
+{
+    int layer = heightmapLayer[i];
+    bool baked = layer >= 0 && textureLod(heightmapTiles, vec4(d, layer), 0.).r > 0.5;
+    vec4 page = baked ? virtualPage(d, mip, layer) : vec4(-1.);
+    float x = page.w >= 0. ? textureLod(pageHeights, page.xyz, 0.).r
+            : baked ? textureLod(heightmap, vec4(d, layer), mip).r
+            : textureLod(placeholderHeightmap, vec4(d, i), max(0., mip - log2(heightmapFaceSize / placeholderFaceSize))).r;
+    return max(x, underwater ? 0. : seaLevel[i]);
 }
 
-vec2 raySphereMinDist(vec3 rayPos, vec3 rayDir, vec3 spherePos, float radius)
+// level of the full resolution heightmap whose texels are as large as a pixel at dist from the eye, on a planet of this radius
+float terrainMip(float dist, float radius)
 {
-    float t = -dot(rayDir, rayPos - spherePos) / dot(rayDir, rayDir);
-    if(t <= 0.) return vec2(1e5, t);
-    vec3 pos = rayPos + t * rayDir;
-    return vec2(length(pos - spherePos) - radius, t);
+    return max(0., log2(dist * pixelAngle * heightmapFaceSize / (radius * 1.5708)));
 }
 
-// found some nice random values at https://www.shadertoy.com/view/Xt23Ry
-float rand(float co) { return fract(sin(co*(91.3458)) * 47453.5453); }
-float rand(vec2 co){ return fract(sin(dot(co.xy ,vec2(12.9898,78.233))) * 43758.5453); }
-float rand(vec3 co){ return rand(co.xy+rand(co.z)); }
+// see heightmap.hpp
+const float HEIGHTMAP_TILE_LEVELS = 9.;
+const float HEIGHTMAP_MAX_BASE_LEVEL = 2.;
+
+// Finest level of the heightmap noise() reads along a step of the march from a point at mip, in the levels of the heightmap planet i uses.
+// The step never goes more than twice as far from the eye, so mip grows by 1 at most
+float marchLevel(float mip, int i)
+{
+    if(heightmapLayer[i] >= 0) return min(ceil(mip) + 1., HEIGHTMAP_TILE_LEVELS - 1.);
+    return min(ceil(max(0., mip - log2(heightmapFaceSize / placeholderFaceSize))) + 1., log2(placeholderFaceSize));
+}
+
+// Upper bound of noise() around d, read in level (of the heightmap planet i uses) of its max-height pyramid, for steps whose finest level is m (see marchLevel()).
+// noise() at a point mixes the texels within 1.5 texels of level m around it and the max-reduced bilinear tap covers half a texel of level
+// around d : uvRadius gets the distance from d (in face coordinates) within which the bound holds
+float maxHeightAround(vec3 d, float level, float m, bool underwater, int i, out float uvRadius)
+{
+    int layer = heightmapLayer[i];
+    float x;
+    if(layer >= 0)
+    {
+        uvRadius = (0.5 * exp2(level) - 1.5 * exp2(m)) * 2. / heightmapFaceSize;
+        x = textureLod(maxHeight, vec4(d, layer), level - HEIGHTMAP_MAX_BASE_LEVEL).r;
+        // the virtual heightmap has details the layer doesn't
+        if(virtualLevels > 0) x += virtualSlack[i];
+    }
+    else
+    {
+        uvRadius = (0.5 * exp2(level) - 1.5 * exp2(m)) * 2. / placeholderFaceSize;
+        x = textureLod(placeholderMaxHeight, vec4(d, i), level - HEIGHTMAP_MAX_BASE_LEVEL).r;
+    }
+    // one quantization step of slack for the precision of the filtering
+    return max(x + 1. / 255., underwater ? 0. : seaLevel[i]);
+}
+
+// the normal maps store the slope of the heightmap divided by this, see heightmap.hpp
+const float HEIGHTMAP_SLOPE_SCALE = 32.;
+
+// slope of the heightmap along the unit sphere at d, from the same heightmap as noise().
+// Explicit levels like noise() : the branches aren't uniform, implicit derivatives would be undefined there.
+// The normal maps have half the resolution of their heightmaps, so their level is one less
+vec3 heightmapSlope(vec3 d, float mip, int i)
+{
+    int layer = heightmapLayer[i];
+    bool baked = layer >= 0 && textureLod(heightmapTiles, vec4(d, layer), 0.).r > 0.5;
+    vec4 page = baked ? virtualPage(d, mip, layer) : vec4(-1.);
+    vec3 slope = page.w >= 0. ? textureLod(pageNormals, page.xyz, 0.).xyz
+               : baked ? textureLod(normalMap, vec4(d, layer), max(0., mip - 1.)).xyz
+               : textureLod(placeholderNormalMap, vec4(d, i), max(0., mip - log2(heightmapFaceSize / placeholderFaceSize) - 1.)).xyz;
+    return HEIGHTMAP_SLOPE_SCALE * slope;
+}
+
+#include "raytrace.glsl"
+#include "random.glsl"
 
 // copy-pasted this, generates random points on the surface of a sphere
 // iq's version of Keinert et al's inverse Spherical Fibonacci Mapping code
@@ -231,41 +352,97 @@ vec3 waveNormal(vec3 gwhere)
 
 // _____________________________________________________ PLANET ________________________________________________________
 
-vec4 rayCastMountains(vec3 rayPos, vec3 rayDir, vec3 sphPos, float radius, float tPlanety, bool underwater, float lod, int i, out float tOut)
+// Marches the terrain with steps of dt near the surface, refined by linear interpolation.
+// Everywhere else it skips the empty space with the max-height pyramids : at a level of the pyramid, the ball of radius
+// min(r - radius - bound, r * sin(uvRadius / stretch)) around the point is above the terrain (stretch bounds the distance covered on a face
+// per radian around it), so the ray can go through it. The level goes up after a skip and down when the ball is smaller than a fine step,
+// down to the finest level whose ball could be larger, where it takes fine steps instead
+vec4 rayCastMountains(vec3 rayPos, vec3 rayDir, vec3 sphPos, float radius, float tPlanety, bool underwater, float lod, float rayDist, int i, out float tOut)
 {
     float nb_iterations = underwater ? lod / 7. : lod;
     float maxt = tPlanety;
     float dt = max(0.025, maxt / nb_iterations);
+    float rayLength = length(rayDir);
+    float faceSize = heightmapLayer[i] >= 0 ? heightmapFaceSize : placeholderFaceSize;
+    float topLevel = heightmapLayer[i] >= 0 ? HEIGHTMAP_TILE_LEVELS - 1. : log2(placeholderFaceSize);
+    float level = topLevel;
+    int wait = 0, backoff = 1; // fine steps before trying to skip again, near the surface
+    bool fine = false; // the last step was a fine one, lh and ly are its sample
     float lh = 0.0;
     float ly = 0.0;
 
-    for(float t = 0.001; t < maxt; t += dt)
+    for(float t = 0.001; t < maxt; )
     {
         vec3 p = rayPos + t * rayDir;
-        float py = length(p - sphPos) - radius;
-        vec3 d = normalize(p - sphPos);
-        float h = mountainAmplitude[i] * noise(d, underwater, i);
+        float r = length(p - sphPos);
+        vec3 d = (p - sphPos) / r;
+        float dist = rayDist + t * rayLength;
+        float mip = terrainMip(dist, radius);
+        float m = marchLevel(mip, i);
+        float minLevel = max(HEIGHTMAP_MAX_BASE_LEVEL, floor(log2(3. * exp2(m) + 3. * dt * rayLength * faceSize / r)) + 1.);
+
+        if(maxReduction && level >= minLevel)
+        {
+            float uvRadius;
+            float bound = mountainAmplitude[i] * maxHeightAround(d, level, m, underwater, i, uvRadius);
+            // |s| + |t| and s^2 + t^2 of the face coordinates of d
+            vec3 a = abs(d) / max(max(abs(d.x), abs(d.y)), abs(d.z));
+            float stretch = min(3., dot(a, a) + 2. * uvRadius * (a.x + a.y + a.z - 1.) + 2. * uvRadius * uvRadius);
+            float clearance = min(min(r - radius - bound, r * sin(uvRadius / stretch)), dist);
+            if(clearance > dt * rayLength)
+            {
+                t += clearance / rayLength;
+                level = min(level + 1., topLevel);
+                fine = false;
+                backoff = 1;
+            }
+            else if(level > minLevel) level -= 1.;
+            else
+            {
+                wait = backoff;
+                backoff = min(2 * backoff, 8);
+                level -= 1.;
+            }
+            continue;
+        }
+
+        float py = r - radius;
+        float h = mountainAmplitude[i] * noise(d, underwater, mip, i);
         if(py < h)
         {
+            if(!fine)
+            {
+                // the last step was a skip, the sample one fine step back is above the terrain too
+                vec3 q = p - dt * rayDir;
+                ly = length(q - sphPos) - radius;
+                lh = mountainAmplitude[i] * noise(q - sphPos, underwater, mip, i);
+            }
             float dst = t-dt+dt*(lh-ly)/(py-ly-h+lh); // <--- https://iquilezles.org/articles/terrainmarching/
             tOut = t;
             return vec4(rayPos + dst * rayDir, h);
         }
         lh = h;
         ly = py;
+        fine = true;
+        t += dt;
+        // the bound is above h, no skip can be longer than py - h
+        level = wait-- <= 0 && py - h > dt * rayLength ? minLevel : minLevel - 1.;
     }
     return vec4(-1.);
 }
 
 
 // .w of return value is positive if there is a reflection
-vec3 shadePlanet(vec3 rayDir, vec3 pos, vec3 spherePos, float radius, vec3 lightSource, float tPlanety, float lod, int i, out float refl, out float tOut)
+// rayDist : how far pos is from the eye along the ray
+vec3 shadePlanet(vec3 rayDir, vec3 pos, vec3 spherePos, float radius, vec3 lightSource, float tPlanety, float lod, float rayDist, int i, out float refl, out float tOut)
 {
-    vec4 mtn = rayCastMountains(pos, rayDir, spherePos, radius, tPlanety, false, lod, i, tOut);
+    vec4 mtn = rayCastMountains(pos, rayDir, spherePos, radius, tPlanety, false, lod, rayDist, i, tOut);
     float n = mtn.w / mountainAmplitude[i];
 
     if(n < -0.01) return vec3(-1.);
     vec3 clr;
+    float mip = terrainMip(rayDist + tOut * length(rayDir), radius);
+    requestPage(normalize(mtn.xyz - spherePos), mip, i);
 
     float shouldReflect = -1.;
 
@@ -284,7 +461,7 @@ vec3 shadePlanet(vec3 rayDir, vec3 pos, vec3 spherePos, float radius, vec3 light
         float refrCoef = abs(dot(normalize(refracted), sphereNormal));
 
         float tmpT = 0.;
-        mtn = rayCastMountains(mtn.xyz, refracted, spherePos, radius, dstToSeabed.x, true, lod, i, tmpT);
+        mtn = rayCastMountains(mtn.xyz, refracted, spherePos, radius, dstToSeabed.x, true, lod, rayDist + length(mtn.xyz - pos), i, tmpT);
         clr = mix(clr, vec3(195.,146.,79.) / 255., waterColor[i].a);
 
         shouldReflect = 1. - pow(refrCoef, fresnel);
@@ -293,21 +470,12 @@ vec3 shadePlanet(vec3 rayDir, vec3 pos, vec3 spherePos, float radius, vec3 light
     // else if(n < 0.75) clr = vec3(90.,139.,93.) / 255.; else clr = vec3(205., 200., 200.) / 255.; // cartoonish snow
     else clr = mix(grassColor[i], peakColor[i], smoothstep(seaLevel[i] + 0.07, 0.85, n));
     
-    vec2 eps = vec2(0.06, 0.);
-    // derivative of implicit surface y = f(x, z) is (-df/dx, 1, -df/dz)
-    vec3 sample1 = mtn.xyz + planetBasis * eps.xyy;
-    float h1 = noise(normalize(sample1 - spherePos), n <= seaLevel[i] + 0.0001, i);
-    vec3 sample1b = mtn.xyz - planetBasis * eps.xyy;
-    float h1b = noise(normalize(sample1b - spherePos), n <= seaLevel[i] + 0.0001, i);
-    float gradx = (h1 - h1b) / (2. * eps.x);
-
-    vec3 sample2 = mtn.xyz + planetBasis * eps.yyx;
-    float h2 = noise(normalize(sample2 - spherePos), n <= seaLevel[i] + 0.0001, i);
-    vec3 sample2b = mtn.xyz - planetBasis * eps.yyx;
-    float h2b = noise(normalize(sample2b - spherePos), n <= seaLevel[i] + 0.0001, i);
-    float gradz = (h2 - h2b) / (2. * eps.x);
-
-    vec3 localNormal = normalize(sphereNormal - mountainAmplitude[i] * gradx * normalize(sample1 - sample1b) - mountainAmplitude[i] * gradz * normalize(sample2 - sample2b));
+    // the surface is at radius + mountainAmplitude * height(d) : its normal leans against the slope of the heightmap along the sphere
+    // (at the seabed for water, mtn has been moved there)
+    vec3 groundNormal = normalize(mtn.xyz - spherePos);
+    vec3 slope = heightmapSlope(groundNormal, mip, i);
+    slope -= dot(slope, groundNormal) * groundNormal;
+    vec3 localNormal = normalize(groundNormal - mountainAmplitude[i] / length(mtn.xyz - spherePos) * slope);
 
     // no grass grows on slope, but it looked kinda ugly
     // clr = mix(clr, vec3(205., 200., 200.) / 255., 1. - smoothstep(0.0, 0.6, abs(dot(localNormal, sphereNormal))));
@@ -324,48 +492,62 @@ vec3 shadePlanet(vec3 rayDir, vec3 pos, vec3 spherePos, float radius, vec3 light
 
 // _____________________________________________________ ATMOSPHERE ________________________________________________________
 
-float densityAtPoint(vec3 where, vec3 planetPos, float planetRadius, int i)
+// integral of the density from p towards dir up to the edge of the atmosphere (going through the planet if dir points at it),
+// baked on the CPU at startup for each planet
+float opticalDepth(vec3 p, vec3 dir, vec3 planetPos, float planetRadius, int i)
 {
-    float h = length(where - planetPos) - planetRadius;
-    return exp(-h * atmosFalloff[i] / atmosRadius[i]) * (1. - h / atmosRadius[i]);
+    vec3 up = p - planetPos;
+    float r = length(up);
+    float h = clamp((r - planetRadius) / atmosRadius[i], 0., 1.);
+    float cosTheta = dot(dir, up) / (r * length(dir));
+    // texel centers sit on h = 0 and 1, cosTheta = -1 and 1
+    vec2 size = vec2(textureSize(opticalDepthLUT, 0).xy);
+    vec2 uv = (vec2(h, 0.5 + 0.5 * cosTheta) * (size - 1.) + 0.5) / size;
+    return atmosRadius[i] * texture(opticalDepthLUT, vec3(uv, i)).r;
 }
 
-float opticalDepth(vec3 rayDir, vec3 rayPos, float rayLength, float nb_steps, vec3 planetPos, float planetRadius, int i)
-{
-    vec3 p = rayPos;
-    float dt = rayLength / nb_steps;
-    float opticalDepth = 0.;
-
-    for(float t = dt; t < rayLength; t += dt)
-    {
-        p = rayPos + t * rayDir;
-        opticalDepth += dt * densityAtPoint(p, planetPos, planetRadius, i);
-    }
+// same sizes as in atmosphere.hpp
+const float SCATTERING_R = 32., SCATTERING_MU = 64., SCATTERING_MU_S = 32., SCATTERING_NU = 8.;
 
-    return opticalDepth;
+// light scattered towards p coming from dir (normalized), up to the edge of the atmosphere or the sea, sun being the direction of the sun
+vec3 scattering(vec3 p, vec3 dir, vec3 sun, vec3 planetPos, float planetRadius, int i)
+{
+    vec3 up = p - planetPos;
+    float r = length(up);
+    up /= r;
+    float h = clamp((r - planetRadius) / atmosRadius[i], 0., 1.);
+
+    // texel centers sit on the bounds of every coordinate, nu is interpolated by hand between two slices of muS
+    float z = (float(i) * SCATTERING_R + 0.5 + sqrt(h) * (SCATTERING_R - 1.)) / (SCATTERING_R * NB_PLANETS);
+    float y = (0.5 + (0.5 + 0.5 * dot(dir, up)) * (SCATTERING_MU - 1.)) / SCATTERING_MU;
+    float x = (0.5 + clamp(0.5 + 0.5 * dot(sun, up), 0., 1.) * (SCATTERING_MU_S - 1.)) / (SCATTERING_MU_S * SCATTERING_NU);
+    float nu = clamp(0.5 + 0.5 * dot(dir, sun), 0., 1.) * (SCATTERING_NU - 1.);
+    float nu0 = min(floor(nu), SCATTERING_NU - 2.);
+
+    vec3 s0 = texture(scatteringLUT, vec3(x + nu0 / SCATTERING_NU, y, z)).rgb;
+    vec3 s1 = texture(scatteringLUT, vec3(x + (nu0 + 1.) / SCATTERING_NU, y, z)).rgb;
+    return mix(s0, s1, nu - nu0);
 }
 
+// Light scattered by the atmosphere between start (on its edge) and start + dist * rayDir, on top of originalColor.
+// Constant cost : the scattering of the whole ray minus what lies behind its end, both read from the precomputed tables
 vec3 atmosphere(vec3 rayDir, vec3 start, float dist, vec3 planetPos, float radius, vec3 lightSource, vec3 originalColor, int i)
 {
-    vec3 totalLight = vec3(0.);
-    float iOpticalDepth = 0.0;
-    float toEyeOpticalDepth = 0.;
+    vec3 rd = normalize(rayDir);
+    vec3 sun = normalize(lightSource - start);
+    vec3 end = start + dist * rayDir;
 
-    float idt = dist / NB_STEPS_i;
-    for(float t = idt; t <= dist; t += idt)
+    vec3 totalLight = scattering(start, rd, sun, planetPos, radius, i);
+    float toEyeOpticalDepth = 0.;
+    if(length(end - planetPos) < radius + atmosRadius[i])
     {
-        vec3 p = start + t * rayDir;
-        vec3 toLight = normalize(lightSource - p);
-        float height = length(p - planetPos) - radius;
-        float rayLengthToSky = raySphere(p, toLight, planetPos, radius + atmosRadius[i]).y;
-
-        float iOpticalDepth = opticalDepth(toLight, p, rayLengthToSky, NB_STEPS_j, planetPos, radius, i);
-        toEyeOpticalDepth = opticalDepth(-rayDir, p, t, NB_STEPS_j, planetPos, radius, i);
-        vec3 transmittance = exp(-(iOpticalDepth + toEyeOpticalDepth) * atmosColor[i]);
-        float localDensity = densityAtPoint(p, planetPos, radius, i);
-
-        totalLight += localDensity * transmittance * atmosColor[i] * idt;
+        // the way back from end to start is a ray to the edge of the atmosphere
+        toEyeOpticalDepth = opticalDepth(end, -rd, planetPos, radius, i);
+        vec3 behind = scattering(end, rd, sun, planetPos, radius, i);
+        totalLight = max(vec3(0.), totalLight - exp(-toEyeOpticalDepth * atmosColor[i]) * behind);
     }
+    else
+        toEyeOpticalDepth = opticalDepth(start, rd, planetPos, radius, i);
 
     float starFade = 3.5 * length(totalLight);
     return totalLight + originalColor * mix(1., exp(-toEyeOpticalDepth), min(1., starFade));
@@ -377,6 +559,7 @@ vec3 raytraceMap(vec3 rayDir, vec3 rayPos)
 {   
     vec3 mapColor = vec3(0.);
     vec3 r0 = rayPos, rd = rayDir;
+    float travelled = length(rayPos - cameraPos); // from the eye to r0, through the reflections and portals
     int NB_MAX_REFLECTIONS = 18;
     float reflectionCoef = 1., nextReflectionCoef = 1.;
     // no recursivity in GLSL (so we have to use loops for reflection... until I code my own shader language (in some IGR class I hope))
@@ -404,7 +587,7 @@ vec3 raytraceMap(vec3 rayDir, vec3 rayPos)
                 float lod = 100. + 600. * (1. - smoothstep(10000., 30000., length(rayPos - cameraPos)));
                 lod = (lod / (r + 1.)); // reduce level of detail when looking through recursive portals
                 vec3 mountainColor = shadePlanet(rd, r0 + tstart * rd, ppi, 
-                                                pri, sunPos, tPlanet.y - tstart, lod, i, nextReflectionCoef, tOut);
+                                                pri, sunPos, tPlanet.y - tstart, lod, travelled + tstart * length(rd), i, nextReflectionCoef, tOut);
 
                 if(mountainColor.x >= -0.1)
                 {
@@ -509,11 +692,13 @@ vec3 raytraceMap(vec3 rayDir, vec3 rayPos)
 
             float dstToWater = raySphere(r0, rd, planetPos[iRefl], uPlanetRadius[iRefl] + seaLevel[iRefl] * mountainAmplitude[iRefl]).x;
             r0 = r0 + dstToWater * rd;
+            travelled += dstToWater * length(rd);
             rd = reflect(rd, waveNormal(normalize(r0 - planetPos[iRefl])));
         }
         else if(shouldTeleport)
         {
             reflectionCoef = nextReflectionCoef;
+            travelled += max(0., tMin) * length(rd);
             r0 = nextr0;
             rd = nextrd;
         }
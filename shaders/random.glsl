@@ -0,0 +1,6 @@
+// Hashes of floats to [0, 1), shared by the passes
+
+// found some nice random values at https://www.shadertoy.com/view/Xt23Ry
+float rand(float co) { return fract(sin(co*(91.3458)) * 47453.5453); }
+float rand(vec2 co){ return fract(sin(dot(co.xy ,vec2(12.9898,78.233))) * 43758.5453); }
+float rand(vec3 co){ return rand(co.xy+rand(co.z)); }
@@ -0,0 +1,32 @@
+// Ray intersections shared by the passes, included with #include "raytrace.glsl" (see shaderloader.h)
+
+// Returns .x > .y if no intersection
+vec2 raySphere(vec3 rayPos, vec3 rayDir, vec3 sphPos, float radius)
+{
+    vec3 p = rayPos - sphPos;
+    float delta = 4. * (dot(p, rayDir) * dot(p, rayDir) - dot(rayDir, rayDir) * (dot(p, p) - radius * radius));
+    if(delta < 0.) return vec2(1e5, -1e5);
+    return vec2((-2. * dot(p, rayDir) - sqrt(delta)) / (2. * dot(rayDir, rayDir)), 
+                (-2. * dot(p, rayDir) + sqrt(delta)) / (2. * dot(rayDir, rayDir)));
+}
+
+// returns 1e6 if no intersection
+float rayCircle(vec3 rayPos, vec3 rayDir, vec3 cPos, vec3 cPlane, float radius)
+{
+    if(abs(dot(rayDir, cPlane)) <= 1e-6 || radius < 0.) return 1e6;
+
+    float t = (dot(cPos, cPlane) - dot(rayPos, cPlane)) / dot(rayDir, cPlane);
+    vec3 p = rayPos + t * rayDir - cPos;
+    // p.y *= 0.75;
+    if(length(p) > radius) return 1e6;
+
+    return t;
+}
+
+vec2 raySphereMinDist(vec3 rayPos, vec3 rayDir, vec3 spherePos, float radius)
+{
+    float t = -dot(rayDir, rayPos - spherePos) / dot(rayDir, rayDir);
+    if(t <= 0.) return vec2(1e5, t);
+    vec3 pos = rayPos + t * rayDir;
+    return vec2(length(pos - spherePos) - radius, t);
+}
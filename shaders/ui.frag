@@ -9,10 +9,9 @@ uniform float tCharge;
 uniform float tBulletTime;
 uniform float tRewind;
 
-float random(float x, float y)
-{
-    return fract(sin(dot(vec2(x, y), vec2(12.9898, 78.233))) * 43758.5453123);
-}
+#include "random.glsl"
+
+float random(float x, float y) { return rand(vec2(x, y)); }
 
 void main()
 {
@@ -0,0 +1,237 @@
+#include "atmosphere.hpp"
+#include "threadpool.hpp"
+
+#include <algorithm>
+#include <vector>
+
+// bilinear fetch in a size x size grid, x and y in [0, 1] on the texel centers
+template <typename T>
+T bilinear(const T* grid, size_t size, float x, float y)
+{
+    x = CLAMP(x, 0.f, 1.f) * (size - 1);
+    y = CLAMP(y, 0.f, 1.f) * (size - 1);
+    size_t j = std::min(static_cast<size_t>(x), size - 2), i = std::min(static_cast<size_t>(y), size - 2);
+    float fx = x - j, fy = y - i;
+    const T* row0 = grid + i * size + j;
+    const T* row1 = row0 + size;
+    return (row0[0] * (1.f - fx) + row0[1] * fx) * (1.f - fy) + (row1[0] * (1.f - fx) + row1[1] * fx) * fy;
+}
+
+float atmosphereDensity(float h, float falloff)
+{
+    return expf(-h * falloff) * (1.f - h);
+}
+
+float integrateOpticalDepth(const OpticalDepthParams& params, float h, float cosTheta, int nbSteps)
+{
+    // in atmosphere radii, planet centered at the origin and start point on the (Oy) axis
+    const float r = params.planetRadius / params.atmosRadius;
+    vec3 start(0., r + h, 0.);
+    vec3 dir(sqrtf(std::max(0.f, 1.f - cosTheta * cosTheta)), cosTheta, 0.);
+
+    // exit of the atmosphere sphere, start is inside so there always is one
+    float b = start.dot(dir), c = start.dot(start) - (r + 1.f) * (r + 1.f);
+    float rayLength = -b + sqrtf(std::max(0.f, b * b - c));
+
+    float dt = rayLength / nbSteps;
+    double depth = 0.;
+    for(int k = 0; k < nbSteps; k++)
+    {
+        vec3 p = start + dir * ((k + 0.5f) * dt);
+        depth += dt * atmosphereDensity(p.length() - r, params.falloff);
+    }
+    return std::min(static_cast<float>(depth), OPTICAL_DEPTH_MAX);
+}
+
+void bakeOpticalDepthLUT(ThreadPool& pool, const OpticalDepthParams& params, size_t size, float* out)
+{
+    pool.parallelFor(size, [&](size_t i) {
+        float cosTheta = 2.f * static_cast<float>(i) / static_cast<float>(size - 1) - 1.f;
+        for(size_t j = 0; j < size; j++)
+            out[i * size + j] = integrateOpticalDepth(params, static_cast<float>(j) / static_cast<float>(size - 1), cosTheta);
+    });
+}
+
+float sampleOpticalDepthLUT(const float* lut, size_t size, float h, float cosTheta)
+{
+    return bilinear(lut, size, h, 0.5f + 0.5f * cosTheta);
+}
+
+// Length of the ray from height h in the direction dir (unit vector, the planet is centered at the origin and the start point is on (Oy))
+// up to the sea if it hits it, up to the edge of the atmosphere otherwise, in atmosphere radii
+float rayLengthInAtmosphere(float r, float h, const vec3& dir)
+{
+    float b = (r + h) * dir.y, c = (r + h) * (r + h);
+    float deltaSea = b * b - (c - r * r);
+    if(deltaSea > 0. && b < 0.) return std::max(0.f, -b - sqrtf(deltaSea));
+    return -b + sqrtf(std::max(0.f, b * b - (c - (r + 1.f) * (r + 1.f))));
+}
+
+// exp(-beta * optical depth) with the layout of the optical depth table
+std::vector<vec3> transmittanceTable(const ScatteringParams& params, const float* opticalDepth)
+{
+    std::vector<vec3> transmittance(OPTICAL_DEPTH_LUT_SIZE * OPTICAL_DEPTH_LUT_SIZE);
+    for(size_t k = 0; k < transmittance.size(); k++)
+        transmittance[k] = vec3::exp(params.beta * (-params.atmosphere.atmosRadius * opticalDepth[k]));
+    return transmittance;
+}
+
+// A ray sampled at the middle of nbSteps segments, with what doesn't depend on the sun : where the samples are
+// and how much of the light scattered there reaches the start point
+struct ScatteringRay
+{
+    vec3 p[SCATTERING_STEPS];
+    float r[SCATTERING_STEPS], h[SCATTERING_STEPS];
+    vec3 weight[SCATTERING_STEPS]; // scattering coefficient * length * transmittance to the start point
+    int nbSteps = 0;
+
+    ScatteringRay(const ScatteringParams& params, float h0, const vec3& dir, int steps)
+    {
+        const float A = params.atmosphere.atmosRadius, R = params.atmosphere.planetRadius / A;
+        vec3 start(0., R + h0, 0.);
+        nbSteps = std::min(steps, SCATTERING_STEPS);
+        float dt = rayLengthInAtmosphere(R, h0, dir) / nbSteps;
+        float depth = 0.; // from the start point, in atmosphere radii
+        for(int k = 0; k < nbSteps; k++)
+        {
+            p[k] = start + dir * ((k + 0.5f) * dt);
+            r[k] = p[k].length();
+            h[k] = r[k] - R;
+            float density = atmosphereDensity(h[k], params.atmosphere.falloff);
+            weight[k] = params.beta * (density * dt * A) * vec3::exp(params.beta * (-A * (depth + 0.5f * density * dt)));
+            depth += density * dt;
+        }
+    }
+
+    // light scattered towards the start point with the sun in the direction sun
+    vec3 light(const vec3& sun, const vec3* transmittance, const vec3* multipleScattering) const
+    {
+        vec3 res;
+        for(int k = 0; k < nbSteps; k++)
+        {
+            float muS = 0.5f + 0.5f * sun.dot(p[k]) / r[k];
+            vec3 incoming = bilinear(transmittance, OPTICAL_DEPTH_LUT_SIZE, h[k], muS);
+            if(multipleScattering)
+                incoming += bilinear(multipleScattering, MULTIPLE_SCATTERING_SIZE, h[k], muS);
+            res += weight[k] * incoming;
+        }
+        return res;
+    }
+
+    // fraction of an isotropic light scattered towards the start point (f_ms of Hillaire)
+    vec3 transfer() const
+    {
+        vec3 res;
+        for(int k = 0; k < nbSteps; k++) res += weight[k];
+        return res;
+    }
+};
+
+void bakeMultipleScatteringLUT(ThreadPool& pool, const ScatteringParams& params, const float* opticalDepth, vec3* out)
+{
+    constexpr size_t N = MULTIPLE_SCATTERING_SIZE;
+    constexpr int NB_STEPS = 20;
+    std::vector<vec3> transmittance = transmittanceTable(params, opticalDepth);
+
+    // directions evenly spread on the sphere (spherical Fibonacci), the isotropic phase function is the mean over them
+    vec3 directions[MULTIPLE_SCATTERING_DIRECTIONS];
+    for(int k = 0; k < MULTIPLE_SCATTERING_DIRECTIONS; k++)
+    {
+        float y = 1.f - (2.f * k + 1.f) / MULTIPLE_SCATTERING_DIRECTIONS;
+        float phi = k * M_PIf * (3.f - sqrtf(5.f));
+        float s = sqrtf(1.f - y * y);
+        directions[k] = vec3(s * cosf(phi), y, s * sinf(phi));
+    }
+
+    pool.parallelFor(N, [&](size_t j) {
+        float h = static_cast<float>(j) / static_cast<float>(N - 1);
+        std::vector<ScatteringRay> rays;
+        for(const vec3& d : directions) rays.emplace_back(params, h, d, NB_STEPS);
+
+        for(size_t i = 0; i < N; i++)
+        {
+            float muS = 2.f * static_cast<float>(i) / static_cast<float>(N - 1) - 1.f;
+            vec3 sun(sqrtf(std::max(0.f, 1.f - muS * muS)), muS, 0.);
+            vec3 secondOrder, transfer;
+            for(const auto& ray : rays)
+            {
+                secondOrder += ray.light(sun, transmittance.data(), nullptr);
+                transfer += ray.transfer();
+            }
+            secondOrder *= 1.f / MULTIPLE_SCATTERING_DIRECTIONS;
+            transfer *= 1.f / MULTIPLE_SCATTERING_DIRECTIONS;
+            // every further order is the previous one times transfer : geometric series
+            out[i * N + j] = vec3(secondOrder.x / (1.f - std::min(transfer.x, 0.99f)),
+                                  secondOrder.y / (1.f - std::min(transfer.y, 0.99f)),
+                                  secondOrder.z / (1.f - std::min(transfer.z, 0.99f)));
+        }
+    });
+}
+
+void bakeScatteringLUT(ThreadPool& pool, const ScatteringParams& params, const float* opticalDepth, const vec3* multipleScattering, vec3* out)
+{
+    std::vector<vec3> transmittance = transmittanceTable(params, opticalDepth);
+
+    pool.parallelFor(SCATTERING_R * SCATTERING_MU, [&](size_t job) {
+        size_t ir = job / SCATTERING_MU, imu = job % SCATTERING_MU;
+        float x = static_cast<float>(ir) / static_cast<float>(SCATTERING_R - 1);
+        float mu = 2.f * static_cast<float>(imu) / static_cast<float>(SCATTERING_MU - 1) - 1.f;
+        float sinMu = sqrtf(std::max(0.f, 1.f - mu * mu));
+        // the samples along the view ray are shared by every sun direction
+        ScatteringRay ray(params, x * x, vec3(sinMu, mu, 0.), SCATTERING_STEPS);
+
+        vec3* row = out + job * SCATTERING_NU * SCATTERING_MU_S;
+        for(size_t inu = 0; inu < SCATTERING_NU; inu++)
+        {
+            float nu = 2.f * static_cast<float>(inu) / static_cast<float>(SCATTERING_NU - 1) - 1.f;
+            for(size_t imus = 0; imus < SCATTERING_MU_S; imus++)
+            {
+                float muS = 2.f * static_cast<float>(imus) / static_cast<float>(SCATTERING_MU_S - 1) - 1.f;
+                // sun such that dot(sun, up) = muS and dot(sun, dir) = nu, as close as possible when there is none
+                float sx = sinMu > 1e-4f ? (nu - mu * muS) / sinMu : 0.f;
+                float sz2 = 1.f - muS * muS - sx * sx;
+                if(sz2 < 0.f)
+                {
+                    sx = sx < 0.f ? -sqrtf(std::max(0.f, 1.f - muS * muS)) : sqrtf(std::max(0.f, 1.f - muS * muS));
+                    sz2 = 0.f;
+                }
+                vec3 sun = vec3(sx, muS, sqrtf(sz2)).normalize();
+                row[inu * SCATTERING_MU_S + imus] = ray.light(sun, transmittance.data(), multipleScattering);
+            }
+        }
+    });
+}
+
+vec3 sampleScatteringLUT(const vec3* lut, const ScatteringParams& params, const vec3& p, const vec3& dir, const vec3& sun)
+{
+    float r = p.length();
+    vec3 up = p * (1.f / r);
+    float h = CLAMP((r - params.atmosphere.planetRadius) / params.atmosphere.atmosRadius, 0.f, 1.f);
+
+    // continuous texel coordinates
+    float x = sqrtf(h) * (SCATTERING_R - 1);
+    float y = CLAMP(0.5f + 0.5f * dir.dot(up), 0.f, 1.f) * (SCATTERING_MU - 1);
+    float z = CLAMP(0.5f + 0.5f * sun.dot(up), 0.f, 1.f) * (SCATTERING_MU_S - 1);
+    float w = CLAMP(0.5f + 0.5f * dir.dot(sun), 0.f, 1.f) * (SCATTERING_NU - 1);
+
+    size_t coords[4] = { std::min(static_cast<size_t>(x), SCATTERING_R - 2), std::min(static_cast<size_t>(y), SCATTERING_MU - 2),
+                         std::min(static_cast<size_t>(w), SCATTERING_NU - 2), std::min(static_cast<size_t>(z), SCATTERING_MU_S - 2) };
+    float weights[4] = { x - coords[0], y - coords[1], w - coords[2], z - coords[3] };
+
+    // quadrilinear interpolation in the [h][mu][nu][muS] layout
+    vec3 res;
+    for(int corner = 0; corner < 16; corner++)
+    {
+        size_t index = 0;
+        float weight = 1.;
+        const size_t sizes[4] = { SCATTERING_R, SCATTERING_MU, SCATTERING_NU, SCATTERING_MU_S };
+        for(int k = 0; k < 4; k++)
+        {
+            int bit = (corner >> k) & 1;
+            index = index * sizes[k] + coords[k] + bit;
+            weight *= bit ? weights[k] : 1.f - weights[k];
+        }
+        res += lut[index] * weight;
+    }
+    return res;
+}
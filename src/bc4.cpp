@@ -0,0 +1,156 @@
+#include "bc4.hpp"
+#include "threadpool.hpp"
+
+#include <algorithm>
+#include <vector>
+#include <cstdlib>
+#include <climits>
+
+// how far the high quality encoder moves the endpoints inside the range of the block (and one step outside)
+constexpr int BC4_SEARCH_RADIUS = 4;
+
+void bc4Palette(int r0, int r1, int palette[8])
+{
+    palette[0] = r0;
+    palette[1] = r1;
+    if(r0 > r1)
+    {
+        for(int k = 1; k < 7; k++) palette[k + 1] = ((7 - k) * r0 + k * r1 + 3) / 7;
+    }
+    else
+    {
+        for(int k = 1; k < 5; k++) palette[k + 1] = ((5 - k) * r0 + k * r1 + 2) / 5;
+        palette[6] = 0;
+        palette[7] = 255;
+    }
+}
+
+// closest entry of the palette for every texel, returns the squared error
+int bc4Indices(const unsigned char texels[16], const int palette[8], int indices[16])
+{
+    int error = 0;
+    for(int t = 0; t < 16; t++)
+    {
+        int best = INT_MAX;
+        for(int k = 0; k < 8; k++)
+        {
+            int d = abs(texels[t] - palette[k]);
+            if(d < best)
+            {
+                best = d;
+                indices[t] = k;
+            }
+        }
+        error += best * best;
+    }
+    return error;
+}
+
+void encodeBC4Block(const unsigned char texels[16], unsigned char block[BC4_BLOCK_BYTES], bool highQuality)
+{
+    const auto range = std::minmax_element(texels, texels + 16);
+    const int lo = *range.first, hi = *range.second;
+    int r0 = hi, r1 = lo, palette[8], indices[16];
+    bc4Palette(r0, r1, palette);
+    int error = bc4Indices(texels, palette, indices);
+
+    if(highQuality && hi > lo)
+    {
+        int candidate[16];
+        auto tryEndpoints = [&](int c0, int c1) {
+            bc4Palette(c0, c1, palette);
+            int e = bc4Indices(texels, palette, candidate);
+            if(e < error)
+            {
+                error = e;
+                r0 = c0;
+                r1 = c1;
+                std::copy(candidate, candidate + 16, indices);
+            }
+        };
+        const int radius = std::min(BC4_SEARCH_RADIUS, (hi - lo) / 2);
+        for(int a = std::max(lo, hi - radius); a <= std::min(255, hi + 1); a++)
+            for(int b = std::max(0, lo - 1); b <= std::min(hi, lo + radius); b++)
+            {
+                // both modes with the same endpoints, swapped
+                if(error > 0 && a > b) tryEndpoints(a, b);
+                if(error > 0 && b <= a) tryEndpoints(b, a);
+            }
+
+        // texels at 0 or 255 can take the last two entries of the r0 <= r1 palette, the endpoints then only cover the others
+        int innerLo = 255, innerHi = 0;
+        for(int t = 0; t < 16; t++)
+            if(texels[t] > 0 && texels[t] < 255)
+            {
+                innerLo = std::min<int>(innerLo, texels[t]);
+                innerHi = std::max<int>(innerHi, texels[t]);
+            }
+        if(innerLo <= innerHi && (innerLo > lo || innerHi < hi))
+        {
+            const int innerRadius = std::min(BC4_SEARCH_RADIUS, (innerHi - innerLo) / 2);
+            for(int b = std::max(0, innerLo - 1); b <= std::min(innerHi, innerLo + innerRadius); b++)
+                for(int a = std::max(b, innerHi - innerRadius); a <= std::min(255, innerHi + 1) && error > 0; a++) tryEndpoints(b, a);
+        }
+    }
+
+    uint64_t bits = 0;
+    for(int t = 0; t < 16; t++) bits |= static_cast<uint64_t>(indices[t]) << (3 * t);
+    block[0] = r0;
+    block[1] = r1;
+    for(int k = 0; k < 6; k++) block[2 + k] = (bits >> (8 * k)) & 0xFF;
+}
+
+void decodeBC4Block(const unsigned char block[BC4_BLOCK_BYTES], unsigned char texels[16])
+{
+    int palette[8];
+    bc4Palette(block[0], block[1], palette);
+    uint64_t bits = 0;
+    for(int k = 0; k < 6; k++) bits |= static_cast<uint64_t>(block[2 + k]) << (8 * k);
+    for(int t = 0; t < 16; t++) texels[t] = palette[(bits >> (3 * t)) & 7];
+}
+
+// block row by of the image, returns its largest error
+int compressBC4Row(const unsigned char* texels, size_t width, size_t height, size_t rowStride, size_t by, unsigned char* blocks, bool highQuality)
+{
+    int worst = 0;
+    unsigned char block[16], decoded[16];
+    for(size_t bx = 0; bx < (width + 3) / 4; bx++)
+    {
+        for(size_t i = 0; i < 4; i++)
+            for(size_t j = 0; j < 4; j++)
+                block[4 * i + j] = texels[std::min(4 * by + i, height - 1) * rowStride + std::min(4 * bx + j, width - 1)];
+        unsigned char* out = blocks + (by * ((width + 3) / 4) + bx) * BC4_BLOCK_BYTES;
+        encodeBC4Block(block, out, highQuality);
+        decodeBC4Block(out, decoded);
+        for(int t = 0; t < 16; t++) worst = std::max(worst, abs(block[t] - decoded[t]));
+    }
+    return worst;
+}
+
+int compressBC4(const unsigned char* texels, size_t width, size_t height, size_t rowStride, unsigned char* blocks, bool highQuality)
+{
+    int worst = 0;
+    for(size_t by = 0; by < (height + 3) / 4; by++)
+        worst = std::max(worst, compressBC4Row(texels, width, height, rowStride, by, blocks, highQuality));
+    return worst;
+}
+
+int compressBC4(ThreadPool& pool, const unsigned char* texels, size_t width, size_t height, size_t rowStride, unsigned char* blocks, bool highQuality)
+{
+    std::vector<int> worst((height + 3) / 4, 0);
+    pool.parallelFor(worst.size(), [&](size_t by) { worst[by] = compressBC4Row(texels, width, height, rowStride, by, blocks, highQuality); });
+    return worst.empty() ? 0 : *std::max_element(worst.begin(), worst.end());
+}
+
+void decompressBC4(const unsigned char* blocks, size_t width, size_t height, unsigned char* texels)
+{
+    unsigned char decoded[16];
+    for(size_t by = 0; by < (height + 3) / 4; by++)
+        for(size_t bx = 0; bx < (width + 3) / 4; bx++)
+        {
+            decodeBC4Block(blocks + (by * ((width + 3) / 4) + bx) * BC4_BLOCK_BYTES, decoded);
+            for(size_t i = 0; i < 4 && 4 * by + i < height; i++)
+                for(size_t j = 0; j < 4 && 4 * bx + j < width; j++)
+                    texels[(4 * by + i) * width + 4 * bx + j] = decoded[4 * i + j];
+        }
+}
@@ -1,5 +1,6 @@
 #include "camera.hpp"
 #include "math.hpp"
+#include "noise.hpp"
 
 #include <iostream>
 #include <algorithm>
@@ -16,6 +17,7 @@ Camera::Camera(GLFWwindow* __window, vec3 spawn)
     : window(__window), pos(spawn)
 {
     timeline = std::make_unique<std::deque<vec3>>();
+    terrainRange.fill(vec2(0., 1.));
     glfwSetKeyCallback(window, glfwKeyCallback);
     glfwSetMouseButtonCallback(window, glfwMouseButtonCallback);
     glfwSetCharCallback(window, glfwCharCallback);
@@ -30,42 +32,15 @@ Camera::Camera(GLFWwindow* __window, vec3 spawn)
     }
 }
 
-// found this value noise on https://gist.github.com/patriciogonzalezvivo/670c22f3966e662d2f83
-// is actually a low-frequency version of the heightmap used for rendering the mountains, for collisions
-float mod289(float x){return x - floor(x * (1.0 / 289.0)) * 289.0;}
-vec4 mod289(vec4 x){return x - vec4::floor(x * (1.0 / 289.0)) * 289.0;}
-vec4 perm(vec4 x){return mod289(((x * 34.0) + vec4(1.,1.,1.,1.)) * x);}
-float noisep(vec3 p)
+// the fbm the heightmaps of the planet are baked from, normalized like their texels, for collisions
+float Camera::noise(const vec3& uvw, const FBMParams& params, const vec2& range) const
 {
-    vec3 a = vec3::floor(p);
-    vec3 d = p - a;
-    d = d * d * (vec3(3.,3.,3.) - d * 2.);
-
-    vec4 b = vec4(a.x, a.x, a.y, a.y) + vec4(0.0, 1.0, 0.0, 1.0);
-    vec4 k1 = perm(vec4(b.x, b.y, b.x, b.y));
-    vec4 k2 = perm(vec4(k1.x, k1.y, k1.x, k1.y) + vec4(b.z, b.z, b.w, b.w));
-
-    vec4 c = k2 + vec4(a.z, a.z, a.z, a.z);
-    vec4 k3 = perm(c);
-    vec4 k4 = perm(c + vec4(1.,1.,1.,1.));
-
-    vec4 o1 = vec4::fract(k3 * (1.0 / 41.0));
-    vec4 o2 = vec4::fract(k4 * (1.0 / 41.0));
-
-    vec4 o3 = o2 * d.z + o1 * (1.0 - d.z);
-    vec2 o4 = vec2(o3.y, o3.w) * d.x + vec2(o3.x, o3.z) * (1.0 - d.x);
-
-    return o4.y * d.y + o4.x * (1.0 - d.y);
-}
-
-float Camera::noise(const vec3& uvw) const
-{
-    return std::max(seaLevel, noisep(uvw * 8.));
+    return std::max(seaLevel, CLAMP((fbm(uvw, params) - range.x) / (range.y - range.x), 0.f, 1.f));
 }
 
 float Camera::heightHere(const PlanetData& pl) const
 {
-    float mountainHeight = mountainAmplitude * noise((pos - pl.p).normalize());
+    float mountainHeight = mountainAmplitude * noise((pos - pl.p).normalize(), terrainParams[iClosest], terrainRange[iClosest]);
     return pl.radius + 65. + mountainHeight;
 }
 
@@ -212,30 +187,22 @@ void Camera::updateMouse()
     mousePos = vec2();
 }
 
-PlanetData Camera::findClosest(const std::vector<PlanetData>& planets)
+PlanetData Camera::findClosest(const PlanetSystem& planets)
 {
-    PlanetData closest = { .p = vec3(INFINITY, INFINITY, INFINITY), .radius = 1., .mass = 1. };
-    for(int i = 0; i < planets.size(); i++)
-    {
-        if((planets[i].p - pos).length() < (closest.p - pos).length()) 
-        {
-            closest = planets[i];
-            iClosest = i;
-        }
+    iClosest = planets.closest(pos);
 
-        // update portalclosest @here
-        if(iPortalClosest1 != -1 and iPortalClosest1 == i)
-        {
-            dposForPortal1 = planets[i].p - oldClosestPosForPortal1;
-            oldClosestPosForPortal1 = planets[i].p;
-        }
-        if(iPortalClosest2 != -1 and iPortalClosest2 == i)
-        {
-            dposForPortal2 = planets[i].p - oldClosestPosForPortal2;
-            oldClosestPosForPortal2 = planets[i].p;
-        }
+    // update portalclosest @here
+    if(iPortalClosest1 != -1)
+    {
+        dposForPortal1 = planets.pos[iPortalClosest1] - oldClosestPosForPortal1;
+        oldClosestPosForPortal1 = planets.pos[iPortalClosest1];
+    }
+    if(iPortalClosest2 != -1)
+    {
+        dposForPortal2 = planets.pos[iPortalClosest2] - oldClosestPosForPortal2;
+        oldClosestPosForPortal2 = planets.pos[iPortalClosest2];
     }
-    return closest;
+    return planets.getInfo(iClosest);
 }
 
 void Camera::applyGravity(const float& dt, const PlanetData& closest)
@@ -343,7 +310,7 @@ void Camera::teleportThroughPortal(const PlanetData& closest)
     }
 }
 
-void Camera::update(float& dt, const float& __time, const std::vector<PlanetData>& planets)
+void Camera::update(float& dt, const float& __time, const PlanetSystem& planets)
 {
     time = __time;
     
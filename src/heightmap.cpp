@@ -0,0 +1,663 @@
+#include "heightmap.hpp"
+#include "threadpool.hpp"
+#include "bc4.hpp"
+#include "ktx.h"
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <cstdio>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+double secondsSince(std::chrono::high_resolution_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+constexpr size_t TILE_SIZE = HEIGHTMAP_TILE_SIZE;
+
+vec3 cubeDirection(size_t face, size_t i, size_t j, size_t faceSize)
+{
+    float sc = 2.f * (static_cast<float>(j) + 0.5f) / static_cast<float>(faceSize) - 1.f;
+    float tc = 2.f * (static_cast<float>(i) + 0.5f) / static_cast<float>(faceSize) - 1.f;
+    vec3 d;
+    switch(face)
+    {
+        case 0:  d = vec3( 1.f, -tc, -sc); break;
+        case 1:  d = vec3(-1.f, -tc,  sc); break;
+        case 2:  d = vec3( sc,  1.f,  tc); break;
+        case 3:  d = vec3( sc, -1.f, -tc); break;
+        case 4:  d = vec3( sc, -tc,  1.f); break;
+        default: d = vec3(-sc, -tc, -1.f); break;
+    }
+    return d.normalize();
+}
+
+// fbm of the texels (row, j0) ... (row, j1 - 1) of the cube map, through the vectorized kernel.
+// The 6 faces are stacked vertically so row goes from 0 to 6 * faceSize
+void fbmRow(size_t row, size_t j0, size_t j1, size_t faceSize, const FBMParams& params, float* out)
+{
+    float x[TILE_SIZE], y[TILE_SIZE], z[TILE_SIZE];
+    for(size_t j = j0; j < j1; j++)
+    {
+        vec3 d = cubeDirection(row / faceSize, row % faceSize, j, faceSize);
+        x[j - j0] = d.x; y[j - j0] = d.y; z[j - j0] = d.z;
+    }
+    fbmBatch(x, y, z, out, j1 - j0, params);
+}
+
+unsigned char quantizeHeight(float x, float minValue, float maxValue)
+{
+    return static_cast<unsigned char>(CLAMP((x - minValue) / (maxValue - minValue), 0.f, 1.f) * 255.);
+}
+
+// texel (i, j) of a normal map of faceSize (see heightmap.hpp) : slope of the heightmap normalized with range = max - min, as 4 snorm bytes
+void normalTexel(size_t face, size_t i, size_t j, size_t faceSize, const FBMParams& params, float range, signed char* out)
+{
+    vec3 d = cubeDirection(face, i, j, faceSize);
+    vec3 g;
+    fbmd(d, g, params);
+    g = g * (1.f / (range * HEIGHTMAP_SLOPE_SCALE));
+    g -= d * g.dot(d);
+    out[0] = static_cast<signed char>(roundf(CLAMP(g.x, -1.f, 1.f) * 127.f));
+    out[1] = static_cast<signed char>(roundf(CLAMP(g.y, -1.f, 1.f) * 127.f));
+    out[2] = static_cast<signed char>(roundf(CLAMP(g.z, -1.f, 1.f) * 127.f));
+    out[3] = 0;
+}
+
+// how a texel of a mip is made from the 2x2 texels under it :
+// their average rounded to nearest (to -infinity on ties) for the heightmaps and normal maps, their max for the max-height pyramids
+struct BoxFilter
+{
+    template <typename T>
+    static T apply(T a, T b, T c, T d) { return static_cast<T>((a + b + c + d + 2) >> 2); }
+};
+
+struct MaxFilter
+{
+    template <typename T>
+    static T apply(T a, T b, T c, T d) { return std::max(std::max(a, b), std::max(c, d)); }
+};
+
+// 2x2 filter of a square level of s x s texels of C channels into the next one
+template <typename T, int C, typename Filter = BoxFilter>
+void downsample(const T* src, size_t srcRowStride, T* dst, size_t s)
+{
+    const T* r1 = src + srcRowStride;
+    for(size_t j = 0; j < s; j++)
+        for(int c = 0; c < C; c++)
+            dst[C * j + c] = Filter::apply(src[C * 2 * j + c], src[C * (2 * j + 1) + c], r1[C * 2 * j + c], r1[C * (2 * j + 1) + c]);
+}
+
+// Max-height pyramid of square images of s x s heights (s a power of 2) stacked vertically, nbRows rows rowStride apart :
+// its levels HEIGHTMAP_MAX_BASE_LEVEL ... log2(s) one after the other in dst, each one with all the images.
+// The levels below HEIGHTMAP_MAX_BASE_LEVEL go to scratch (nbRows * s / 3 texels are enough)
+void maxPyramid(const unsigned char* src, size_t rowStride, size_t s, size_t nbRows, unsigned char* scratch, unsigned char* dst)
+{
+    for(int level = 1; (s >> level) > 0; level++)
+    {
+        const size_t n = s >> level, rows = nbRows >> level;
+        unsigned char*& out = level < HEIGHTMAP_MAX_BASE_LEVEL ? scratch : dst;
+        for(size_t i = 0; i < rows; i++)
+            downsample<unsigned char, 1, MaxFilter>(src + 2 * i * rowStride, rowStride, out + i * n, n);
+        src = out;
+        rowStride = n;
+        out += rows * n;
+    }
+}
+
+// Output file mapped in memory : the baker writes its texels straight into the page cache
+// and the kernel flushes them to disk, so the image never has to fit in RAM
+struct MappedOutput
+{
+    int fd = -1;
+    char* data = nullptr;
+    size_t size = 0;
+};
+
+bool openMappedOutput(MappedOutput& out, const char* path, size_t size)
+{
+    out.size = size;
+    out.fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(out.fd < 0)
+    {
+        std::cout << "Can't create " << path << " : " << strerror(errno) << std::endl;
+        return false;
+    }
+    if(ftruncate(out.fd, out.size) != 0)
+    {
+        std::cout << "Can't resize " << path << " to " << out.size << " bytes : " << strerror(errno) << std::endl;
+        close(out.fd);
+        return false;
+    }
+    void* p = mmap(nullptr, out.size, PROT_READ | PROT_WRITE, MAP_SHARED, out.fd, 0);
+    if(p == MAP_FAILED)
+    {
+        std::cout << "Can't map " << path << " : " << strerror(errno) << std::endl;
+        close(out.fd);
+        return false;
+    }
+    out.data = static_cast<char*>(p);
+    return true;
+}
+
+// starts the write-back of [begin, end) and drops these pages from our resident set
+void releaseMappedRange(MappedOutput& out, size_t begin, size_t end)
+{
+    const size_t page = sysconf(_SC_PAGESIZE);
+    begin = begin / page * page;
+    end = std::min(out.size, (end + page - 1) / page * page);
+    msync(out.data + begin, end - begin, MS_ASYNC);
+    madvise(out.data + begin, end - begin, MADV_DONTNEED);
+}
+
+bool closeMappedOutput(MappedOutput& out)
+{
+    bool ok = msync(out.data, out.size, MS_SYNC) == 0;
+    munmap(out.data, out.size);
+    ok = close(out.fd) == 0 && ok;
+    return ok;
+}
+
+// Where every level and face of an uncompressed cube map of 8 bits channels lives in a KTX file (see ktx.h)
+struct KTXCubeLayout
+{
+    size_t faceSize = 0;
+    size_t texelSize = 1; // bytes
+    int levels = 0;
+    std::vector<size_t> levelOffset; // of the imageSize field of each level
+    std::vector<size_t> faceStride;  // face size + cube padding
+    std::vector<size_t> rowStride;   // rows are 4 bytes aligned
+    size_t totalSize = 0;
+
+    KTXCubeLayout(size_t __faceSize, size_t keyValueBytes, size_t __texelSize = 1) : faceSize(__faceSize), texelSize(__texelSize)
+    {
+        while((faceSize >> levels) > 0) levels++;
+        size_t offset = sizeof(KTXHeader) + keyValueBytes;
+        for(int level = 0; level < levels; level++)
+        {
+            size_t s = size(level);
+            levelOffset.push_back(offset);
+            rowStride.push_back(ktx_align4(s * texelSize));
+            faceStride.push_back(ktx_align4(rowStride.back() * s));
+            offset += sizeof(uint32_t) + 6 * faceStride.back();
+        }
+        totalSize = offset;
+    }
+
+    size_t size(int level) const { return std::max<size_t>(1, faceSize >> level); }
+    size_t faceOffset(int level, size_t face) const { return levelOffset[level] + sizeof(uint32_t) + face * faceStride[level]; }
+    size_t texel(int level, size_t face, size_t i, size_t j) const { return faceOffset(level, face) + i * rowStride[level] + j * texelSize; }
+};
+
+// GL enums of the texels of a KTX file
+struct KTXFormat
+{
+    uint32_t glType, glFormat, glInternalFormat;
+};
+
+constexpr KTXFormat KTX_R8 = { 0x1401, 0x1903, 0x8229 };          // GL_UNSIGNED_BYTE, GL_RED, GL_R8
+constexpr KTXFormat KTX_RGBA8_SNORM = { 0x1400, 0x1908, 0x8F97 }; // GL_BYTE, GL_RGBA, GL_RGBA8_SNORM
+
+// one entry of the KTX key/value data : byte size, "key\0value\0", padded to 4 bytes
+std::string ktxKeyValue(const std::string& key, const std::string& value)
+{
+    uint32_t size = key.size() + 1 + value.size() + 1;
+    std::string entry(sizeof(size), '\0');
+    memcpy(&entry[0], &size, sizeof(size));
+    entry += key + '\0' + value + '\0';
+    entry.resize(ktx_align4(entry.size()), '\0');
+    return entry;
+}
+
+// what a heightmap was baked from, human readable
+std::string heightmapDescription(size_t faceSize, const FBMParams& params)
+{
+    char buf[256];
+    snprintf(buf, sizeof(buf), "fbm cube map, face size %zu, %d octaves, frequency %.9g, gain %.9g, seed %u, bake version %u",
+             faceSize, params.octaves, params.frequency, params.gain, params.seed, HEIGHTMAP_BAKE_VERSION);
+    return buf;
+}
+
+void writeKTXCubeHeader(MappedOutput& out, const KTXCubeLayout& layout, const KTXFormat& format, const std::string& keyValueData)
+{
+    KTXHeader header{};
+    memcpy(header.identifier, KTX_IDENTIFIER, KTX_IDENTIFIER_SIZE);
+    header.endianness = KTX_ENDIANNESS;
+    header.glType = format.glType;
+    header.glTypeSize = 1;
+    header.glFormat = format.glFormat;
+    header.glInternalFormat = format.glInternalFormat;
+    header.glBaseInternalFormat = format.glFormat;
+    header.pixelWidth = layout.faceSize;
+    header.pixelHeight = layout.faceSize;
+    header.numberOfFaces = 6;
+    header.numberOfMipmapLevels = layout.levels;
+    header.bytesOfKeyValueData = keyValueData.size();
+    memcpy(out.data, &header, sizeof(header));
+    memcpy(out.data + sizeof(header), keyValueData.data(), keyValueData.size());
+
+    for(int level = 0; level < layout.levels; level++)
+    {
+        uint32_t imageSize = layout.rowStride[level] * layout.size(level);
+        memcpy(out.data + layout.levelOffset[level], &imageSize, sizeof(imageSize));
+    }
+}
+
+// Fills levels 1 ... n - 1 of the cube map from level 0, each level being a 2x2 filter of the previous one.
+// Faces and bands of rows of a level are computed in parallel
+template <typename T, int C, typename Filter = BoxFilter>
+void buildMipChain(ThreadPool& pool, MappedOutput& out, const KTXCubeLayout& layout)
+{
+    for(int level = 1; level < layout.levels; level++)
+    {
+        const size_t s = layout.size(level), NB_BANDS = (s + TILE_SIZE - 1) / TILE_SIZE;
+        pool.parallelFor(6 * NB_BANDS, [&](size_t job) {
+            size_t face = job / NB_BANDS, i0 = (job % NB_BANDS) * TILE_SIZE;
+            for(size_t i = i0; i < std::min(i0 + TILE_SIZE, s); i++)
+                downsample<T, C, Filter>(reinterpret_cast<const T*>(out.data + layout.texel(level - 1, face, 2 * i, 0)), layout.rowStride[level - 1] / sizeof(T),
+                                 reinterpret_cast<T*>(out.data + layout.texel(level, face, i, 0)), s);
+        });
+        releaseMappedRange(out, layout.levelOffset[level - 1], layout.levelOffset[level]);
+    }
+    releaseMappedRange(out, layout.levelOffset.back(), layout.totalSize);
+}
+
+// Normal map of the heightmap of faceSize normalized with range, bands of rows are spread over the pool and released once written
+bool generateNormalMap(ThreadPool& pool, size_t faceSize, const FBMParams& params, float range, const char* path)
+{
+    const size_t N = normalMapFaceSize(faceSize), HEIGHT = 6 * N;
+    std::string keyValueData = ktxKeyValue("SolarSystem.bake", "normal map of the " + heightmapDescription(faceSize, params));
+    KTXCubeLayout layout(N, keyValueData.size(), 4);
+    MappedOutput out;
+    if(!openMappedOutput(out, path, layout.totalSize)) return false;
+    writeKTXCubeHeader(out, layout, KTX_RGBA8_SNORM, keyValueData);
+
+    for(size_t i0 = 0; i0 < HEIGHT; i0 += TILE_SIZE)
+    {
+        const size_t i1 = std::min(i0 + TILE_SIZE, HEIGHT);
+        pool.parallelFor(i1 - i0, [&](size_t k) {
+            size_t face = (i0 + k) / N, i = (i0 + k) % N;
+            signed char* dst = reinterpret_cast<signed char*>(out.data + layout.texel(0, face, i, 0));
+            for(size_t j = 0; j < N; j++)
+                normalTexel(face, i, j, N, params, range, dst + 4 * j);
+        });
+        releaseMappedRange(out, layout.texel(0, i0 / N, i0 % N, 0), layout.texel(0, (i1 - 1) / N, (i1 - 1) % N, N));
+    }
+    buildMipChain<signed char, 4>(pool, out, layout);
+
+    if(!closeMappedOutput(out))
+    {
+        std::cout << "Error while writing " << path << " : " << strerror(errno) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Max-height pyramid of the heightmap being written in heightmap (with its layout), from level HEIGHTMAP_MAX_BASE_LEVEL down to 1x1.
+// Each row of its first level is the max of 2^HEIGHTMAP_MAX_BASE_LEVEL rows of the heightmap, they are spread over the pool
+bool generateMaxHeightPyramid(ThreadPool& pool, size_t faceSize, const FBMParams& params, const MappedOutput& heightmap, const KTXCubeLayout& heightmapLayout,
+                              const char* path)
+{
+    const size_t M = std::max<size_t>(faceSize >> HEIGHTMAP_MAX_BASE_LEVEL, 1), BAND = faceSize / M;
+    std::string keyValueData = ktxKeyValue("SolarSystem.bake", "max-height pyramid of the " + heightmapDescription(faceSize, params));
+    KTXCubeLayout layout(M, keyValueData.size());
+    MappedOutput out;
+    if(!openMappedOutput(out, path, layout.totalSize)) return false;
+    writeKTXCubeHeader(out, layout, KTX_R8, keyValueData);
+
+    pool.parallelFor(6 * M, [&](size_t row) {
+        size_t face = row / M, i = row % M;
+        std::vector<unsigned char> scratch(BAND * faceSize);
+        maxPyramid(reinterpret_cast<const unsigned char*>(heightmap.data + heightmapLayout.texel(0, face, i * BAND, 0)), heightmapLayout.rowStride[0],
+                   faceSize, BAND, scratch.data(), reinterpret_cast<unsigned char*>(out.data + layout.texel(0, face, i, 0)));
+    });
+    buildMipChain<unsigned char, 1, MaxFilter>(pool, out, layout);
+
+    if(!closeMappedOutput(out))
+    {
+        std::cout << "Error while writing " << path << " : " << strerror(errno) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool generateSphericalFBMnoise(ThreadPool& pool, size_t faceSize, const FBMParams& params, const char* path, BakeTimings& timings, const char* normalPath,
+                               const char* maxPath)
+{
+    const size_t WIDTH = faceSize, HEIGHT = 6 * faceSize;
+    const size_t NB_TILES_W = (WIDTH + TILE_SIZE - 1) / TILE_SIZE, NB_TILES_H = (HEIGHT + TILE_SIZE - 1) / TILE_SIZE;
+    const size_t NB_TILES = NB_TILES_W * NB_TILES_H;
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    std::vector<float> tileMin(NB_TILES, INFINITY), tileMax(NB_TILES, -INFINITY);
+    pool.parallelFor(NB_TILES, [&](size_t tile) {
+        size_t i0 = (tile / NB_TILES_W) * TILE_SIZE, j0 = (tile % NB_TILES_W) * TILE_SIZE;
+        size_t j1 = std::min(j0 + TILE_SIZE, WIDTH);
+        float row[TILE_SIZE];
+        for(size_t i = i0; i < std::min(i0 + TILE_SIZE, HEIGHT); i++)
+        {
+            fbmRow(i, j0, j1, faceSize, params, row);
+            for(size_t j = j0; j < j1; j++)
+            {
+                tileMin[tile] = std::min(tileMin[tile], row[j - j0]);
+                tileMax[tile] = std::max(tileMax[tile], row[j - j0]);
+            }
+        }
+    });
+
+    float minfound = *std::min_element(tileMin.begin(), tileMin.end());
+    float maxfound = *std::max_element(tileMax.begin(), tileMax.end());
+    timings.compute = secondsSince(start);
+    start = std::chrono::high_resolution_clock::now();
+
+    std::string keyValueData = ktxKeyValue("SolarSystem.bake", heightmapDescription(faceSize, params));
+    KTXCubeLayout layout(faceSize, keyValueData.size());
+    MappedOutput out;
+    if(!openMappedOutput(out, path, layout.totalSize)) return false;
+    writeKTXCubeHeader(out, layout, KTX_R8, keyValueData);
+    unsigned char* img = reinterpret_cast<unsigned char*>(out.data);
+
+    for(size_t band = 0; band < NB_TILES_H; band++)
+    {
+        const size_t i0 = band * TILE_SIZE, i1 = std::min(i0 + TILE_SIZE, HEIGHT);
+        pool.parallelFor(NB_TILES_W, [&](size_t column) {
+            size_t j0 = column * TILE_SIZE;
+            size_t j1 = std::min(j0 + TILE_SIZE, WIDTH);
+            float row[TILE_SIZE];
+            for(size_t i = i0; i < i1; i++)
+            {
+                fbmRow(i, j0, j1, faceSize, params, row);
+                unsigned char* dst = img + layout.texel(0, i / faceSize, i % faceSize, 0);
+                for(size_t j = j0; j < j1; j++)
+                {
+                    dst[j] = quantizeHeight(row[j - j0], minfound, maxfound);
+                }
+            }
+        });
+        releaseMappedRange(out, layout.texel(0, i0 / faceSize, i0 % faceSize, 0), layout.texel(0, (i1 - 1) / faceSize, (i1 - 1) % faceSize, WIDTH));
+    }
+    timings.normalize = secondsSince(start);
+
+    start = std::chrono::high_resolution_clock::now();
+    buildMipChain<unsigned char, 1>(pool, out, layout);
+    if(maxPath && !generateMaxHeightPyramid(pool, faceSize, params, out, layout, maxPath))
+    {
+        closeMappedOutput(out);
+        return false;
+    }
+    timings.mips = secondsSince(start);
+
+    start = std::chrono::high_resolution_clock::now();
+    bool ok = closeMappedOutput(out);
+    timings.write = secondsSince(start);
+    if(!ok)
+    {
+        std::cout << "Error while writing " << path << " : " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    std::cout << "min : " << minfound << ", max : " << maxfound << std::endl;
+
+    if(normalPath)
+    {
+        start = std::chrono::high_resolution_clock::now();
+        if(!generateNormalMap(pool, faceSize, params, maxfound - minfound, normalPath)) return false;
+        timings.normals = secondsSince(start);
+    }
+    return true;
+}
+
+int compressHeightmapBC4(ThreadPool& pool, const char* path, const char* bc4Path, bool highQuality)
+{
+    int fd = open(path, O_RDONLY);
+    struct stat st{};
+    if(fd < 0 || fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(KTXHeader))
+    {
+        std::cout << "Can't read " << path << std::endl;
+        if(fd >= 0) close(fd);
+        return -1;
+    }
+    void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(p == MAP_FAILED)
+    {
+        std::cout << "Can't map " << path << " : " << strerror(errno) << std::endl;
+        return -1;
+    }
+    const char* in = static_cast<const char*>(p);
+    KTXHeader header;
+    memcpy(&header, in, sizeof(header));
+    const KTXCubeLayout layout(header.pixelWidth, header.bytesOfKeyValueData);
+    if(memcmp(header.identifier, KTX_IDENTIFIER, KTX_IDENTIFIER_SIZE) != 0 || header.glInternalFormat != KTX_R8.glInternalFormat || header.numberOfFaces != 6
+       || static_cast<int>(header.numberOfMipmapLevels) != layout.levels || layout.totalSize > static_cast<size_t>(st.st_size))
+    {
+        std::cout << path << " isn't an R8 cube map with its mips" << std::endl;
+        munmap(p, st.st_size);
+        return -1;
+    }
+
+    // same key/value data, then every level : its imageSize and its 6 faces of blocks (multiples of 8 bytes, nothing to pad)
+    std::vector<size_t> levelOffset;
+    size_t size = sizeof(KTXHeader) + header.bytesOfKeyValueData;
+    for(int level = 0; level < layout.levels; level++)
+    {
+        levelOffset.push_back(size);
+        size += sizeof(uint32_t) + 6 * bc4Size(layout.size(level), layout.size(level));
+    }
+    MappedOutput out;
+    if(!openMappedOutput(out, bc4Path, size))
+    {
+        munmap(p, st.st_size);
+        return -1;
+    }
+    header.glType = 0;
+    header.glFormat = 0;
+    header.glInternalFormat = BC4_GL_INTERNAL_FORMAT;
+    memcpy(out.data, &header, sizeof(header));
+    memcpy(out.data + sizeof(header), in + sizeof(header), header.bytesOfKeyValueData);
+
+    int worst = 0;
+    for(int level = 0; level < layout.levels; level++)
+    {
+        const size_t s = layout.size(level);
+        uint32_t imageSize = bc4Size(s, s);
+        memcpy(out.data + levelOffset[level], &imageSize, sizeof(imageSize));
+        for(size_t face = 0; face < 6; face++)
+        {
+            unsigned char* blocks = reinterpret_cast<unsigned char*>(out.data + levelOffset[level] + sizeof(uint32_t) + face * imageSize);
+            worst = std::max(worst, compressBC4(pool, reinterpret_cast<const unsigned char*>(in + layout.texel(level, face, 0, 0)), s, s, layout.rowStride[level],
+                                                blocks, highQuality));
+        }
+        releaseMappedRange(out, levelOffset[level], level + 1 < layout.levels ? levelOffset[level + 1] : size);
+    }
+    munmap(p, st.st_size);
+
+    if(!closeMappedOutput(out))
+    {
+        std::cout << "Error while writing " << bc4Path << " : " << strerror(errno) << std::endl;
+        return -1;
+    }
+    return worst;
+}
+
+void bakeHeightmapFaces(ThreadPool& pool, size_t faceSize, const FBMParams& params, std::vector<unsigned char>& texels, std::vector<signed char>& normals,
+                        float& minValue, float& maxValue)
+{
+    std::vector<float> heights(6 * faceSize * faceSize);
+    pool.parallelFor(6 * faceSize, [&](size_t row) {
+        for(size_t j0 = 0; j0 < faceSize; j0 += TILE_SIZE)
+            fbmRow(row, j0, std::min(j0 + TILE_SIZE, faceSize), faceSize, params, heights.data() + row * faceSize + j0);
+    });
+
+    auto range = std::minmax_element(heights.begin(), heights.end());
+    minValue = *range.first;
+    maxValue = *range.second;
+    texels.resize(heights.size());
+    for(size_t k = 0; k < heights.size(); k++)
+        texels[k] = quantizeHeight(heights[k], minValue, maxValue);
+
+    const size_t N = normalMapFaceSize(faceSize);
+    normals.resize(6 * N * N * 4);
+    pool.parallelFor(6 * N, [&](size_t row) {
+        for(size_t j = 0; j < N; j++)
+            normalTexel(row / N, row % N, j, N, params, maxValue - minValue, normals.data() + 4 * (row * N + j));
+    });
+}
+
+void maxHeightPyramid(const std::vector<unsigned char>& texels, size_t faceSize, std::vector<unsigned char>& pyramid)
+{
+    size_t bytes = 0;
+    for(size_t s = faceSize >> HEIGHTMAP_MAX_BASE_LEVEL; s > 0; s /= 2) bytes += 6 * s * s;
+    pyramid.resize(bytes);
+    std::vector<unsigned char> scratch(2 * faceSize * faceSize);
+    maxPyramid(texels.data(), faceSize, faceSize, 6 * faceSize, scratch.data(), pyramid.data());
+}
+
+void bakeHeightmapTile(size_t faceSize, const FBMParams& params, size_t face, size_t i0, size_t j0, float minValue, float maxValue,
+                       unsigned char* out, signed char* normals, unsigned char* maxHeights)
+{
+    float row[TILE_SIZE];
+    for(size_t i = 0; i < TILE_SIZE; i++)
+    {
+        fbmRow(face * faceSize + i0 + i, j0, j0 + TILE_SIZE, faceSize, params, row);
+        for(size_t j = 0; j < TILE_SIZE; j++)
+            out[i * TILE_SIZE + j] = quantizeHeight(row[j], minValue, maxValue);
+    }
+
+    const unsigned char* src = out;
+    unsigned char* dst = out + TILE_SIZE * TILE_SIZE;
+    for(size_t s = TILE_SIZE / 2; s > 0; s /= 2)
+    {
+        for(size_t i = 0; i < s; i++)
+            downsample<unsigned char, 1>(src + 2 * i * 2 * s, 2 * s, dst + i * s, s);
+        src = dst;
+        dst += s * s;
+    }
+
+    unsigned char scratch[TILE_SIZE * TILE_SIZE / 3];
+    maxPyramid(out, TILE_SIZE, TILE_SIZE, TILE_SIZE, scratch, maxHeights);
+
+    const size_t N = normalMapFaceSize(faceSize);
+    for(size_t i = 0; i < NORMAL_TILE_SIZE; i++)
+        for(size_t j = 0; j < NORMAL_TILE_SIZE; j++)
+            normalTexel(face, i0 / 2 + i, j0 / 2 + j, N, params, maxValue - minValue, normals + 4 * (i * NORMAL_TILE_SIZE + j));
+
+    const signed char* nsrc = normals;
+    signed char* ndst = normals + 4 * NORMAL_TILE_SIZE * NORMAL_TILE_SIZE;
+    for(size_t s = NORMAL_TILE_SIZE / 2; s > 0; s /= 2)
+    {
+        for(size_t i = 0; i < s; i++)
+            downsample<signed char, 4>(nsrc + 4 * 2 * i * 2 * s, 4 * 2 * s, ndst + 4 * i * s, s);
+        nsrc = ndst;
+        ndst += 4 * s * s;
+    }
+}
+
+void bakeHeightmapPage(size_t faceSize, const FBMParams& params, size_t face, size_t i0, size_t j0, size_t size, float minValue, float maxValue,
+                       unsigned char* heights, signed char* normals)
+{
+    const size_t S = size + 2;
+    auto clampTexel = [faceSize](size_t k, size_t k0) { return static_cast<size_t>(CLAMP(static_cast<long>(k0 + k) - 1, 0l, static_cast<long>(faceSize) - 1)); };
+    float x[TILE_SIZE], y[TILE_SIZE], z[TILE_SIZE], row[TILE_SIZE];
+    for(size_t i = 0; i < S; i++)
+    {
+        for(size_t j = 0; j < S; j++)
+        {
+            vec3 d = cubeDirection(face, clampTexel(i, i0), clampTexel(j, j0), faceSize);
+            x[j] = d.x; y[j] = d.y; z[j] = d.z;
+        }
+        fbmBatch(x, y, z, row, S, params);
+        for(size_t j = 0; j < S; j++)
+        {
+            heights[i * S + j] = quantizeHeight(row[j], minValue, maxValue);
+            normalTexel(face, clampTexel(i, i0), clampTexel(j, j0), faceSize, params, maxValue - minValue, normals + 4 * (i * S + j));
+        }
+    }
+}
+
+uint64_t heightmapKey(size_t faceSize, const FBMParams& params)
+{
+    // FNV-1a, the offsets are derived from the seed
+    uint64_t hash = 0xcbf29ce484222325ull;
+    auto mix = [&hash](const void* data, size_t size) {
+        for(size_t k = 0; k < size; k++)
+        {
+            hash ^= static_cast<const unsigned char*>(data)[k];
+            hash *= 0x100000001b3ull;
+        }
+    };
+    uint32_t fields[6] = { HEIGHTMAP_BAKE_VERSION, static_cast<uint32_t>(faceSize), static_cast<uint32_t>(params.octaves), 0, 0, params.seed };
+    memcpy(&fields[3], &params.frequency, sizeof(float));
+    memcpy(&fields[4], &params.gain, sizeof(float));
+    mix(fields, sizeof(fields));
+    return hash;
+}
+
+uint64_t heightmapKey(size_t faceSize, const FBMParams& params, float minValue, float maxValue)
+{
+    uint64_t hash = heightmapKey(faceSize, params);
+    float range[2] = { minValue, maxValue };
+    for(size_t k = 0; k < sizeof(range); k++)
+    {
+        hash ^= reinterpret_cast<const unsigned char*>(range)[k];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+std::string heightmapCachePath(const std::string& cacheDir, size_t faceSize, const FBMParams& params)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "/heightmap-%016llx.ktx", static_cast<unsigned long long>(heightmapKey(faceSize, params)));
+    return cacheDir + name;
+}
+
+std::string normalMapCachePath(const std::string& cacheDir, size_t faceSize, const FBMParams& params)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "/normals-%016llx.ktx", static_cast<unsigned long long>(heightmapKey(faceSize, params)));
+    return cacheDir + name;
+}
+
+std::string maxHeightCachePath(const std::string& cacheDir, size_t faceSize, const FBMParams& params)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "/maxheight-%016llx.ktx", static_cast<unsigned long long>(heightmapKey(faceSize, params)));
+    return cacheDir + name;
+}
+
+std::string bakeHeightmapCached(ThreadPool& pool, const std::string& cacheDir, size_t faceSize, const FBMParams& params, BakeTimings* timings)
+{
+    std::string path = heightmapCachePath(cacheDir, faceSize, params), normalPath = normalMapCachePath(cacheDir, faceSize, params);
+    std::string maxPath = maxHeightCachePath(cacheDir, faceSize, params);
+    if(access(path.c_str(), R_OK) == 0 && access(normalPath.c_str(), R_OK) == 0 && access(maxPath.c_str(), R_OK) == 0) return path;
+
+    if(mkdir(cacheDir.c_str(), 0755) != 0 && errno != EEXIST)
+    {
+        std::cout << "Can't create the bake cache " << cacheDir << " : " << strerror(errno) << std::endl;
+        return "";
+    }
+
+    std::cout << "baking " << path << " (" << heightmapDescription(faceSize, params) << ")" << std::endl;
+    const std::string suffix = ".tmp" + std::to_string(getpid());
+    std::string tmp = path + suffix, normalTmp = normalPath + suffix, maxTmp = maxPath + suffix;
+    BakeTimings localTimings;
+    // the normal map and the max-height pyramid first, the heightmap is what readers check
+    if(!generateSphericalFBMnoise(pool, faceSize, params, tmp.c_str(), timings ? *timings : localTimings, normalTmp.c_str(), maxTmp.c_str())
+       || rename(normalTmp.c_str(), normalPath.c_str()) != 0 || rename(maxTmp.c_str(), maxPath.c_str()) != 0 || rename(tmp.c_str(), path.c_str()) != 0)
+    {
+        unlink(tmp.c_str());
+        unlink(normalTmp.c_str());
+        unlink(maxTmp.c_str());
+        return "";
+    }
+    return path;
+}
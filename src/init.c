@@ -1,104 +1,30 @@
 #include <glad.h>
 
 #include "init.h"
+#include "pack.h"
+#include "shaderloader.h"
+#include "programcache.h"
+#include "profiler.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 
 #define NB_VERTEX 4
 #define ATTR_PER_VERTEX 3
 #define NB_INDEX 6
 
-// written in one of my previous projects 2 years ago
-// I adapted it so it can also read grey-scale images (.pgm format)
-unsigned char *read_ppm(int is_pgm, const char *filename_ppm, int *width, int *height)
-{
-    FILE *fichier = fopen(filename_ppm, "r");
-    if (fichier == NULL)
-    {
-        printf("Can't find %s\n", filename_ppm);
-        return NULL;
-    }
-    if(fgetc(fichier) != 'P' || fgetc(fichier) != (is_pgm ? '5' : '6'))
-    {
-        return NULL;
-    }
-    fgetc(fichier);
-    if(fgetc(fichier) == '#')
-    {
-        while(fgetc(fichier) != '\n');
-    }
-    else
-    {
-        fseek(fichier, -1, SEEK_CUR);
-    }
-
-    int max_color = 255;
-    if (fscanf(fichier, "%d %d %d", width, height, &max_color) != 3)
-    {
-        printf("Probleme de lecture du header ppm...");
-        fclose(fichier);
-        return NULL;
-    }
-    if (max_color != 255)
-    {
-        printf("Couleur ref doit etre 255, non ?\n");
-        fclose(fichier);
-        return NULL;
-    }
+// mapped once by init(), the shaders are read from it when it is there and from their own files otherwise
+static AssetPack assets;
 
-    // Tout le fichier est lu d'un seul coup avec un fread approprié
-
-    int nb_px = (*width) * (*height);
-    unsigned char *res = malloc((is_pgm ? 1 : 3) * nb_px * sizeof(unsigned char));
-    fread(res, sizeof(unsigned char), (is_pgm ? 1 : 3) * nb_px, fichier);
-
-    fclose(fichier);
-    return res;
-}
-
-unsigned int init_texture(const char* path)
+const void *find_asset(const char *path, size_t *size)
 {
-    if(!path || !*path || !path[1]) return -1;
-
-    static unsigned int dejavu = 0;
-    int width, height;
-    int g = 0; for(; path[g]; g++);
-    int is_pgm = path[g - 2] == 'g';
-    unsigned char *data = read_ppm(is_pgm, path, &width, &height);
-
-    // Chaque texture chargée est associée à un uint, qu'on stocke dans un
-    // unsigned int[], ici comme il y en a 1 seul on envoie &texture
-    unsigned int texture_id;
-    // Génération du texture object
-    glGenTextures(1, &texture_id);
-
-    glActiveTexture(GL_TEXTURE0 + dejavu++);
-
-    glBindTexture(GL_TEXTURE_2D, texture_id);
-
-    if(!is_pgm)
-    {
-        // On attache une image 2d à un texture object
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-
-        glGenerateMipmap(GL_TEXTURE_2D);
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    }
-    else
-    {
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, width, height, 0, GL_RED, GL_UNSIGNED_BYTE, data);
-
-        glGenerateMipmap(GL_TEXTURE_2D);
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    }
-
-    return texture_id;
+    // the entries are named relative to the repository, the callers give paths from asset_root() (or relative to the build directory)
+    size_t root = strlen(asset_root());
+    if (strncmp(path, asset_root(), root) == 0) path += root;
+    while (strncmp(path, "../", 3) == 0) path += 3;
+    return pack_find(&assets, path, size);
 }
 
 unsigned int compile_shader(unsigned int type, const char *source)
@@ -111,9 +37,13 @@ unsigned int compile_shader(unsigned int type, const char *source)
     return id;
 }
 
-int create_program(const char *vertex_shader, const char *fragment_shader)
+unsigned int start_program(const char *vertex_shader, const char *fragment_shader, int *from_binary)
 {
-    unsigned int program = glCreateProgram();
+    unsigned int program = load_program_binary(vertex_shader, fragment_shader);
+    *from_binary = program != 0;
+    if (program) return program;
+
+    program = glCreateProgram();
 
     unsigned int vs = compile_shader(GL_VERTEX_SHADER, vertex_shader);
     unsigned int fs = compile_shader(GL_FRAGMENT_SHADER, fragment_shader);
@@ -121,33 +51,82 @@ int create_program(const char *vertex_shader, const char *fragment_shader)
     glAttachShader(program, vs);
     glAttachShader(program, fs);
 
+    glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
     glLinkProgram(program);
-    glValidateProgram(program);
 
+    // they live as long as they are attached, finish_program() still reads their logs
     glDeleteShader(vs);
     glDeleteShader(fs);
 
     return program;
 }
 
-char *read_shader(const char *filename)
+int finish_program(unsigned int program, int from_binary, const char *vertex_shader, const char *fragment_shader)
 {
-    FILE *shader_file = fopen(filename, "r");
-
-    int maxbuf = 200;
-    char *res = malloc((1 + maxbuf) * sizeof(char));
-    int i = 0;
-
-    while (!feof(shader_file))
+    int ok;
+    glGetProgramiv(program, GL_LINK_STATUS, &ok);
+    unsigned int shaders[2];
+    int nb_shaders = 0;
+    glGetAttachedShaders(program, 2, &nb_shaders, shaders);
+    for (int i = 0; i < nb_shaders; i++)
     {
-        if (i >= maxbuf)
+        int compiled;
+        glGetShaderiv(shaders[i], GL_COMPILE_STATUS, &compiled);
+        if (!compiled)
         {
-            maxbuf *= 2;
-            res = realloc(res, (1 + maxbuf) * sizeof(char));
+            char log[4096];
+            glGetShaderInfoLog(shaders[i], sizeof(log), NULL, log);
+            printf("Shader compilation failed :\n%s", log);
+            // errors are given as source(line), source 0 being the shader itself
+            for (int n = 1; shader_file_name(n); n++) printf("  source %d is %s\n", n, shader_file_name(n));
         }
-        res[i++] = fgetc(shader_file);
+        glDetachShader(program, shaders[i]);
+    }
+    if (!ok)
+    {
+        char log[4096];
+        glGetProgramInfoLog(program, sizeof(log), NULL, log);
+        printf("Program link failed :\n%s", log);
+        return 0;
     }
-    res[i - 1] = '\0';
+    if (!from_binary) save_program_binary(program, vertex_shader, fragment_shader);
+    return 1;
+}
+
+int create_program(const char *vertex_shader, const char *fragment_shader)
+{
+    // glGetProgramiv waits for the driver, so both times include the whole compilation
+    double start = glfwGetTime();
+    int from_binary;
+    unsigned int program = start_program(vertex_shader, fragment_shader, &from_binary);
+    if (finish_program(program, from_binary, vertex_shader, fragment_shader))
+        printf(from_binary ? "program loaded from its binary in %.1f ms (warm start)\n" : "program compiled and linked in %.1f ms (cold start)\n",
+               1e3 * (glfwGetTime() - start));
+
+    return program;
+}
+
+char *read_shader(const char *filename)
+{
+    FILE *shader_file = fopen(filename, "rb");
+    if (shader_file == NULL)
+    {
+        printf("Can't find %s\n", filename);
+        return NULL;
+    }
+
+    // the whole file in one read
+    fseek(shader_file, 0, SEEK_END);
+    long size = ftell(shader_file);
+    fseek(shader_file, 0, SEEK_SET);
+    char *res = size >= 0 ? malloc(size + 1) : NULL;
+    if (res && fread(res, 1, size, shader_file) != (size_t)size)
+    {
+        printf("Can't read %s\n", filename);
+        free(res);
+        res = NULL;
+    }
+    if (res) res[size] = '\0';
 
     fclose(shader_file);
 
@@ -200,15 +179,31 @@ void framebuffer_size_callback(GLFWwindow* window, int width, int height)
     glfwSwapBuffers(window);
 }
 
-unsigned int initUI()
+void set_global_programs(unsigned int program, unsigned int ui_program)
 {
-    char *vs_source = read_shader("../shaders/main.vert");
-    char *fs_source = read_shader("../shaders/ui.frag");
+    global_program = program;
+    global_ui_program = ui_program;
+}
 
-    global_ui_program = create_program(vs_source, fs_source);
+// load_shader of a file named relative to the repository, found from asset_root()
+static const char *load_asset_shader(const char *relative)
+{
+    char path[PATH_MAX];
+    return asset_path(relative, path, sizeof(path)) ? load_shader(path) : NULL;
+}
 
-    free(vs_source);
-    free(fs_source);
+unsigned int initUI()
+{
+    // main.vert comes from the cache, it was loaded by init()
+    profile_begin("load_shader ui");
+    const char *vs_source = load_asset_shader("shaders/main.vert");
+    const char *fs_source = load_asset_shader("shaders/ui.frag");
+    profile_end();
+    if (!vs_source || !fs_source) return 0;
+
+    profile_begin("create_program ui");
+    global_ui_program = create_program(vs_source, fs_source);
+    profile_end();
 
     return global_ui_program;
 }
@@ -216,9 +211,14 @@ unsigned int initUI()
 unsigned int init(GLFWwindow** window)
 {
     glfwInitHint(GLFW_PLATFORM, GLFW_PLATFORM_X11);
-    if (!glfwInit()) return 0;
+    profile_begin("glfwInit");
+    int initialized = glfwInit();
+    profile_end();
+    if (!initialized) return 0;
 
+    profile_begin("glfwCreateWindow");
     *window = glfwCreateWindow(RESOLUTION_W, RESOLUTION_H, "Welcome to my solar system !", NULL, NULL);
+    profile_end();
     if (window == NULL)
     {
         printf("Error in glfwCreateWindow !\n");
@@ -230,7 +230,10 @@ unsigned int init(GLFWwindow** window)
     glfwSetWindowSizeLimits(*window, LOW_RES_W, LOW_RES_H, GLFW_DONT_CARE, GLFW_DONT_CARE);
     // glfwSwapInterval(0); // decomment this to remove the 60FPS cap
 
-    if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
+    profile_begin("gladLoadGLLoader");
+    int loaded = gladLoadGLLoader((GLADloadproc)glfwGetProcAddress);
+    profile_end();
+    if (!loaded)
     {
         printf("Failed to initialize GLAD\n");
         return 0;
@@ -240,29 +243,41 @@ unsigned int init(GLFWwindow** window)
     glfwGetFramebufferSize(*window, &w, &h);
     glViewport(0, 0, w, h);
 
+    // one open and one mmap for every asset, next to the executable so that the working directory doesn't matter
+    profile_begin("pack_open_default");
+    if (pack_open_default(&assets)) printf("assets read from %s (%u files)\n", PACK_FILE_NAME, assets.entryCount);
+    profile_end();
+
+    profile_begin("load_shader main");
     // Vertex Shader, pour la position de chaque vertex
-    char *vs_source = read_shader("../shaders/main.vert");
+    const char *vs_source = load_asset_shader("shaders/main.vert");
 
     // Fragment Shader, pour chaque pixel (gère la couleur en outre)
-    char *fs_source = read_shader("../shaders/main.frag");
+    const char *fs_source = load_asset_shader("shaders/main.frag");
+    profile_end();
+    if (!vs_source || !fs_source) return 0;
 
+    profile_begin("create_program main");
     global_program = create_program(vs_source, fs_source);
     glUseProgram(global_program);
+    profile_end();
 
     glfwSetFramebufferSizeCallback(*window, framebuffer_size_callback);
 
-    free(vs_source);
-    free(fs_source);
-
+    profile_begin("setupMesh");
     setupMesh();
+    profile_end();
     glEnable(GL_BLEND);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA); 
+    // filter across the edges of the cube map faces (heightmap)
+    glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
 
     return global_program;
 }
 
 void generateLowResBuf(unsigned int* frameBuf, unsigned int* outTexture)
 {
+    profile_begin("generateLowResBuf");
     glGenFramebuffers(1, frameBuf);
     glBindFramebuffer(GL_FRAMEBUFFER, *frameBuf);
 
@@ -272,4 +287,5 @@ void generateLowResBuf(unsigned int* frameBuf, unsigned int* outTexture)
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
     glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, *outTexture, 0);
+    profile_end();
 }
\ No newline at end of file
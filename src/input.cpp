@@ -51,7 +51,6 @@ InputData Input::getInput()
 
     static InputData data{  .sunPos{ 0.,30.,10360. }, .sunRadius = 1242., .sunColor{ 1.0,1.0,0.5 }, .sunCoronaStrength = 9448.4,
                             .fov = 60., .cameraSpeed = 230., .jumpStrength = 450.,
-                            .nb_steps_i = 9.01, .nb_steps_j = 6.01,
                             .atmosScattering = 0.2, .mountainFrequency = 8.,
                             .refractionindex = 0.75, .fresnel = 2.,
                             .ambientCoef = 0.02, .diffuseCoef = 0.21, .minDiffuse = 0.36, .penumbraCoef = 0.06,
@@ -99,8 +98,6 @@ InputData Input::getInput()
 
     if (ImGui::CollapsingHeader("Atmosphere"))
     {
-        ImGui::SliderFloat("atmos steps i", &data.nb_steps_i, 0., 30.);
-        ImGui::SliderFloat("atmos steps j", &data.nb_steps_j, 0., 30.);
         ImGui::SliderFloat("atmos scattering", &data.atmosScattering, 0., 10.);
     }
     
@@ -5,149 +5,189 @@
 #include <chrono>
 #include <array>
 #include <memory>
+#include <vector>
+#include <future>
 
 #include "init.h"
 #include "input.hpp"
 #include "camera.hpp"
 #include "math.hpp"
-
-std::array<std::unique_ptr<Planet>, NB_PLANETS> setupPlanets()
+#include "threadpool.hpp"
+#include "atmosphere.hpp"
+#include "terrain.hpp"
+#include "shaderreload.hpp"
+#include "profiler.h"
+#include "uniforms.hpp"
+#include "planetblock.hpp"
+#include "pack.h"
+
+PlanetSystem setupPlanets()
 {
-    std::array<std::unique_ptr<Planet>, NB_PLANETS> res = {
-        std::make_unique<Planet>(vec3(-9434.7906, -25662.6391, 2955.8649), 700000000., 500., 64., 0.463, vec4(72., 167., 206., 19.), 8.9, 225., vec3(748., 602., 427.9), vec3(214., 194., 149.), vec3(91., 142., 92.), vec3(205., 215., 195.), 3600., 0.),
-        std::make_unique<Planet>(vec3(879.11278, 3896.616536, -1279.07537), 810000000., 608., 89., 0.308, vec4(25., 2., 2., 50.), 9.3, 227., vec3(450., 640., 800.), vec3(164., 80., 80.), vec3(140., 36., 36.), vec3(2., 2., 2.)               , 3600., 100.),
-        std::make_unique<Planet>(vec3(13411.7725, 1986.762333, 18793.155), 780000000., 650., 43., 0.098, vec4(97., 131., 146., 2.), 10.5, 292., vec3(475., 536., 800.), vec3(240., 219., 169.), vec3(221., 173., 106.), vec3(242., 165., 55.), 2700., 200.),
-        std::make_unique<Planet>(vec3(-27397.563, -27352.0892, -22861.6378), 800000000., 527., 95., 0.355, vec4(138., 211., 193., 7.), 6.48, 244., vec3(461., 400., 507.), vec3(168., 175., 221.), vec3(64., 15., 100.), vec3(135.,106., 183.), 3000., 300.),
-        std::make_unique<Planet>(vec3(-6744.2406, -12949.7822, -1483.17318), 950000000., 953., 97., 0.429, vec4(72., 116., 99., 6.), 9.6, 338., vec3(508., 451., 521.), vec3(143., 179., 156.), vec3(159., 211., 158.), vec3(34., 82., 75.)  , 4500., 400.),
-        std::make_unique<Planet>(vec3(13625.1274, 51722.1683, -14043.7552), 990000000., 999., 98., 0.973, vec4(63., 155., 222., 2.), 11.6, 303., vec3(752., 607., 441.), vec3(175., 217., 246.), vec3(95., 161., 173.), vec3(43., 127., 215.), 4500., 500.),
-        std::make_unique<Planet>(vec3(14351.9012, 11241.1955, 14033.6766), 600000000., 433., 56., 0.655, vec4(9., 6., 49., 12.), 15.8, 322., vec3(400., 400., 400.), vec3(30.,28.,28.), vec3(17., 18., 29.), vec3(0., 0., 0.)                , 2100. ,  600.),
-        std::make_unique<Planet>(vec3(0.0, 0.0, 0.0), 630000000., 410., 86., 0.3,   vec4(95., 25., 174., 0.), 10., 263., vec3(508., 555., 530.), vec3(102., 70., 134.), vec3(46., 22., 32.), vec3(176., 232., 244.)         , 2400. , 700.)
-    };
+    PlanetSystem res;
+    res.set(0, vec3(-9434.7906, -25662.6391, 2955.8649), 700000000., 500., 64., 0.463, vec4(72., 167., 206., 19.), 8.9, 225., vec3(748., 602., 427.9), vec3(214., 194., 149.), vec3(91., 142., 92.), vec3(205., 215., 195.), 3600., 0.);
+    res.set(1, vec3(879.11278, 3896.616536, -1279.07537), 810000000., 608., 89., 0.308, vec4(25., 2., 2., 50.), 9.3, 227., vec3(450., 640., 800.), vec3(164., 80., 80.), vec3(140., 36., 36.), vec3(2., 2., 2.)               , 3600., 100.);
+    res.set(2, vec3(13411.7725, 1986.762333, 18793.155), 780000000., 650., 43., 0.098, vec4(97., 131., 146., 2.), 10.5, 292., vec3(475., 536., 800.), vec3(240., 219., 169.), vec3(221., 173., 106.), vec3(242., 165., 55.), 2700., 200.);
+    res.set(3, vec3(-27397.563, -27352.0892, -22861.6378), 800000000., 527., 95., 0.355, vec4(138., 211., 193., 7.), 6.48, 244., vec3(461., 400., 507.), vec3(168., 175., 221.), vec3(64., 15., 100.), vec3(135.,106., 183.), 3000., 300.);
+    res.set(4, vec3(-6744.2406, -12949.7822, -1483.17318), 950000000., 953., 97., 0.429, vec4(72., 116., 99., 6.), 9.6, 338., vec3(508., 451., 521.), vec3(143., 179., 156.), vec3(159., 211., 158.), vec3(34., 82., 75.)  , 4500., 400.);
+    res.set(5, vec3(13625.1274, 51722.1683, -14043.7552), 990000000., 999., 98., 0.973, vec4(63., 155., 222., 2.), 11.6, 303., vec3(752., 607., 441.), vec3(175., 217., 246.), vec3(95., 161., 173.), vec3(43., 127., 215.), 4500., 500.);
+    res.set(6, vec3(14351.9012, 11241.1955, 14033.6766), 600000000., 433., 56., 0.655, vec4(9., 6., 49., 12.), 15.8, 322., vec3(400., 400., 400.), vec3(30.,28.,28.), vec3(17., 18., 29.), vec3(0., 0., 0.)                , 2100. ,  600.);
+    res.set(7, vec3(0.0, 0.0, 0.0), 630000000., 410., 86., 0.3,   vec4(95., 25., 174., 0.), 10., 263., vec3(508., 555., 530.), vec3(102., 70., 134.), vec3(46., 22., 32.), vec3(176., 232., 244.)         , 2400. , 700.);
     return res;
 }
 
-void setPlanetsUniforms(const InputData& inputData, unsigned int program, std::vector<PlanetData> planets)
+// scattering in 1 / lambda^4 (Rayleigh), atmosColor holds the wavelengths
+vec3 scatteringBeta(const vec3& atmosColor, float atmosScattering)
 {
-    vec3 planetPos[NB_PLANETS]{};
-    float uPlanetRadius[NB_PLANETS]{};
-    float mountainAmplitude[NB_PLANETS]{};
-    float seaLevel[NB_PLANETS]{};
-    vec4 waterColor[NB_PLANETS]{};
-    float atmosFalloff[NB_PLANETS]{};
-    float atmosRadius[NB_PLANETS]{};
-    vec3 atmosColor[NB_PLANETS]{};
-    vec3 beachColor[NB_PLANETS]{};
-    vec3 grassColor[NB_PLANETS]{};
-    vec3 peakColor[NB_PLANETS]{};
-
-    for(int i = 0; i < NB_PLANETS; i++)
-    {
-        planetPos[i] = planets[i].p;
-        uPlanetRadius[i] = planets[i].radius;
-        mountainAmplitude[i] = planets[i].mountainAmplitude;
-        seaLevel[i] = planets[i].seaLevel;
-        waterColor[i] = planets[i].waterColor;
-        atmosFalloff[i] = planets[i].atmosFalloff;
-        atmosRadius[i] = planets[i].atmosRadius;
-        atmosColor[i] = vec3(powf(400. / planets[i].atmosColor.x, 4) * inputData.atmosScattering, powf(400. / planets[i].atmosColor.y, 4) * inputData.atmosScattering, powf(400. / planets[i].atmosColor.z, 4) * inputData.atmosScattering);
-        beachColor[i] = planets[i].beachColor;
-        grassColor[i] = planets[i].grassColor;
-        peakColor[i] = planets[i].peakColor;
-    }
+    return vec3(powf(400. / atmosColor.x, 4), powf(400. / atmosColor.y, 4), powf(400. / atmosColor.z, 4)) * atmosScattering;
+}
 
-    float planetPosLinear[NB_PLANETS * 3];
-    int i = 0; 
-    while(i < NB_PLANETS * 3) 
-    { 
-        planetPosLinear[i] = planetPos[i / 3].x; 
-        planetPosLinear[i + 1] = planetPos[i / 3].y; 
-        planetPosLinear[i + 2] = planetPos[i / 3].z; 
-        i += 3;
-    }
+// the atmosphere starts at sea level, like in raytraceMap()
+ScatteringParams atmosphereParams(const PlanetData& pd, float atmosScattering)
+{
+    ScatteringParams params;
+    params.atmosphere = OpticalDepthParams{ .planetRadius = pd.radius + pd.seaLevel * pd.mountainAmplitude, .atmosRadius = pd.atmosRadius, .falloff = pd.atmosFalloff };
+    params.beta = scatteringBeta(pd.atmosColor, atmosScattering);
+    return params;
+}
 
-    float waterColorLinear[NB_PLANETS * 4];
-    i = 0; 
-    while(i < NB_PLANETS * 4) 
-    { 
-        waterColorLinear[i] = waterColor[i / 4].x / 255.; 
-        waterColorLinear[i + 1] = waterColor[i / 4].y / 255.; 
-        waterColorLinear[i + 2] = waterColor[i / 4].z / 255.; 
-        waterColorLinear[i + 3] = waterColor[i / 4].w / 255.; 
-        i += 4;
-    }
+// the planets as a whole, for the atmosphere bakes
+std::vector<PlanetData> planetInfos(const PlanetSystem& planets)
+{
+    std::vector<PlanetData> res;
+    for(size_t i = 0; i < planets.size(); i++) res.push_back(planets.getInfo(i));
+    return res;
+}
 
-    float atmosColorLinear[NB_PLANETS * 3];
-    i = 0; 
-    while(i < NB_PLANETS * 3) 
-    { 
-        atmosColorLinear[i] = atmosColor[i / 3].x; 
-        atmosColorLinear[i + 1] = atmosColor[i / 3].y; 
-        atmosColorLinear[i + 2] = atmosColor[i / 3].z; 
-        i += 3;
-    }
+// Bakes the optical depth table of every planet's atmosphere (see atmosphere.hpp) into the layers of a float texture array.
+// The tables are also kept in luts for the scattering bakes
+unsigned int initOpticalDepthLUTs(ThreadPool& pool, const std::vector<PlanetData>& planets, std::vector<float>& luts)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+    constexpr size_t N = OPTICAL_DEPTH_LUT_SIZE;
+    luts.resize(NB_PLANETS * N * N);
+    for(size_t i = 0; i < NB_PLANETS; i++)
+        bakeOpticalDepthLUT(pool, atmosphereParams(planets[i], 0.).atmosphere, N, luts.data() + i * N * N);
+
+    unsigned int texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_R32F, N, N, NB_PLANETS, 0, GL_RED, GL_FLOAT, luts.data());
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    std::cout << "optical depth tables baked in " << std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count()
+              << " ms on " << pool.size() << " threads" << std::endl;
+    return texture;
+}
 
-    float beachColorLinear[NB_PLANETS * 3];
-    i = 0; 
-    while(i < NB_PLANETS * 3) 
-    { 
-        beachColorLinear[i] = beachColor[i / 3].x / 255.; 
-        beachColorLinear[i + 1] = beachColor[i / 3].y / 255.; 
-        beachColorLinear[i + 2] = beachColor[i / 3].z / 255.; 
-        i += 3;
-    }
-    float grassColorLinear[NB_PLANETS * 3];
-    i = 0; 
-    while(i < NB_PLANETS * 3) 
-    { 
-        grassColorLinear[i] = grassColor[i / 3].x / 255.; 
-        grassColorLinear[i + 1] = grassColor[i / 3].y / 255.; 
-        grassColorLinear[i + 2] = grassColor[i / 3].z / 255.; 
-        i += 3;
-    }
-    float peakColorLinear[NB_PLANETS * 3];
-    i = 0; 
-    while(i < NB_PLANETS * 3) 
-    { 
-        peakColorLinear[i] = peakColor[i / 3].x / 255.; 
-        peakColorLinear[i + 1] = peakColor[i / 3].y / 255.; 
-        peakColorLinear[i + 2] = peakColor[i / 3].z / 255.; 
-        i += 3;
+// Bakes the multiple scattering then the in-scattering table of every planet (see atmosphere.hpp), one after the other in the same buffer.
+// This doesn't touch GL so that it can run in the background, uploadScatteringLUTs() sends the result
+std::vector<vec3> bakeScatteringLUTs(ThreadPool& pool, const std::vector<PlanetData>& planets, float atmosScattering, const std::vector<float>& opticalDepths)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+    std::vector<vec3> luts(NB_PLANETS * SCATTERING_LUT_TEXELS);
+    std::vector<vec3> multipleScattering(MULTIPLE_SCATTERING_SIZE * MULTIPLE_SCATTERING_SIZE);
+    for(size_t i = 0; i < NB_PLANETS; i++)
+    {
+        ScatteringParams params = atmosphereParams(planets[i], atmosScattering);
+        const float* opticalDepth = opticalDepths.data() + i * OPTICAL_DEPTH_LUT_SIZE * OPTICAL_DEPTH_LUT_SIZE;
+        bakeMultipleScatteringLUT(pool, params, opticalDepth, multipleScattering.data());
+        bakeScatteringLUT(pool, params, opticalDepth, multipleScattering.data(), luts.data() + i * SCATTERING_LUT_TEXELS);
     }
+    std::cout << "scattering tables baked in " << std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count()
+              << " ms on " << pool.size() << " threads" << std::endl;
+    return luts;
+}
 
-    glUniform3fv(glGetUniformLocation(program, "planetPos"), NB_PLANETS, planetPosLinear);
-    glUniform1fv(glGetUniformLocation(program, "uPlanetRadius"), NB_PLANETS, uPlanetRadius);
-    glUniform1fv(glGetUniformLocation(program, "mountainAmplitude"), NB_PLANETS, mountainAmplitude);
-    glUniform1fv(glGetUniformLocation(program, "seaLevel"), NB_PLANETS, seaLevel);
-    glUniform4fv(glGetUniformLocation(program, "waterColor"), NB_PLANETS, waterColorLinear);
-    glUniform1fv(glGetUniformLocation(program, "atmosFalloff"), NB_PLANETS, atmosFalloff);
-    glUniform1fv(glGetUniformLocation(program, "atmosRadius"), NB_PLANETS, atmosRadius);
-    glUniform3fv(glGetUniformLocation(program, "atmosColor"), NB_PLANETS, atmosColorLinear);
-    glUniform3fv(glGetUniformLocation(program, "beachColor"), NB_PLANETS, beachColorLinear);
-    glUniform3fv(glGetUniformLocation(program, "grassColor"), NB_PLANETS, grassColorLinear);
-    glUniform3fv(glGetUniformLocation(program, "peakColor"), NB_PLANETS, peakColorLinear);
+// the planets are stacked along z, creates the texture the first time
+void uploadScatteringLUTs(unsigned int& texture, const std::vector<vec3>& luts)
+{
+    if(texture == 0) glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_3D, texture);
+    glTexImage3D(GL_TEXTURE_3D, 0, GL_RGB16F, SCATTERING_NU * SCATTERING_MU_S, SCATTERING_MU, SCATTERING_R * NB_PLANETS, 0, GL_RGB, GL_FLOAT, luts.data());
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+}
+
+// the per-planet values of main.frag, laid out like its PlanetBlock, read straight from the arrays of the planets
+PlanetBlock planetBlock(const InputData& inputData, const PlanetSystem& planets)
+{
+    PlanetBlock block{};
+    for(size_t i = 0; i < NB_PLANETS; i++)
+    {
+        const vec3 atmosColor = scatteringBeta(planets.atmosColor[i], inputData.atmosScattering);
+        const vec4& water = planets.waterColor[i];
+        const vec3 &beach = planets.beachColor[i], &grass = planets.grassColor[i], &peak = planets.peakColor[i];
+        block.planetPos[i] = { planets.pos[i].x, planets.pos[i].y, planets.pos[i].z, 0.f };
+        block.uPlanetRadius[i].value = planets.radius[i];
+        block.mountainAmplitude[i].value = planets.mountainAmplitude[i];
+        block.seaLevel[i].value = planets.seaLevel[i];
+        block.waterColor[i] = { water.x / 255.f, water.y / 255.f, water.z / 255.f, water.w / 255.f };
+        block.atmosFalloff[i].value = planets.atmosFalloff[i];
+        block.atmosRadius[i].value = planets.atmosRadius[i];
+        block.atmosColor[i] = { atmosColor.x, atmosColor.y, atmosColor.z, 0.f };
+        block.beachColor[i] = { beach.x / 255.f, beach.y / 255.f, beach.z / 255.f, 0.f };
+        block.grassColor[i] = { grass.x / 255.f, grass.y / 255.f, grass.z / 255.f, 0.f };
+        block.peakColor[i] = { peak.x / 255.f, peak.y / 255.f, peak.z / 255.f, 0.f };
+    }
+    return block;
 }
 
 int main()
 {
+    // time to first frame and to full detail are measured from here, they include the window and GL context creation
+    const auto launchTime = std::chrono::high_resolution_clock::now();
+    bool firstFrameShown = false, fullDetailShown = false;
+    // the phases up to the first frame, written to trace.json then (see profiler.h)
+    profile_begin("startup");
+
     GLFWwindow* window = nullptr;
+    profile_begin("init");
     unsigned int program = init(&window);
+    profile_end();
+    profile_begin("initUI");
     unsigned int UIprogram = initUI();
+    profile_end();
 
-    // auto earthTexture = init_texture("../assets/eart.ppm");
-    auto opticalDepthTexture = init_texture("../assets/noise.pgm");
+    profile_begin("ThreadPool");
+    ThreadPool pool;
+    profile_end();
 
+    profile_begin("Input::init");
     Input::init(window);
     auto camera = std::make_unique<Camera>(window, vec3(-9434.7906 - 300, -25662.6391 + 600, 2955.8649));
+    profile_end();
 
     auto startTime = std::chrono::high_resolution_clock::now();
     auto prevTime = startTime;
     auto lastSecondTime = startTime;
 
-    glUniform1f(glGetUniformLocation(program, "aspectRatio"), static_cast<float>(RESOLUTION_W) / static_cast<float>(RESOLUTION_H));
+    // every location is looked up once here, and again when the shaders are reloaded
+    MainUniforms uniforms;
+    uniforms.resolve(program);
+    UIUniforms uiUniforms;
+    uiUniforms.resolve(UIprogram);
+
+    glUniform1f(uniforms.aspectRatio, static_cast<float>(RESOLUTION_W) / static_cast<float>(RESOLUTION_H));
+    glUniform1i(uniforms.opticalDepthLUT, 2);
+    glUniform1i(uniforms.scatteringLUT, 3);
     glUseProgram(UIprogram);
-    glUniform1f(glGetUniformLocation(UIprogram, "aspectRatio"), static_cast<float>(RESOLUTION_W) / static_cast<float>(RESOLUTION_H));
+    glUniform1f(uiUniforms.aspectRatio, static_cast<float>(RESOLUTION_W) / static_cast<float>(RESOLUTION_H));
     glUseProgram(program);
 
+    // the parameters of the interface only change when they are edited : a group is sent again when one of its values changes
+    UniformGroup<8> sunGroup;
+    UniformGroup<1> fovGroup;
+    UniformGroup<2> waterGroup;
+    UniformGroup<4> lightGroup;
+    UniformGroup<6> starsGroup;
+    UploadStats uploads;
+
     unsigned int frameBuf, outTexture;
     generateLowResBuf(&frameBuf, &outTexture);
 
@@ -159,6 +199,73 @@ int main()
     auto planets = setupPlanets();
     float time = 0.;
 
+    std::vector<float> opticalDepths;
+    profile_begin("initOpticalDepthLUTs");
+    auto opticalDepthTexture = initOpticalDepthLUTs(pool, planetInfos(planets), opticalDepths);
+    profile_end();
+    profile_begin("PlanetHeightmaps");
+    PlanetHeightmaps heightmaps(pool, planets);
+    profile_end();
+    heightmaps.setUniforms(uniforms, 4);
+    // the camera collides with the terrain of the heightmaps
+    for(size_t i = 0; i < planets.size(); i++)
+    {
+        float minValue, maxValue;
+        heightmaps.terrainRange(i, minValue, maxValue);
+        camera->setTerrain(i, heightmaps.terrainParams(i), minValue, maxValue);
+    }
+    PlanetUniformBuffer planetBuffer;
+
+    // shaders edited while the app runs are rebuilt and swapped in (see shaderreload.hpp), the uniforms set once are set again
+    profile_begin("ShaderReloader");
+    ShaderReloader shaderReloader;
+    // the paths init() loaded them from (see pack.h)
+    auto shaderPath = [](const char* name) { return std::string(asset_root()) + "shaders/" + name; };
+    auto aspectRatio = [window] {
+        int w, h;
+        glfwGetFramebufferSize(window, &w, &h);
+        return h > 0 ? static_cast<float>(w) / static_cast<float>(h) : static_cast<float>(RESOLUTION_W) / static_cast<float>(RESOLUTION_H);
+    };
+    shaderReloader.watch(program, shaderPath("main.vert"), shaderPath("main.frag"), [&] {
+        uniforms.resolve(program);
+        glUniform1f(uniforms.aspectRatio, aspectRatio());
+        glUniform1i(uniforms.opticalDepthLUT, 2);
+        glUniform1i(uniforms.scatteringLUT, 3);
+        sunGroup.invalidate();
+        fovGroup.invalidate();
+        waterGroup.invalidate();
+        lightGroup.invalidate();
+        starsGroup.invalidate();
+        heightmaps.setUniforms(uniforms, 4);
+        set_global_programs(program, UIprogram);
+    });
+    shaderReloader.watch(UIprogram, shaderPath("main.vert"), shaderPath("ui.frag"), [&] {
+        uiUniforms.resolve(UIprogram);
+        glUniform1f(uiUniforms.aspectRatio, aspectRatio());
+        set_global_programs(program, UIprogram);
+        glUseProgram(program);
+    });
+    profile_end();
+
+    // the scattering tables depend on atmosScattering, they are rebaked in the background when it changes
+    unsigned int scatteringTexture = 0;
+    float bakedScattering = -1.;
+    std::future<std::vector<vec3>> pendingScattering;
+
+    // GPU duration of the main render pass, averaged and printed every second.
+    // Results are read a few frames later so that we never wait for the GPU
+    constexpr int NB_TIMER_QUERIES = 4;
+    unsigned int timerQueries[NB_TIMER_QUERIES];
+    glGenQueries(NB_TIMER_QUERIES, timerQueries);
+    unsigned int frameIndex = 0;
+    double gpuTimeSum = 0.;
+    int gpuTimeCount = 0, frameCount = 0;
+    // CPU time spent setting the uniforms and submitting the passes (everything of the frame but the interface and the swap)
+    double submitTimeSum = 0.;
+    // parameter uploads, summed over the frames of the second
+    unsigned long uploadCallsSum = 0, uploadBytesSum = 0;
+
+    profile_begin("first frame");
     // mainloop here
     while (!glfwWindowShouldClose(window))
     {
@@ -169,80 +276,122 @@ int main()
         prevTime = currentTime;
         time += dt; // time is sum of dt so that we can slow time and rewind it
 
+        shaderReloader.update();
+        const auto submitStart = std::chrono::high_resolution_clock::now();
+
         // glActiveTexture(GL_TEXTURE0);
         // glBindTexture(GL_TEXTURE_2D, earthTexture);
         // glUniform1i(glGetUniformLocation(program, "earthTexture"), 0);
 
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, opticalDepthTexture);
-        glUniform1i(glGetUniformLocation(program, "heightmap"), 1);
+        uploads = UploadStats{};
+
+        glActiveTexture(GL_TEXTURE2);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, opticalDepthTexture);
 
         auto inputData = Input::getInput();
-        glUniform1f(glGetUniformLocation(program, "time"), time);
-        glUniform3f(glGetUniformLocation(program, "sunPos"), 
-            inputData.sunPos[0], inputData.sunPos[1], inputData.sunPos[2]);
-        glUniform1f(glGetUniformLocation(program, "sunRadius"), inputData.sunRadius);
-        glUniform3f(glGetUniformLocation(program, "sunColor"), 
-            inputData.sunColor[0], inputData.sunColor[1], inputData.sunColor[2]);
-        glUniform1f(glGetUniformLocation(program, "sunCoronaStrength"), 
-            inputData.sunCoronaStrength);
-        glUniform1f(glGetUniformLocation(program, "fov"), inputData.fov * 3.1415 / 180.);
-
-        glUniform1f(glGetUniformLocation(program, "NB_STEPS_i"), inputData.nb_steps_i);
-        glUniform1f(glGetUniformLocation(program, "NB_STEPS_j"), inputData.nb_steps_j);
-        glUniform1f(glGetUniformLocation(program, "refractionindex"), inputData.refractionindex);
-        glUniform1f(glGetUniformLocation(program, "fresnel"), inputData.fresnel);
-
-        glUniform1f(glGetUniformLocation(program, "ambientCoef"), inputData.ambientCoef);
-        glUniform1f(glGetUniformLocation(program, "diffuseCoef"), inputData.diffuseCoef);
-        glUniform1f(glGetUniformLocation(program, "minDiffuse"), inputData.minDiffuse);
-        glUniform1f(glGetUniformLocation(program, "penumbraCoef"), inputData.penumbraCoef);
-
-        glUniform1f(glGetUniformLocation(program, "nbStars"), inputData.nbStars);
-        glUniform1f(glGetUniformLocation(program, "starsDisplacement"), inputData.starsDisplacement);
-        glUniform1f(glGetUniformLocation(program, "starSize"), inputData.starSize);
-        glUniform1f(glGetUniformLocation(program, "starSizeVariation"), inputData.starSizeVariation);
-        glUniform1f(glGetUniformLocation(program, "starVoidThreshold"), inputData.starVoidThreshold);
-        glUniform1f(glGetUniformLocation(program, "starFlickering"), inputData.starFlickering);
+        glUniform1f(uniforms.time, time);
+        uploads.add(1, sizeof(float));
+
+        if(sunGroup.changed({ inputData.sunPos[0], inputData.sunPos[1], inputData.sunPos[2], inputData.sunRadius,
+                              inputData.sunColor[0], inputData.sunColor[1], inputData.sunColor[2], inputData.sunCoronaStrength }))
+        {
+            glUniform3f(uniforms.sunPos, 
+                inputData.sunPos[0], inputData.sunPos[1], inputData.sunPos[2]);
+            glUniform1f(uniforms.sunRadius, inputData.sunRadius);
+            glUniform3f(uniforms.sunColor, 
+                inputData.sunColor[0], inputData.sunColor[1], inputData.sunColor[2]);
+            glUniform1f(uniforms.sunCoronaStrength, 
+                inputData.sunCoronaStrength);
+            uploads.add(4, 8 * sizeof(float));
+        }
+        if(fovGroup.changed({ inputData.fov }))
+        {
+            glUniform1f(uniforms.fov, inputData.fov * 3.1415 / 180.);
+            // main.frag puts the screen (2 units high) at 2 / tan(fov / 2) from the eye
+            glUniform1f(uniforms.pixelAngle, tan(0.5 * inputData.fov * 3.1415 / 180.) / LOW_RES_H);
+            uploads.add(2, 2 * sizeof(float));
+        }
+
+        if(waterGroup.changed({ inputData.refractionindex, inputData.fresnel }))
+        {
+            glUniform1f(uniforms.refractionindex, inputData.refractionindex);
+            glUniform1f(uniforms.fresnel, inputData.fresnel);
+            uploads.add(2, 2 * sizeof(float));
+        }
+
+        if(lightGroup.changed({ inputData.ambientCoef, inputData.diffuseCoef, inputData.minDiffuse, inputData.penumbraCoef }))
+        {
+            glUniform1f(uniforms.ambientCoef, inputData.ambientCoef);
+            glUniform1f(uniforms.diffuseCoef, inputData.diffuseCoef);
+            glUniform1f(uniforms.minDiffuse, inputData.minDiffuse);
+            glUniform1f(uniforms.penumbraCoef, inputData.penumbraCoef);
+            uploads.add(4, 4 * sizeof(float));
+        }
+
+        if(starsGroup.changed({ inputData.nbStars, inputData.starsDisplacement, inputData.starSize,
+                                inputData.starSizeVariation, inputData.starVoidThreshold, inputData.starFlickering }))
+        {
+            glUniform1f(uniforms.nbStars, inputData.nbStars);
+            glUniform1f(uniforms.starsDisplacement, inputData.starsDisplacement);
+            glUniform1f(uniforms.starSize, inputData.starSize);
+            glUniform1f(uniforms.starSizeVariation, inputData.starSizeVariation);
+            glUniform1f(uniforms.starVoidThreshold, inputData.starVoidThreshold);
+            glUniform1f(uniforms.starFlickering, inputData.starFlickering);
+            uploads.add(6, 6 * sizeof(float));
+        }
 
         camera->setSpeedRef(inputData.cameraSpeed);
         camera->setJumpStrength(inputData.jumpStrength);
-        std::vector<PlanetData> pdv;
-        for(int i = 0; i < NB_PLANETS; i++)
+        camera->update(dt, realTime, planets);
+        planetBuffer.update(planetBlock(inputData, planets));
+        uploads.add(1, sizeof(PlanetBlock));
+
+        heightmaps.update(camera->getPos(), planets);
+        heightmaps.bind(uniforms, 4, uploads);
+
+        if(inputData.atmosScattering != bakedScattering && !pendingScattering.valid())
         {
-            pdv.push_back(planets[i]->getInfo());
+            bakedScattering = inputData.atmosScattering;
+            pendingScattering = std::async(std::launch::async, [&pool, &opticalDepths, infos = planetInfos(planets), bakedScattering] {
+                return bakeScatteringLUTs(pool, infos, bakedScattering, opticalDepths);
+            });
         }
-        camera->update(dt, realTime, pdv);
-        setPlanetsUniforms(inputData, program, pdv);
-
-        for(const auto& e : planets)
+        glActiveTexture(GL_TEXTURE3);
+        // the first tables are waited for, the next ones replace the old ones once they are ready
+        if(pendingScattering.valid() && (scatteringTexture == 0 || pendingScattering.wait_for(std::chrono::seconds(0)) == std::future_status::ready))
         {
-            e->update(dt);
+            ProfileScope scope("scattering tables");
+            uploadScatteringLUTs(scatteringTexture, pendingScattering.get());
         }
+        glBindTexture(GL_TEXTURE_3D, scatteringTexture);
+
+        planets.update(dt);
 
         vec3 camPos = camera->getPos();
-        glUniform3f(glGetUniformLocation(program ,"cameraPos"), camPos.x, camPos.y, camPos.z);
+        glUniform3f(uniforms.cameraPos, camPos.x, camPos.y, camPos.z);
 
         vec2 camTheta = camera->getAngle();
-        glUniform2f(glGetUniformLocation(program ,"cameraRotation"), camTheta.x, camTheta.y);
+        glUniform2f(uniforms.cameraRotation, camTheta.x, camTheta.y);
 
         float lb[9];
         camera->getPlanetBasis(lb);
-        glUniformMatrix3fv(glGetUniformLocation(program ,"planetBasis"), 1, false, lb);
+        glUniformMatrix3fv(uniforms.planetBasis, 1, false, lb);
+        uploads.add(3, (3 + 2 + 9) * sizeof(float));
 
         vec3 portalPlane1{}, portalPlane2{};
         vec3 portalPos1{}, portalPos2{};
         float portalSize1 = -1., portalSize2 = -1.;
         float pb1[9], pb2[9];
         camera->getPortalInfo(portalPlane1, portalPlane2, portalPos1, portalPos2, portalSize1, portalSize2, pb1, pb2);
-        glUniform3f(glGetUniformLocation(program ,"portalPlane1"), portalPlane1.x, portalPlane1.y, portalPlane1.z);
-        glUniform3f(glGetUniformLocation(program ,"portalPlane2"), portalPlane2.x, portalPlane2.y, portalPlane2.z);
-        glUniform3f(glGetUniformLocation(program ,"portalPos1"), portalPos1.x, portalPos1.y, portalPos1.z);
-        glUniform3f(glGetUniformLocation(program ,"portalPos2"), portalPos2.x, portalPos2.y, portalPos2.z);
-        glUniform1f(glGetUniformLocation(program ,"portalSize1"), portalSize1);
-        glUniform1f(glGetUniformLocation(program ,"portalSize2"), portalSize2);
-        glUniformMatrix3fv(glGetUniformLocation(program ,"portalBasis1"), 1, false, pb1);
-        glUniformMatrix3fv(glGetUniformLocation(program ,"portalBasis2"), 1, false, pb2);
+        glUniform3f(uniforms.portalPlane1, portalPlane1.x, portalPlane1.y, portalPlane1.z);
+        glUniform3f(uniforms.portalPlane2, portalPlane2.x, portalPlane2.y, portalPlane2.z);
+        glUniform3f(uniforms.portalPos1, portalPos1.x, portalPos1.y, portalPos1.z);
+        glUniform3f(uniforms.portalPos2, portalPos2.x, portalPos2.y, portalPos2.z);
+        glUniform1f(uniforms.portalSize1, portalSize1);
+        glUniform1f(uniforms.portalSize2, portalSize2);
+        glUniformMatrix3fv(uniforms.portalBasis1, 1, false, pb1);
+        glUniformMatrix3fv(uniforms.portalBasis2, 1, false, pb2);
+        uploads.add(8, (4 * 3 + 2 + 2 * 9) * sizeof(float));
 
         int W, H;
         glfwGetWindowSize(window, &W, &H);
@@ -252,7 +401,11 @@ int main()
         glViewport(0, 0, LOW_RES_W, LOW_RES_H);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
+        glBeginQuery(GL_TIME_ELAPSED, timerQueries[frameIndex % NB_TIMER_QUERIES]);
         glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, NULL);
+        glEndQuery(GL_TIME_ELAPSED);
+        heightmaps.endFrame();
+        planetBuffer.endFrame();
 
         glBindFramebuffer(GL_READ_FRAMEBUFFER, frameBuf);
         glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
@@ -260,19 +413,64 @@ int main()
 
         // Draw UI over the framebuffer
         glUseProgram(UIprogram);
-        glUniform1f(glGetUniformLocation(UIprogram, "time"), time);
-        glUniform1f(glGetUniformLocation(UIprogram, "tCharge"), camera->getDashTimer());
-        glUniform1f(glGetUniformLocation(UIprogram, "tBulletTime"), camera->getBulletTimer());
-        glUniform1f(glGetUniformLocation(UIprogram, "tRewind"), camera->isRewinding() ? 1. : 0.);
+        glUniform1f(uiUniforms.time, time);
+        glUniform1f(uiUniforms.tCharge, camera->getDashTimer());
+        glUniform1f(uiUniforms.tBulletTime, camera->getBulletTimer());
+        glUniform1f(uiUniforms.tRewind, camera->isRewinding() ? 1. : 0.);
+        uploads.add(4, 4 * sizeof(float));
         
         glViewport(0, 0, W, H);
         glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, NULL);
         glUseProgram(program);
+        submitTimeSum += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - submitStart).count();
+        uploadCallsSum += uploads.calls;
+        uploadBytesSum += uploads.bytes;
 
         Input::renderInterface();
 
         glfwSwapBuffers(window);
         glfwPollEvents();
+
+        if(!firstFrameShown || (!fullDetailShown && heightmaps.fullDetail()))
+        {
+            const char* what = firstFrameShown ? "full detail" : "first frame";
+            std::cout << what << " after " << std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - launchTime).count()
+                      << " ms" << std::endl;
+            if(!firstFrameShown)
+            {
+                profile_end(); // first frame
+                profile_end(); // startup
+                profile_write_trace("trace.json");
+            }
+            fullDetailShown = firstFrameShown;
+            firstFrameShown = true;
+        }
+
+        frameIndex++;
+        frameCount++;
+        if(frameIndex >= NB_TIMER_QUERIES)
+        {
+            unsigned int oldest = timerQueries[frameIndex % NB_TIMER_QUERIES];
+            int available = 0;
+            glGetQueryObjectiv(oldest, GL_QUERY_RESULT_AVAILABLE, &available);
+            if(available)
+            {
+                GLuint64 ns = 0;
+                glGetQueryObjectui64v(oldest, GL_QUERY_RESULT, &ns);
+                gpuTimeSum += ns * 1e-6;
+                gpuTimeCount++;
+            }
+        }
+        if(std::chrono::duration<float>(currentTime - lastSecondTime).count() >= 1.f)
+        {
+            if(gpuTimeCount > 0)
+                std::cout << "frame : " << gpuTimeSum / gpuTimeCount << " ms GPU (main pass), " << submitTimeSum / frameCount << " ms CPU (submit), "
+                          << uploadCallsSum / frameCount << " uploads (" << uploadBytesSum / frameCount << " bytes), " << frameCount << " FPS" << std::endl;
+            gpuTimeSum = submitTimeSum = 0.;
+            uploadCallsSum = uploadBytesSum = 0;
+            gpuTimeCount = frameCount = 0;
+            lastSecondTime = currentTime;
+        }
     }
     Input::destroy();
 
@@ -0,0 +1,364 @@
+#include "noise.hpp"
+
+#include <cstring>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define NOISE_X86
+#include <immintrin.h>
+#endif
+
+// found this on https://gist.github.com/patriciogonzalezvivo/670c22f3966e662d2f83
+static vec4 mod289(vec4 x){return x - vec4::floor(x * (1.0 / 289.0)) * 289.0;}
+static vec4 perm(vec4 x){return mod289(((x * 34.0) + vec4(1.,1.,1.,1.)) * x);}
+
+float noise(vec3 p)
+{
+    vec3 a = vec3::floor(p);
+    vec3 d = p - a;
+    d = d * d * (vec3(3.,3.,3.) - d * 2.);
+
+    vec4 b = vec4(a.x, a.x, a.y, a.y) + vec4(0.0, 1.0, 0.0, 1.0);
+    vec4 k1 = perm(vec4(b.x, b.y, b.x, b.y));
+    vec4 k2 = perm(vec4(k1.x, k1.y, k1.x, k1.y) + vec4(b.z, b.z, b.w, b.w));
+
+    vec4 c = k2 + vec4(a.z, a.z, a.z, a.z);
+    vec4 k3 = perm(c);
+    vec4 k4 = perm(c + vec4(1.,1.,1.,1.));
+
+    vec4 o1 = vec4::fract(k3 * (1.0 / 41.0));
+    vec4 o2 = vec4::fract(k4 * (1.0 / 41.0));
+
+    vec4 o3 = o2 * d.z + o1 * (1.0 - d.z);
+    vec2 o4 = vec2(o3.y, o3.w) * d.x + vec2(o3.x, o3.z) * (1.0 - d.x);
+
+    return o4.y * d.y + o4.x * (1.0 - d.y);
+}
+
+void FBMParams::setSeed(unsigned int s)
+{
+    seed = s;
+    // splitmix32 so that close seeds give unrelated offsets, kept in [0, 289) which is the period of the hash
+    auto next = [&s]() {
+        unsigned int z = (s += 0x9e3779b9u);
+        z = (z ^ (z >> 16)) * 0x85ebca6bu;
+        z = (z ^ (z >> 13)) * 0xc2b2ae35u;
+        return static_cast<float>((z ^ (z >> 16)) % 289u);
+    };
+    for(int i = 0; i < FBM_MAX_OCTAVES; i++)
+        offsets[i] = seed == 0 ? vec3() : vec3(next(), next(), next());
+}
+
+float fbm(vec3 x, const FBMParams& params)
+{
+    float G = params.gain;
+    float f = params.frequency;
+    float a = 1.0;
+    float t = 0.0;
+    int numOctaves = std::min(params.octaves, FBM_MAX_OCTAVES);
+    for( int i=0; i<numOctaves; i++ )
+    {
+        t += noise(x * f + params.offsets[i]) * a;
+        f *= 2.0;
+        a *= G;
+    }
+    return t;
+}
+
+float noised(vec3 p, vec3& gradient)
+{
+    vec3 a = vec3::floor(p);
+    vec3 w = p - a;
+    vec3 d = w * w * (vec3(3.,3.,3.) - w * 2.);
+    vec3 dd = w * (vec3(1.,1.,1.) - w) * 6.; // derivative of the smoothstep
+
+    vec4 b = vec4(a.x, a.x, a.y, a.y) + vec4(0.0, 1.0, 0.0, 1.0);
+    vec4 k1 = perm(vec4(b.x, b.y, b.x, b.y));
+    vec4 k2 = perm(vec4(k1.x, k1.y, k1.x, k1.y) + vec4(b.z, b.z, b.w, b.w));
+
+    vec4 c = k2 + vec4(a.z, a.z, a.z, a.z);
+    vec4 k3 = perm(c);
+    vec4 k4 = perm(c + vec4(1.,1.,1.,1.));
+
+    // corners (x, y) = (0, 0), (1, 0), (0, 1), (1, 1), at z = 0 then z = 1
+    vec4 o1 = vec4::fract(k3 * (1.0 / 41.0));
+    vec4 o2 = vec4::fract(k4 * (1.0 / 41.0));
+
+    vec4 o3 = o2 * d.z + o1 * (1.0 - d.z);
+    vec4 dz = o2 - o1;
+    vec2 o4 = vec2(o3.y, o3.w) * d.x + vec2(o3.x, o3.z) * (1.0 - d.x);
+    vec2 dzx = vec2(dz.y, dz.w) * d.x + vec2(dz.x, dz.z) * (1.0 - d.x);
+
+    gradient = vec3(((o3.y - o3.x) * (1.f - d.y) + (o3.w - o3.z) * d.y) * dd.x,
+                    (o4.y - o4.x) * dd.y,
+                    (dzx.x * (1.f - d.y) + dzx.y * d.y) * dd.z);
+    return o4.y * d.y + o4.x * (1.0 - d.y);
+}
+
+float fbmd(vec3 x, vec3& gradient, const FBMParams& params)
+{
+    float G = params.gain;
+    float f = params.frequency;
+    float a = 1.0;
+    float t = 0.0;
+    gradient = vec3();
+    int numOctaves = std::min(params.octaves, FBM_MAX_OCTAVES);
+    for( int i=0; i<numOctaves; i++ )
+    {
+        vec3 g;
+        t += noised(x * f + params.offsets[i], g) * a;
+        gradient += g * (a * f);
+        f *= 2.0;
+        a *= G;
+    }
+    return t;
+}
+
+// The vectorized kernels below follow the scalar code operation by operation (same rounding order,
+// and floor/fract are computed like vec4::floor and vec4::fract with a truncation), one lane per direction.
+// The only difference is the final lerp which the scalar version does in double precision
+
+#ifdef NOISE_X86
+
+// ______________________________________________ SSE2 (4 directions) ______________________________________________
+
+static inline __m128 floor4(__m128 x)
+{
+    __m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(x));
+    return _mm_sub_ps(t, _mm_and_ps(_mm_cmplt_ps(x, _mm_setzero_ps()), _mm_set1_ps(1.f)));
+}
+
+static inline __m128 fract4(__m128 x)
+{
+    __m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(x));
+    return _mm_add_ps(_mm_sub_ps(x, t), _mm_and_ps(_mm_cmplt_ps(x, _mm_setzero_ps()), _mm_set1_ps(1.f)));
+}
+
+static inline __m128 perm4(__m128 x)
+{
+    __m128 y = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(34.f)), _mm_set1_ps(1.f)), x);
+    __m128 q = floor4(_mm_mul_ps(y, _mm_set1_ps(static_cast<float>(1.0 / 289.0))));
+    return _mm_sub_ps(y, _mm_mul_ps(q, _mm_set1_ps(289.f)));
+}
+
+static inline __m128 lerp4(__m128 a, __m128 b, __m128 t, __m128 oneMinusT)
+{
+    return _mm_add_ps(_mm_mul_ps(b, t), _mm_mul_ps(a, oneMinusT));
+}
+
+static inline __m128 noise4(__m128 px, __m128 py, __m128 pz)
+{
+    const __m128 one = _mm_set1_ps(1.f), inv41 = _mm_set1_ps(static_cast<float>(1.0 / 41.0));
+
+    __m128 ax = floor4(px), ay = floor4(py), az = floor4(pz);
+    __m128 dx = _mm_sub_ps(px, ax), dy = _mm_sub_ps(py, ay), dz = _mm_sub_ps(pz, az);
+    dx = _mm_mul_ps(_mm_mul_ps(dx, dx), _mm_sub_ps(_mm_set1_ps(3.f), _mm_mul_ps(dx, _mm_set1_ps(2.f))));
+    dy = _mm_mul_ps(_mm_mul_ps(dy, dy), _mm_sub_ps(_mm_set1_ps(3.f), _mm_mul_ps(dy, _mm_set1_ps(2.f))));
+    dz = _mm_mul_ps(_mm_mul_ps(dz, dz), _mm_sub_ps(_mm_set1_ps(3.f), _mm_mul_ps(dz, _mm_set1_ps(2.f))));
+
+    // k1 = (perm(ax), perm(ax + 1), perm(ax), perm(ax + 1))
+    __m128 k1x = perm4(ax), k1y = perm4(_mm_add_ps(ax, one));
+    __m128 ay1 = _mm_add_ps(ay, one);
+
+    // k2 + az, then the 8 corners of the cell
+    __m128 c0 = _mm_add_ps(perm4(_mm_add_ps(k1x, ay)), az);
+    __m128 c1 = _mm_add_ps(perm4(_mm_add_ps(k1y, ay)), az);
+    __m128 c2 = _mm_add_ps(perm4(_mm_add_ps(k1x, ay1)), az);
+    __m128 c3 = _mm_add_ps(perm4(_mm_add_ps(k1y, ay1)), az);
+
+    __m128 oneMinusDz = _mm_sub_ps(one, dz);
+    __m128 o30 = lerp4(fract4(_mm_mul_ps(perm4(c0), inv41)), fract4(_mm_mul_ps(perm4(_mm_add_ps(c0, one)), inv41)), dz, oneMinusDz);
+    __m128 o31 = lerp4(fract4(_mm_mul_ps(perm4(c1), inv41)), fract4(_mm_mul_ps(perm4(_mm_add_ps(c1, one)), inv41)), dz, oneMinusDz);
+    __m128 o32 = lerp4(fract4(_mm_mul_ps(perm4(c2), inv41)), fract4(_mm_mul_ps(perm4(_mm_add_ps(c2, one)), inv41)), dz, oneMinusDz);
+    __m128 o33 = lerp4(fract4(_mm_mul_ps(perm4(c3), inv41)), fract4(_mm_mul_ps(perm4(_mm_add_ps(c3, one)), inv41)), dz, oneMinusDz);
+
+    __m128 oneMinusDx = _mm_sub_ps(one, dx);
+    __m128 o4x = lerp4(o30, o31, dx, oneMinusDx);
+    __m128 o4y = lerp4(o32, o33, dx, oneMinusDx);
+
+    return lerp4(o4x, o4y, dy, _mm_sub_ps(one, dy));
+}
+
+static void fbmSSE2(const float* x, const float* y, const float* z, float* out, size_t n, const FBMParams& params)
+{
+    const float G = params.gain;
+    const int numOctaves = std::min(params.octaves, FBM_MAX_OCTAVES);
+    size_t k = 0;
+    for(; k + 4 <= n; k += 4)
+    {
+        __m128 px = _mm_loadu_ps(x + k), py = _mm_loadu_ps(y + k), pz = _mm_loadu_ps(z + k);
+        __m128 t = _mm_setzero_ps();
+        float f = params.frequency, a = 1.0;
+        for(int i = 0; i < numOctaves; i++)
+        {
+            const vec3& o = params.offsets[i];
+            __m128 vf = _mm_set1_ps(f);
+            __m128 v = noise4(_mm_add_ps(_mm_mul_ps(px, vf), _mm_set1_ps(o.x)),
+                              _mm_add_ps(_mm_mul_ps(py, vf), _mm_set1_ps(o.y)),
+                              _mm_add_ps(_mm_mul_ps(pz, vf), _mm_set1_ps(o.z)));
+            t = _mm_add_ps(t, _mm_mul_ps(v, _mm_set1_ps(a)));
+            f *= 2.0;
+            a *= G;
+        }
+        _mm_storeu_ps(out + k, t);
+    }
+    for(; k < n; k++) out[k] = fbm(vec3(x[k], y[k], z[k]), params);
+}
+
+// ______________________________________________ AVX2 (8 directions) ______________________________________________
+
+#pragma GCC push_options
+#pragma GCC target("avx2")
+
+static inline __m256 floor8(__m256 x)
+{
+    __m256 t = _mm256_cvtepi32_ps(_mm256_cvttps_epi32(x));
+    return _mm256_sub_ps(t, _mm256_and_ps(_mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_LT_OQ), _mm256_set1_ps(1.f)));
+}
+
+static inline __m256 fract8(__m256 x)
+{
+    __m256 t = _mm256_cvtepi32_ps(_mm256_cvttps_epi32(x));
+    return _mm256_add_ps(_mm256_sub_ps(x, t), _mm256_and_ps(_mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_LT_OQ), _mm256_set1_ps(1.f)));
+}
+
+static inline __m256 perm8(__m256 x)
+{
+    __m256 y = _mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(x, _mm256_set1_ps(34.f)), _mm256_set1_ps(1.f)), x);
+    __m256 q = floor8(_mm256_mul_ps(y, _mm256_set1_ps(static_cast<float>(1.0 / 289.0))));
+    return _mm256_sub_ps(y, _mm256_mul_ps(q, _mm256_set1_ps(289.f)));
+}
+
+static inline __m256 lerp8(__m256 a, __m256 b, __m256 t, __m256 oneMinusT)
+{
+    return _mm256_add_ps(_mm256_mul_ps(b, t), _mm256_mul_ps(a, oneMinusT));
+}
+
+static inline __m256 noise8(__m256 px, __m256 py, __m256 pz)
+{
+    const __m256 one = _mm256_set1_ps(1.f), inv41 = _mm256_set1_ps(static_cast<float>(1.0 / 41.0));
+
+    __m256 ax = floor8(px), ay = floor8(py), az = floor8(pz);
+    __m256 dx = _mm256_sub_ps(px, ax), dy = _mm256_sub_ps(py, ay), dz = _mm256_sub_ps(pz, az);
+    dx = _mm256_mul_ps(_mm256_mul_ps(dx, dx), _mm256_sub_ps(_mm256_set1_ps(3.f), _mm256_mul_ps(dx, _mm256_set1_ps(2.f))));
+    dy = _mm256_mul_ps(_mm256_mul_ps(dy, dy), _mm256_sub_ps(_mm256_set1_ps(3.f), _mm256_mul_ps(dy, _mm256_set1_ps(2.f))));
+    dz = _mm256_mul_ps(_mm256_mul_ps(dz, dz), _mm256_sub_ps(_mm256_set1_ps(3.f), _mm256_mul_ps(dz, _mm256_set1_ps(2.f))));
+
+    __m256 k1x = perm8(ax), k1y = perm8(_mm256_add_ps(ax, one));
+    __m256 ay1 = _mm256_add_ps(ay, one);
+
+    __m256 c0 = _mm256_add_ps(perm8(_mm256_add_ps(k1x, ay)), az);
+    __m256 c1 = _mm256_add_ps(perm8(_mm256_add_ps(k1y, ay)), az);
+    __m256 c2 = _mm256_add_ps(perm8(_mm256_add_ps(k1x, ay1)), az);
+    __m256 c3 = _mm256_add_ps(perm8(_mm256_add_ps(k1y, ay1)), az);
+
+    __m256 oneMinusDz = _mm256_sub_ps(one, dz);
+    __m256 o30 = lerp8(fract8(_mm256_mul_ps(perm8(c0), inv41)), fract8(_mm256_mul_ps(perm8(_mm256_add_ps(c0, one)), inv41)), dz, oneMinusDz);
+    __m256 o31 = lerp8(fract8(_mm256_mul_ps(perm8(c1), inv41)), fract8(_mm256_mul_ps(perm8(_mm256_add_ps(c1, one)), inv41)), dz, oneMinusDz);
+    __m256 o32 = lerp8(fract8(_mm256_mul_ps(perm8(c2), inv41)), fract8(_mm256_mul_ps(perm8(_mm256_add_ps(c2, one)), inv41)), dz, oneMinusDz);
+    __m256 o33 = lerp8(fract8(_mm256_mul_ps(perm8(c3), inv41)), fract8(_mm256_mul_ps(perm8(_mm256_add_ps(c3, one)), inv41)), dz, oneMinusDz);
+
+    __m256 oneMinusDx = _mm256_sub_ps(one, dx);
+    __m256 o4x = lerp8(o30, o31, dx, oneMinusDx);
+    __m256 o4y = lerp8(o32, o33, dx, oneMinusDx);
+
+    return lerp8(o4x, o4y, dy, _mm256_sub_ps(one, dy));
+}
+
+static void fbmAVX2(const float* x, const float* y, const float* z, float* out, size_t n, const FBMParams& params)
+{
+    const float G = params.gain;
+    const int numOctaves = std::min(params.octaves, FBM_MAX_OCTAVES);
+    size_t k = 0;
+    for(; k + 8 <= n; k += 8)
+    {
+        __m256 px = _mm256_loadu_ps(x + k), py = _mm256_loadu_ps(y + k), pz = _mm256_loadu_ps(z + k);
+        __m256 t = _mm256_setzero_ps();
+        float f = params.frequency, a = 1.0;
+        for(int i = 0; i < numOctaves; i++)
+        {
+            const vec3& o = params.offsets[i];
+            __m256 vf = _mm256_set1_ps(f);
+            __m256 v = noise8(_mm256_add_ps(_mm256_mul_ps(px, vf), _mm256_set1_ps(o.x)),
+                              _mm256_add_ps(_mm256_mul_ps(py, vf), _mm256_set1_ps(o.y)),
+                              _mm256_add_ps(_mm256_mul_ps(pz, vf), _mm256_set1_ps(o.z)));
+            t = _mm256_add_ps(t, _mm256_mul_ps(v, _mm256_set1_ps(a)));
+            f *= 2.0;
+            a *= G;
+        }
+        _mm256_storeu_ps(out + k, t);
+    }
+    for(; k < n; k++) out[k] = fbm(vec3(x[k], y[k], z[k]), params);
+}
+
+#pragma GCC pop_options
+
+#endif // NOISE_X86
+
+static void fbmScalar(const float* x, const float* y, const float* z, float* out, size_t n, const FBMParams& params)
+{
+    for(size_t k = 0; k < n; k++) out[k] = fbm(vec3(x[k], y[k], z[k]), params);
+}
+
+using FbmKernel = void (*)(const float*, const float*, const float*, float*, size_t, const FBMParams&);
+
+struct KernelChoice
+{
+    FbmKernel kernel;
+    const char* name;
+};
+
+static KernelChoice bestKernel()
+{
+#ifdef NOISE_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")) return { fbmAVX2, "avx2" };
+    return { fbmSSE2, "sse2" };
+#else
+    return { fbmScalar, "scalar" };
+#endif
+}
+
+static KernelChoice currentKernel = bestKernel();
+
+void fbmBatch(const float* x, const float* y, const float* z, float* out, size_t n, const FBMParams& params)
+{
+    currentKernel.kernel(x, y, z, out, n, params);
+}
+
+const char* fbmBatchKernelName()
+{
+    return currentKernel.name;
+}
+
+bool fbmBatchSelectKernel(const char* name)
+{
+    if(!strcmp(name, "scalar"))
+    {
+        currentKernel = { fbmScalar, "scalar" };
+        return true;
+    }
+#ifdef NOISE_X86
+    if(!strcmp(name, "sse2"))
+    {
+        currentKernel = { fbmSSE2, "sse2" };
+        return true;
+    }
+    if(!strcmp(name, "avx2") && __builtin_cpu_supports("avx2"))
+    {
+        currentKernel = { fbmAVX2, "avx2" };
+        return true;
+    }
+#endif
+    return false;
+}
+
+int64_t ulpDistance(float a, float b)
+{
+    int32_t ia, ib;
+    memcpy(&ia, &a, sizeof(float)); memcpy(&ib, &b, sizeof(float));
+    // map the sign-magnitude representation on a monotonic integer line
+    int64_t la = ia < 0 ? INT64_C(0x80000000) - ia : ia;
+    int64_t lb = ib < 0 ? INT64_C(0x80000000) - ib : ib;
+    return la > lb ? la - lb : lb - la;
+}
@@ -0,0 +1,159 @@
+#include "pack.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+uint64_t pack_checksum(const void *data, size_t size)
+{
+    const unsigned char *bytes = data;
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+int pack_open(const char *path, AssetPack *pack)
+{
+    memset(pack, 0, sizeof(*pack));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        printf("Can't find %s\n", path);
+        return 0;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(PackHeader))
+    {
+        printf("%s is too short to be a pack\n", path);
+        close(fd);
+        return 0;
+    }
+    void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+    {
+        printf("Can't map %s : %s\n", path, strerror(errno));
+        return 0;
+    }
+
+    const PackHeader *header = p;
+    const PackEntry *entries = (const PackEntry *)(header + 1);
+    size_t size = st.st_size;
+    if (memcmp(header->magic, PACK_MAGIC, sizeof(header->magic)) != 0 || header->version != PACK_VERSION
+        || header->entryCount > (size - sizeof(PackHeader)) / sizeof(PackEntry)
+        || pack_checksum(entries, header->entryCount * sizeof(PackEntry)) != header->tocChecksum)
+    {
+        printf("%s isn't a version %d pack, or its table of contents is corrupted\n", path, PACK_VERSION);
+        munmap(p, size);
+        return 0;
+    }
+    for (uint32_t i = 0; i < header->entryCount; i++)
+    {
+        const PackEntry *e = entries + i;
+        if (e->name[PACK_NAME_SIZE - 1] != '\0' || e->offset % PACK_ALIGNMENT != 0 || e->offset > size || e->size >= size - e->offset
+            || (i > 0 && strcmp(entries[i - 1].name, e->name) >= 0))
+        {
+            printf("%s : entry %u is out of the file or out of order\n", path, i);
+            munmap(p, size);
+            return 0;
+        }
+    }
+
+    pack->data = p;
+    pack->size = size;
+    pack->entries = entries;
+    pack->entryCount = header->entryCount;
+    pack->verified = calloc(header->entryCount + 1, 1);
+    return 1;
+}
+
+// directory of the executable with its '/', "" if /proc/self/exe can't be read (the working directory then)
+static const char *executable_dir(void)
+{
+    // first called by init(), before any other thread looks at it
+    static char dir[PATH_MAX];
+    static int found = 0;
+    if (!found)
+    {
+        found = 1;
+        ssize_t n = readlink("/proc/self/exe", dir, sizeof(dir) - 1);
+        dir[n > 0 ? n : 0] = '\0';
+        char *slash = strrchr(dir, '/');
+        if (slash) slash[1] = '\0';
+        else dir[0] = '\0';
+    }
+    return dir;
+}
+
+const char *asset_root(void)
+{
+    static char root[PATH_MAX + 3];
+    if (!root[0]) snprintf(root, sizeof(root), "%s../", executable_dir());
+    return root;
+}
+
+int asset_path(const char *relative, char *path, size_t size)
+{
+    int n = snprintf(path, size, "%s%s", asset_root(), relative);
+    return n >= 0 && (size_t)n < size;
+}
+
+int pack_open_default(AssetPack *pack)
+{
+    memset(pack, 0, sizeof(*pack));
+    char path[PATH_MAX];
+    if (snprintf(path, sizeof(path), "%s" PACK_FILE_NAME, executable_dir()) >= (int)sizeof(path)) return 0;
+
+    if (access(path, R_OK) != 0) return 0;
+    return pack_open(path, pack);
+}
+
+void pack_close(AssetPack *pack)
+{
+    if (pack->data) munmap((void *)pack->data, pack->size);
+    free(pack->verified);
+    memset(pack, 0, sizeof(*pack));
+}
+
+const void *pack_find(AssetPack *pack, const char *name, size_t *size)
+{
+    if (!pack->data) return NULL;
+
+    uint32_t lo = 0, hi = pack->entryCount;
+    while (lo < hi)
+    {
+        uint32_t mid = lo + (hi - lo) / 2;
+        int c = strcmp(pack->entries[mid].name, name);
+        if (c == 0)
+        {
+            const PackEntry *e = pack->entries + mid;
+            const unsigned char *blob = pack->data + e->offset;
+            // the blob is read anyway by whoever asked for it, checking it first only brings its pages in a bit earlier
+            if (!pack->verified[mid])
+            {
+                if (pack_checksum(blob, e->size) != e->checksum || blob[e->size] != '\0')
+                {
+                    printf("%s is corrupted in the pack\n", name);
+                    return NULL;
+                }
+                pack->verified[mid] = 1;
+            }
+            if (size) *size = e->size;
+            return blob;
+        }
+        if (c < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return NULL;
+}
@@ -0,0 +1,154 @@
+#include "../include/pack.h"
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+
+// Writes the asset pack read by the renderer (see pack.h) : every file given on the command line, named by its path relative to --root
+
+struct PackedFile
+{
+    std::string name;
+    std::vector<char> data;
+};
+
+bool readWholeFile(const std::string& path, std::vector<char>& data)
+{
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if(!file) return false;
+    data.resize(file.tellg());
+    file.seekg(0);
+    return static_cast<bool>(file.read(data.data(), data.size()));
+}
+
+bool writePack(std::vector<PackedFile>& files, const std::string& output)
+{
+    std::sort(files.begin(), files.end(), [](const PackedFile& a, const PackedFile& b) { return a.name < b.name; });
+    for(size_t i = 1; i < files.size(); i++)
+        if(files[i].name == files[i - 1].name)
+        {
+            std::cout << files[i].name << " is given twice" << std::endl;
+            return false;
+        }
+
+    std::vector<PackEntry> entries(files.size());
+    size_t offset = pack_align(sizeof(PackHeader) + entries.size() * sizeof(PackEntry));
+    for(size_t i = 0; i < files.size(); i++)
+    {
+        memset(&entries[i], 0, sizeof(PackEntry));
+        memcpy(entries[i].name, files[i].name.c_str(), files[i].name.size());
+        entries[i].offset = offset;
+        entries[i].size = files[i].data.size();
+        entries[i].checksum = pack_checksum(files[i].data.data(), files[i].data.size());
+        // + 1 for the '\0' after every blob
+        offset = pack_align(offset + files[i].data.size() + 1);
+    }
+
+    PackHeader header{};
+    memcpy(header.magic, PACK_MAGIC, sizeof(header.magic));
+    header.version = PACK_VERSION;
+    header.entryCount = entries.size();
+    header.tocChecksum = pack_checksum(entries.data(), entries.size() * sizeof(PackEntry));
+
+    // written next to the output then renamed, a running renderer never maps half a pack
+    std::string tmp = output + ".tmp";
+    std::ofstream file(tmp, std::ios::binary);
+    if(!file)
+    {
+        std::cout << "Can't write " << tmp << std::endl;
+        return false;
+    }
+    std::vector<char> zeros(PACK_ALIGNMENT + 1, 0);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(PackEntry));
+    size_t written = sizeof(header) + entries.size() * sizeof(PackEntry);
+    for(size_t i = 0; i < files.size(); i++)
+    {
+        file.write(zeros.data(), entries[i].offset - written);
+        file.write(files[i].data.data(), files[i].data.size());
+        written = entries[i].offset + files[i].data.size();
+    }
+    // the '\0' after the last blob
+    file.write(zeros.data(), pack_align(written + 1) - written);
+    file.close();
+    if(!file || rename(tmp.c_str(), output.c_str()) != 0)
+    {
+        std::cout << "Can't write " << output << std::endl;
+        remove(tmp.c_str());
+        return false;
+    }
+    std::cout << files.size() << " files packed into " << output << " (" << pack_align(written + 1) << " bytes)" << std::endl;
+    return true;
+}
+
+void printUsage()
+{
+    std::cout << "usage : solar_pack [options] FILE...\n"
+                 "  --root DIR                the files are named by their path relative to DIR (default .)\n"
+                 "  --output PATH             pack to write (default " PACK_FILE_NAME "), the renderer looks for it next to its executable\n";
+}
+
+int main(int argc, char** argv)
+{
+    std::string root = ".", output = PACK_FILE_NAME;
+    std::vector<std::string> paths;
+
+    for(int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if(arg == "--help" || arg == "-h")
+        {
+            printUsage();
+            return 0;
+        }
+        if(arg.compare(0, 2, "--") != 0)
+        {
+            paths.push_back(arg);
+            continue;
+        }
+        if(i + 1 >= argc)
+        {
+            std::cout << "Missing value after " << arg << std::endl;
+            printUsage();
+            return 1;
+        }
+        const char* value = argv[++i];
+        if(arg == "--root") root = value;
+        else if(arg == "--output") output = value;
+        else
+        {
+            std::cout << "Unknown option " << arg << std::endl;
+            printUsage();
+            return 1;
+        }
+    }
+    if(paths.empty())
+    {
+        printUsage();
+        return 1;
+    }
+    if(root.back() != '/') root += '/';
+
+    std::vector<PackedFile> files(paths.size());
+    for(size_t i = 0; i < paths.size(); i++)
+    {
+        const std::string& path = paths[i];
+        // names relative to the root, so that they are the same whatever directory the pack is built from
+        files[i].name = path.compare(0, root.size(), root) == 0 ? path.substr(root.size()) : path;
+        if(files[i].name.empty() || files[i].name.size() >= PACK_NAME_SIZE)
+        {
+            std::cout << path << " : the name " << files[i].name << " doesn't fit in a pack entry (" << PACK_NAME_SIZE - 1 << " characters at most)" << std::endl;
+            return 1;
+        }
+        if(!readWholeFile(path, files[i].data))
+        {
+            std::cout << "Can't read " << path << std::endl;
+            return 1;
+        }
+    }
+    return writePack(files, output) ? 0 : 1;
+}
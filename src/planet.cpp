@@ -1,41 +1,69 @@
 #include "planet.hpp"
 #include "input.hpp"
 
+static const vec3 sunPos = vec3(0.,30.,10360.);
 
-Planet::Planet( const vec3& __pos, const float& __mass, const float& __radius, 
-                const float& __mountainAmplitude, const float& __seaLevel, const vec4& __waterColor, 
-                const float& __atmosFalloff, const float& __atmosRadius, const vec3& __atmosColor, 
-                const vec3& __beachColor, const vec3& __grassColor, const vec3& __peakColor,
-                const float& __periodDuration, const float& __phase )
-    : pos(__pos), mass(__mass), radius(__radius), mountainAmplitude(__mountainAmplitude), 
-        seaLevel(__seaLevel), waterColor(__waterColor), atmosFalloff(__atmosFalloff),
-        atmosRadius(__atmosRadius), atmosColor(__atmosColor),
-        beachColor(__beachColor), grassColor(__grassColor), peakColor(__peakColor),
-        periodDuration(__periodDuration), phase(__phase)
+void PlanetSystem::set( size_t i, const vec3& __pos, const float& __mass, const float& __radius, 
+                        const float& __mountainAmplitude, const float& __seaLevel, const vec4& __waterColor, 
+                        const float& __atmosFalloff, const float& __atmosRadius, const vec3& __atmosColor, 
+                        const vec3& __beachColor, const vec3& __grassColor, const vec3& __peakColor,
+                        const float& __periodDuration, const float& __phase )
 {
-    pos -= sunPos;
-    pos.y = cosf(phase) * pos.y - sinf(phase) * pos.z;
-    pos.z = sinf(phase) * pos.y + cosf(phase) * pos.z;
-    pos += sunPos;
+    vec3 p = __pos - sunPos;
+    p.y = cosf(__phase) * p.y - sinf(__phase) * p.z;
+    p.z = sinf(__phase) * p.y + cosf(__phase) * p.z;
+    pos[i] = p + sunPos;
+    radius[i] = __radius;
+    mass[i] = __mass;
+    periodDuration[i] = __periodDuration;
+
+    mountainAmplitude[i] = __mountainAmplitude;
+    seaLevel[i] = __seaLevel;
+    waterColor[i] = __waterColor;
+    atmosFalloff[i] = __atmosFalloff;
+    atmosRadius[i] = __atmosRadius;
+    atmosColor[i] = __atmosColor;
+    beachColor[i] = __beachColor;
+    grassColor[i] = __grassColor;
+    peakColor[i] = __peakColor;
 }
 
-PlanetData Planet::getInfo() const
+PlanetData PlanetSystem::getInfo(size_t i) const
 {
     PlanetData ans{
-        .p = pos, .radius = radius, .mass = mass,
-        .mountainAmplitude = mountainAmplitude, .seaLevel = seaLevel, .waterColor = waterColor,
-        .atmosFalloff = atmosFalloff, .atmosRadius = atmosRadius, .atmosColor = atmosColor,
-        .beachColor = beachColor, .grassColor = grassColor, .peakColor = peakColor
+        .p = pos[i], .radius = radius[i], .mass = mass[i],
+        .mountainAmplitude = mountainAmplitude[i], .seaLevel = seaLevel[i], .waterColor = waterColor[i],
+        .atmosFalloff = atmosFalloff[i], .atmosRadius = atmosRadius[i], .atmosColor = atmosColor[i],
+        .beachColor = beachColor[i], .grassColor = grassColor[i], .peakColor = peakColor[i]
     };
 
     return ans;
 }
 
-void Planet::update(const float& dt)
+size_t PlanetSystem::closest(const vec3& p) const
+{
+    size_t ans = 0;
+    float best = INFINITY;
+    for(size_t i = 0; i < NB_PLANETS; i++)
+    {
+        float d = (pos[i] - p).length();
+        if(d < best)
+        {
+            best = d;
+            ans = i;
+        }
+    }
+    return ans;
+}
+
+void PlanetSystem::update(const float& dt)
 {
-    float dphi = 2. * M_PIf * dt / periodDuration;
-    pos -= sunPos;
-    pos.y = cosf(dphi) * pos.y - sinf(dphi) * pos.z;
-    pos.z = sinf(dphi) * pos.y + cosf(dphi) * pos.z;
-    pos += sunPos;
-}
\ No newline at end of file
+    for(size_t i = 0; i < NB_PLANETS; i++)
+    {
+        float dphi = 2. * M_PIf * dt / periodDuration[i];
+        vec3 p = pos[i] - sunPos;
+        p.y = cosf(dphi) * p.y - sinf(dphi) * p.z;
+        p.z = sinf(dphi) * p.y + cosf(dphi) * p.z;
+        pos[i] = p + sunPos;
+    }
+}
@@ -0,0 +1,51 @@
+#include <glad.h>
+
+#include "planetblock.hpp"
+
+#include <cstring>
+
+PlanetUniformBuffer::PlanetUniformBuffer()
+{
+    int alignment = 256;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    stride = (sizeof(PlanetBlock) + alignment - 1) / alignment * alignment;
+
+    const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+    glBufferStorage(GL_UNIFORM_BUFFER, NB_COPIES * stride, nullptr, flags);
+    mapped = static_cast<unsigned char*>(glMapBufferRange(GL_UNIFORM_BUFFER, 0, NB_COPIES * stride, flags));
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+PlanetUniformBuffer::~PlanetUniformBuffer()
+{
+    for(void* f : fences)
+        if(f) glDeleteSync(static_cast<GLsync>(f));
+    glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+    glUnmapBuffer(GL_UNIFORM_BUFFER);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    glDeleteBuffers(1, &buffer);
+}
+
+void PlanetUniformBuffer::update(const PlanetBlock& block)
+{
+    const int k = frame % NB_COPIES;
+    if(fences[k])
+    {
+        // the GPU is done with this copy, three frames ago
+        glClientWaitSync(static_cast<GLsync>(fences[k]), GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+        glDeleteSync(static_cast<GLsync>(fences[k]));
+        fences[k] = nullptr;
+    }
+    memcpy(mapped + k * stride, &block, sizeof(PlanetBlock));
+    glBindBufferRange(GL_UNIFORM_BUFFER, PLANET_BLOCK_BINDING, buffer, k * stride, sizeof(PlanetBlock));
+}
+
+void PlanetUniformBuffer::endFrame()
+{
+    const int k = frame % NB_COPIES;
+    if(fences[k]) glDeleteSync(static_cast<GLsync>(fences[k]));
+    fences[k] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    frame++;
+}
@@ -0,0 +1,108 @@
+#include "pnm.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static int is_space(unsigned char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+}
+
+// skips whitespace and comments from *pos, then reads a decimal number. Returns -1 if there is none or if it overflows
+static long read_header_number(const unsigned char *data, size_t size, size_t *pos)
+{
+    while (*pos < size)
+    {
+        if (data[*pos] == '#')
+            while (*pos < size && data[*pos] != '\n' && data[*pos] != '\r') (*pos)++;
+        else if (is_space(data[*pos]))
+            (*pos)++;
+        else
+            break;
+    }
+    if (*pos >= size || data[*pos] < '0' || data[*pos] > '9') return -1;
+
+    long n = 0;
+    while (*pos < size && data[*pos] >= '0' && data[*pos] <= '9')
+    {
+        n = 10 * n + (data[*pos] - '0');
+        if (n > INT_MAX) return -1;
+        (*pos)++;
+    }
+    return n;
+}
+
+size_t pnm_parse_header(const unsigned char *data, size_t size, int *width, int *height, int *channels)
+{
+    if (size < 2 || data[0] != 'P' || (data[1] != '5' && data[1] != '6')) return 0;
+    *channels = data[1] == '5' ? 1 : 3;
+
+    size_t pos = 2;
+    long w = read_header_number(data, size, &pos);
+    long h = read_header_number(data, size, &pos);
+    long maxval = read_header_number(data, size, &pos);
+    // a comment right after maxval, its end of line is the whitespace that ends the header
+    if (pos < size && data[pos] == '#')
+        while (pos < size && data[pos] != '\n' && data[pos] != '\r') pos++;
+    // a single whitespace ends the header, the first pixel can be anything (even '#' or a space)
+    if (w <= 0 || h <= 0 || maxval != 255 || pos >= size || !is_space(data[pos])) return 0;
+    pos++;
+
+    if ((size_t)w * (size_t)h > (size - pos) / *channels) return 0;
+    *width = (int)w;
+    *height = (int)h;
+    return pos;
+}
+
+int pnm_map(const char *path, PNMImage *image)
+{
+    memset(image, 0, sizeof(*image));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        printf("Can't find %s\n", path);
+        return 0;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        printf("Can't read %s\n", path);
+        close(fd);
+        return 0;
+    }
+    void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+    {
+        printf("Can't map %s : %s\n", path, strerror(errno));
+        return 0;
+    }
+    // read once from start to end by the upload
+    madvise(p, st.st_size, MADV_SEQUENTIAL);
+    madvise(p, st.st_size, MADV_WILLNEED);
+
+    size_t offset = pnm_parse_header(p, st.st_size, &image->width, &image->height, &image->channels);
+    if (offset == 0)
+    {
+        printf("%s isn't a binary PPM/PGM with a maxval of 255, or it is truncated\n", path);
+        munmap(p, st.st_size);
+        return 0;
+    }
+    image->pixels = (const unsigned char *)p + offset;
+    image->mapping = p;
+    image->mapping_size = st.st_size;
+    return 1;
+}
+
+void pnm_unmap(PNMImage *image)
+{
+    if (image->mapping) munmap(image->mapping, image->mapping_size);
+    memset(image, 0, sizeof(*image));
+}
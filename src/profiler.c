@@ -0,0 +1,139 @@
+#include <glad.h>
+#include <GLFW/glfw3.h>
+
+#include "profiler.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define PROFILE_MAX_DEPTH 32
+
+typedef struct
+{
+    char name[64];
+    double begin, end;          // microseconds since the first phase
+    int depth;
+    unsigned int queries[2];    // GL timestamps of the beginning and the end, 0 without a context
+} ProfileEvent;
+
+static ProfileEvent events[PROFILE_MAX_EVENTS];
+static int nb_events = 0;
+static int open_events[PROFILE_MAX_DEPTH];
+static int depth = 0;
+static double origin = -1.;
+static int written = 0;
+
+static double now_us(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    double us = t.tv_sec * 1e6 + t.tv_nsec * 1e-3;
+    if (origin < 0.) origin = us;
+    return us - origin;
+}
+
+// the queries need a current context and the GL functions, which appear halfway through init()
+static int gl_ready(void)
+{
+    return glfwGetCurrentContext() != NULL && glad_glQueryCounter != NULL;
+}
+
+void profile_begin(const char *name)
+{
+    if (written || depth >= PROFILE_MAX_DEPTH) return;
+    if (nb_events >= PROFILE_MAX_EVENTS)
+    {
+        // still nested, profile_end() must find something to close
+        open_events[depth++] = -1;
+        return;
+    }
+    ProfileEvent *e = events + nb_events;
+    memset(e, 0, sizeof(*e));
+    snprintf(e->name, sizeof(e->name), "%s", name);
+    e->depth = depth;
+    e->end = -1.;
+    if (gl_ready())
+    {
+        glGenQueries(2, e->queries);
+        glQueryCounter(e->queries[0], GL_TIMESTAMP);
+    }
+    e->begin = now_us();
+    open_events[depth++] = nb_events++;
+}
+
+void profile_end(void)
+{
+    if (written || depth == 0) return;
+    int i = open_events[--depth];
+    if (i < 0) return;
+    events[i].end = now_us();
+    if (events[i].queries[0]) glQueryCounter(events[i].queries[1], GL_TIMESTAMP);
+}
+
+// names go between quotes in the JSON
+static void write_name(FILE *file, const char *name)
+{
+    fputc('"', file);
+    for (; *name; name++)
+    {
+        if (*name == '"' || *name == '\\') fputc('\\', file);
+        if ((unsigned char)*name >= 0x20) fputc(*name, file);
+    }
+    fputc('"', file);
+}
+
+int profile_write_trace(const char *path)
+{
+    // GPU timestamps are in nanoseconds from an unspecified origin : shifted so that the GPU clock reads the same as ours right now
+    double gpu_offset = 0.;
+    int has_gpu = gl_ready();
+    if (has_gpu)
+    {
+        glFinish();
+        GLint64 gpu_now;
+        glGetInteger64v(GL_TIMESTAMP, &gpu_now);
+        gpu_offset = now_us() - gpu_now * 1e-3;
+    }
+
+    FILE *file = fopen(path, "w");
+    if (file == NULL)
+    {
+        printf("Can't write %s\n", path);
+        return 0;
+    }
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"CPU\"}},\n");
+    fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"GPU\"}}");
+    for (int i = 0; i < nb_events; i++)
+    {
+        ProfileEvent *e = events + i;
+        // still open, it lasts until now
+        if (e->end < e->begin) e->end = now_us();
+        fprintf(file, ",\n{\"name\":");
+        write_name(file, e->name);
+        fprintf(file, ",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f}", e->begin, e->end - e->begin);
+
+        if (has_gpu && e->queries[0])
+        {
+            GLuint64 gpu_begin = 0, gpu_end = 0;
+            glGetQueryObjectui64v(e->queries[0], GL_QUERY_RESULT, &gpu_begin);
+            glGetQueryObjectui64v(e->queries[1], GL_QUERY_RESULT, &gpu_end);
+            glDeleteQueries(2, e->queries);
+            e->queries[0] = e->queries[1] = 0;
+            if (gpu_end < gpu_begin) continue;
+            fprintf(file, ",\n{\"name\":");
+            write_name(file, e->name);
+            fprintf(file, ",\"ph\":\"X\",\"pid\":1,\"tid\":2,\"ts\":%.3f,\"dur\":%.3f}", gpu_begin * 1e-3 + gpu_offset, (gpu_end - gpu_begin) * 1e-3);
+        }
+    }
+    fprintf(file, "\n]}\n");
+    int ok = fclose(file) == 0;
+    written = 1;
+
+    printf("startup :");
+    for (int i = 0; i < nb_events; i++)
+        if (events[i].depth <= 1) printf("%s%s %.1f ms", events[i].depth == 0 ? "\n  " : ", ", events[i].name, 1e-3 * (events[i].end - events[i].begin));
+    printf("\n  trace written to %s\n", path);
+    return ok;
+}
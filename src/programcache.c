@@ -0,0 +1,133 @@
+#include <glad.h>
+
+#include "programcache.h"
+#include "pack.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <limits.h>
+
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define PROGRAM_MAGIC "SOLARPRG"
+
+typedef struct
+{
+    char magic[8];
+    uint64_t key;       // checked again on load, the file name could collide
+    uint32_t format;    // binaryFormat of glGetProgramBinary
+    uint32_t length;
+} ProgramBinaryHeader;
+
+// FNV-1a 64 bits of s and its '\0', continuing hash
+static uint64_t mix(uint64_t hash, const char *s)
+{
+    if (!s) s = "";
+    do
+    {
+        hash ^= (unsigned char)*s;
+        hash *= 0x100000001b3ull;
+    } while (*s++);
+    return hash;
+}
+
+static uint64_t program_key(const char *vertex_shader, const char *fragment_shader)
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    hash = mix(hash, (const char *)glGetString(GL_VENDOR));
+    hash = mix(hash, (const char *)glGetString(GL_RENDERER));
+    hash = mix(hash, (const char *)glGetString(GL_VERSION));
+    hash = mix(hash, vertex_shader);
+    return mix(hash, fragment_shader);
+}
+
+static void program_path(uint64_t key, char *path, size_t size)
+{
+    snprintf(path, size, "%s" PROGRAM_CACHE_DIR "/program-%016llx.bin", asset_root(), (unsigned long long)key);
+}
+
+unsigned int load_program_binary(const char *vertex_shader, const char *fragment_shader)
+{
+    uint64_t key = program_key(vertex_shader, fragment_shader);
+    char path[PATH_MAX];
+    program_path(key, path, sizeof(path));
+
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) return 0;
+    ProgramBinaryHeader header;
+    void *binary = NULL;
+    if (fread(&header, sizeof(header), 1, file) == 1 && memcmp(header.magic, PROGRAM_MAGIC, sizeof(header.magic)) == 0 && header.key == key
+        && (binary = malloc(header.length)) != NULL && fread(binary, 1, header.length, file) != header.length)
+    {
+        free(binary);
+        binary = NULL;
+    }
+    fclose(file);
+
+    unsigned int program = 0;
+    if (binary)
+    {
+        program = glCreateProgram();
+        glProgramBinary(program, header.format, binary, header.length);
+        free(binary);
+        int ok;
+        glGetProgramiv(program, GL_LINK_STATUS, &ok);
+        if (!ok)
+        {
+            glDeleteProgram(program);
+            program = 0;
+        }
+    }
+    // truncated, or made by a driver which says it's the same but doesn't take it anymore
+    if (!program)
+    {
+        printf("%s can't be loaded, the program is linked again\n", path);
+        unlink(path);
+    }
+    return program;
+}
+
+void save_program_binary(unsigned int program, const char *vertex_shader, const char *fragment_shader)
+{
+    int formats = 0, length = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (formats == 0 || length <= 0) return;
+
+    ProgramBinaryHeader header;
+    memcpy(header.magic, PROGRAM_MAGIC, sizeof(header.magic));
+    header.key = program_key(vertex_shader, fragment_shader);
+    void *binary = malloc(length);
+    if (!binary) return;
+    GLenum format;
+    GLsizei written = 0;
+    glGetProgramBinary(program, length, &written, &format, binary);
+    header.format = format;
+    header.length = written;
+
+    char dir[PATH_MAX];
+    asset_path(PROGRAM_CACHE_DIR, dir, sizeof(dir));
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST)
+    {
+        printf("Can't create %s : %s\n", dir, strerror(errno));
+        free(binary);
+        return;
+    }
+    // written aside then renamed, another instance never reads half a binary
+    char path[PATH_MAX], tmp[PATH_MAX + 32];
+    program_path(header.key, path, sizeof(path));
+    snprintf(tmp, sizeof(tmp), "%s.tmp%d", path, (int)getpid());
+    FILE *file = fopen(tmp, "wb");
+    int ok = file && written > 0 && fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(binary, 1, written, file) == (size_t)written;
+    if (file && fclose(file) != 0) ok = 0;
+    if (!ok || rename(tmp, path) != 0)
+    {
+        printf("Can't write %s\n", path);
+        unlink(tmp);
+    }
+    free(binary);
+}
@@ -0,0 +1,183 @@
+#include "shaderloader.h"
+#include "init.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct
+{
+    char *path;
+    const char *text;       // whole file, '\0' terminated
+    int owned;              // text was read from disk (and is freed with the cache), otherwise it points into the asset pack
+    char *expanded;         // with its includes, once it has been loaded as a shader
+    unsigned int stamp;     // equal to the current expansion if it was already pasted into it
+} CachedFile;
+
+typedef struct
+{
+    char *data;
+    size_t size, capacity;
+} Buffer;
+
+static CachedFile *files = NULL;
+static int nb_files = 0, files_capacity = 0;
+static unsigned int expansion = 0;
+static int from_files = 0;
+
+static int append(Buffer *b, const char *s, size_t n)
+{
+    if (b->size + n + 1 > b->capacity)
+    {
+        size_t capacity = b->capacity ? b->capacity : 4096;
+        while (b->size + n + 1 > capacity) capacity *= 2;
+        char *data = realloc(b->data, capacity);
+        if (!data) return 0;
+        b->data = data;
+        b->capacity = capacity;
+    }
+    memcpy(b->data + b->size, s, n);
+    b->size += n;
+    b->data[b->size] = '\0';
+    return 1;
+}
+
+// index of path in the cache, read on the first call. -1 if it can't be read
+static int cached_file(const char *path)
+{
+    for (int i = 0; i < nb_files; i++)
+        if (strcmp(files[i].path, path) == 0) return i;
+
+    const char *text = from_files ? NULL : find_asset(path, NULL);
+    int owned = 0;
+    if (!text)
+    {
+        text = read_shader(path);
+        if (!text) return -1;
+        owned = 1;
+    }
+    if (nb_files == files_capacity)
+    {
+        files_capacity = files_capacity ? 2 * files_capacity : 16;
+        files = realloc(files, files_capacity * sizeof(CachedFile));
+    }
+    CachedFile *f = files + nb_files;
+    memset(f, 0, sizeof(*f));
+    f->path = malloc(strlen(path) + 1);
+    strcpy(f->path, path);
+    f->text = text;
+    f->owned = owned;
+    return nb_files++;
+}
+
+// name between the quotes if line is an #include directive, its length in *n
+static const char *include_name(const char *line, const char *end, size_t *n)
+{
+    while (line < end && (*line == ' ' || *line == '\t')) line++;
+    if (end - line < 8 || strncmp(line, "#include", 8) != 0) return NULL;
+    line += 8;
+    while (line < end && (*line == ' ' || *line == '\t')) line++;
+    if (line >= end || *line != '"') return NULL;
+    const char *name = ++line;
+    while (line < end && *line != '"') line++;
+    if (line >= end || line == name) return NULL;
+    *n = line - name;
+    return name;
+}
+
+// pastes file into out with its includes. number is its source string number in the #line directives (0 for the shader itself)
+static int expand(int file, int number, Buffer *out)
+{
+    files[file].stamp = expansion;
+    // the cache can move while the includes are read, hence the copies
+    const char *text = files[file].text;
+    char dir[512];
+    const char *slash = strrchr(files[file].path, '/');
+    size_t dir_size = slash ? (size_t)(slash + 1 - files[file].path) : 0;
+    if (dir_size >= sizeof(dir)) dir_size = 0;
+    memcpy(dir, files[file].path, dir_size);
+
+    int line_number = 1;
+    for (const char *line = text; *line; line_number++)
+    {
+        const char *end = strchr(line, '\n');
+        if (!end) end = line + strlen(line);
+
+        size_t n;
+        const char *name = include_name(line, end, &n);
+        if (!name)
+        {
+            if (!append(out, line, end - line) || !append(out, "\n", 1)) return 0;
+        }
+        else
+        {
+            char path[1024];
+            if (dir_size + n >= sizeof(path))
+            {
+                printf("%s:%d : the included path is too long\n", files[file].path, line_number);
+                return 0;
+            }
+            memcpy(path, dir, dir_size);
+            memcpy(path + dir_size, name, n);
+            path[dir_size + n] = '\0';
+
+            int included = cached_file(path);
+            if (included < 0)
+            {
+                printf("%s:%d : can't include %s\n", files[file].path, line_number, path);
+                return 0;
+            }
+            // already there (included twice, or by one of the files it includes)
+            if (files[included].stamp != expansion)
+            {
+                char directive[64];
+                snprintf(directive, sizeof(directive), "#line 1 %d\n", included + 1);
+                if (!append(out, directive, strlen(directive)) || !expand(included, included + 1, out)) return 0;
+                snprintf(directive, sizeof(directive), "#line %d %d\n", line_number + 1, number);
+                if (!append(out, directive, strlen(directive))) return 0;
+            }
+        }
+        line = *end ? end + 1 : end;
+    }
+    return 1;
+}
+
+const char *load_shader(const char *path)
+{
+    int file = cached_file(path);
+    if (file < 0) return NULL;
+    if (files[file].expanded) return files[file].expanded;
+
+    // stamps from the previous expansions don't count
+    expansion++;
+    Buffer out = { NULL, 0, 0 };
+    if (!expand(file, 0, &out))
+    {
+        free(out.data);
+        return NULL;
+    }
+    return files[file].expanded = out.data;
+}
+
+const char *shader_file_name(int n)
+{
+    return n >= 1 && n <= nb_files ? files[n - 1].path : NULL;
+}
+
+void shader_read_files(int on)
+{
+    from_files = on;
+}
+
+void shader_cache_clear(void)
+{
+    for (int i = 0; i < nb_files; i++)
+    {
+        free(files[i].path);
+        if (files[i].owned) free((char *)files[i].text);
+        free(files[i].expanded);
+    }
+    free(files);
+    files = NULL;
+    nb_files = files_capacity = 0;
+}
@@ -0,0 +1,195 @@
+#include <glad.h>
+#include <GLFW/glfw3.h>
+
+#include "shaderreload.hpp"
+#include "shaderloader.h"
+#include "init.h"
+
+#include <iostream>
+#include <chrono>
+#include <cstring>
+#include <cerrno>
+
+#include <unistd.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+
+// KHR_parallel_shader_compile isn't in glad.h
+constexpr GLenum GL_COMPLETION_STATUS_KHR = 0x91B1;
+typedef void (*MaxShaderCompilerThreadsProc)(GLuint count);
+
+// editors write a file in several steps (and some of them save every file at once) : the rebuild waits for this long without events
+constexpr long long RELOAD_DEBOUNCE_NS = 100'000'000;
+
+static long long steadyNow()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static bool hasExtension(const char* name)
+{
+    int count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for(int i = 0; i < count; i++)
+        if(strcmp(reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i)), name) == 0) return true;
+    return false;
+}
+
+ShaderReloader::ShaderReloader()
+{
+    for(const char* name : { "GL_KHR_parallel_shader_compile", "GL_ARB_parallel_shader_compile" })
+    {
+        if(!hasExtension(name)) continue;
+        // both have the same entry point, ARB with its own name
+        auto maxThreads = reinterpret_cast<MaxShaderCompilerThreadsProc>(glfwGetProcAddress(name[3] == 'K' ? "glMaxShaderCompilerThreadsKHR" : "glMaxShaderCompilerThreadsARB"));
+        if(!maxThreads) continue;
+        // as many as the driver wants
+        maxThreads(0xFFFFFFFF);
+        parallelCompile = true;
+        break;
+    }
+
+    inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    stopFd = eventfd(0, EFD_CLOEXEC);
+    if(inotifyFd < 0 || stopFd < 0)
+    {
+        std::cerr << "shader hot-reload disabled : " << strerror(errno) << std::endl;
+        return;
+    }
+    watcher = std::thread(&ShaderReloader::watchLoop, this);
+}
+
+ShaderReloader::~ShaderReloader()
+{
+    if(watcher.joinable())
+    {
+        uint64_t one = 1;
+        if(write(stopFd, &one, sizeof(one)) != sizeof(one)) std::cerr << "can't stop the shader watcher" << std::endl;
+        watcher.join();
+    }
+    for(auto& w : programs)
+        if(w.pending) glDeleteProgram(w.pending);
+    if(inotifyFd >= 0) close(inotifyFd);
+    if(stopFd >= 0) close(stopFd);
+}
+
+void ShaderReloader::watch(unsigned int& program, const std::string& vertexPath, const std::string& fragmentPath, std::function<void()> onSwap)
+{
+    Watched w;
+    w.program = &program;
+    w.vertexPath = vertexPath;
+    w.fragmentPath = fragmentPath;
+    w.onSwap = std::move(onSwap);
+    programs.push_back(std::move(w));
+    watchShaderFiles();
+}
+
+void ShaderReloader::watchShaderFiles()
+{
+    if(inotifyFd < 0) return;
+    std::lock_guard<std::mutex> lock(mutex);
+    for(int n = 1; shader_file_name(n); n++)
+    {
+        std::string path = shader_file_name(n);
+        files.insert(path);
+        size_t slash = path.find_last_of('/');
+        std::string dir = slash == std::string::npos ? "." : path.substr(0, slash);
+        // the same directory gives the same watch
+        int wd = inotify_add_watch(inotifyFd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+        if(wd < 0) std::cerr << "can't watch " << dir << " : " << strerror(errno) << std::endl;
+        else watchDirs[wd] = dir;
+    }
+}
+
+void ShaderReloader::watchLoop()
+{
+    alignas(inotify_event) char buffer[4096];
+    pollfd fds[2] = { { inotifyFd, POLLIN, 0 }, { stopFd, POLLIN, 0 } };
+    while(true)
+    {
+        if(poll(fds, 2, -1) < 0)
+        {
+            if(errno == EINTR) continue;
+            return;
+        }
+        if(fds[1].revents) return;
+
+        ssize_t n;
+        while((n = read(inotifyFd, buffer, sizeof(buffer))) > 0)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for(char* p = buffer; p < buffer + n; p += sizeof(inotify_event) + reinterpret_cast<inotify_event*>(p)->len)
+            {
+                auto* event = reinterpret_cast<inotify_event*>(p);
+                auto dir = watchDirs.find(event->wd);
+                if(event->len == 0 || dir == watchDirs.end() || !files.count(dir->second + "/" + event->name)) continue;
+                lastChange = steadyNow();
+                changed = true;
+            }
+        }
+    }
+}
+
+void ShaderReloader::update()
+{
+    if(changed && steadyNow() - lastChange > RELOAD_DEBOUNCE_NS)
+    {
+        changed = false;
+        startRebuilds();
+    }
+
+    for(auto& w : programs)
+    {
+        if(!w.pending) continue;
+        if(parallelCompile && !w.fromBinary)
+        {
+            int done = 0;
+            glGetProgramiv(w.pending, GL_COMPLETION_STATUS_KHR, &done);
+            if(!done) continue;
+        }
+        if(finishRebuild(w))
+        {
+            glUseProgram(*w.program);
+            w.onSwap();
+        }
+    }
+}
+
+void ShaderReloader::startRebuilds()
+{
+    // the pack has the shaders as they were when it was built, the files are the ones being edited
+    shader_read_files(1);
+    shader_cache_clear();
+    for(auto& w : programs)
+    {
+        if(w.pending) glDeleteProgram(w.pending);
+        w.pending = 0;
+        const char* vs = load_shader(w.vertexPath.c_str());
+        const char* fs = load_shader(w.fragmentPath.c_str());
+        if(!vs || !fs) continue;
+        // the cache is cleared by the next change, the rebuild keeps its own copies
+        w.vertexSource = vs;
+        w.fragmentSource = fs;
+        w.pending = start_program(vs, fs, &w.fromBinary);
+        std::cout << "reloading " << w.fragmentPath << (parallelCompile ? " in the background" : "") << std::endl;
+    }
+    // a new #include can bring new files (and directories)
+    watchShaderFiles();
+}
+
+bool ShaderReloader::finishRebuild(Watched& w)
+{
+    unsigned int program = w.pending;
+    w.pending = 0;
+    if(!finish_program(program, w.fromBinary, w.vertexSource.c_str(), w.fragmentSource.c_str()))
+    {
+        std::cout << w.fragmentPath << " : keeping the previous program" << std::endl;
+        glDeleteProgram(program);
+        return false;
+    }
+    glDeleteProgram(*w.program);
+    *w.program = program;
+    std::cout << w.fragmentPath << " reloaded" << std::endl;
+    return true;
+}
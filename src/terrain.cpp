@@ -0,0 +1,524 @@
+#include <glad.h>
+#include <GLFW/glfw3.h>
+
+#include "terrain.hpp"
+#include "heightmap.hpp"
+#include "bc4.hpp"
+#include "virtualheightmap.hpp"
+#include "uploadring.hpp"
+#include "uniforms.hpp"
+#include "threadpool.hpp"
+
+#include <iostream>
+#include <algorithm>
+#include <iterator>
+#include <cstring>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// GL_ARB_texture_filter_minmax, not in glad.h
+#ifndef GL_TEXTURE_REDUCTION_MODE_ARB
+#define GL_TEXTURE_REDUCTION_MODE_ARB 0x9366
+#endif
+
+FBMParams planetHeightmapParams(size_t planet)
+{
+    FBMParams params;
+    params.setSeed(1 + planet);
+    return params;
+}
+
+// BC4 levels of a tile : down to a block
+constexpr int COMPRESSED_TILE_LEVELS = HEIGHTMAP_TILE_LEVELS - 2;
+
+// bytes of the BC4 levels of a tile
+size_t compressedTileBytes()
+{
+    size_t bytes = 0;
+    for(int level = 0; level < COMPRESSED_TILE_LEVELS; level++) bytes += bc4Size(HEIGHTMAP_TILE_SIZE >> level, HEIGHTMAP_TILE_SIZE >> level);
+    return bytes;
+}
+
+// Tile file : one record per tile at a fixed offset, the header last written so that a record cut by a crash is baked again
+constexpr uint32_t TILE_RECORD_MAGIC = 0x454c4954; // "TILE"
+constexpr size_t TILE_HEADER_BYTES = 16;
+
+// bytes of a full resolution layer (6 faces with their mips, and the same for the normal map and the max-height pyramid)
+size_t heightmapLayerBytes(size_t faceSize, bool compressed)
+{
+    size_t bytes = 0;
+    for(int level = 0; level < (compressed ? COMPRESSED_TILE_LEVELS : HEIGHTMAP_TILE_LEVELS); level++)
+        bytes += (compressed ? 6 * bc4Size(faceSize >> level, faceSize >> level) : 6 * (faceSize >> level) * (faceSize >> level));
+    for(int level = HEIGHTMAP_MAX_BASE_LEVEL; level < HEIGHTMAP_TILE_LEVELS; level++)
+        bytes += 6 * (faceSize >> level) * (faceSize >> level);
+    const size_t N = normalMapFaceSize(faceSize);
+    for(int level = 0; level < NORMAL_TILE_LEVELS; level++)
+        bytes += 4 * 6 * (N >> level) * (N >> level);
+    return bytes;
+}
+
+// distance from the camera to the surface of the planet at sea level, 0 inside
+float surfaceDistance(const vec3& camera, const PlanetSystem& planets, size_t planet)
+{
+    return std::max(0.f, (planets.pos[planet] - camera).length() - planets.radius[planet]);
+}
+
+PlanetHeightmaps::PlanetHeightmaps(ThreadPool& __pool, const PlanetSystem& planets, const TerrainStreamingParams& __params)
+    : pool(__pool), params(__params), snapshotPos(planets.pos), snapshotRadius(planets.radius)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+    const size_t P = params.placeholderFaceSize, PN = normalMapFaceSize(P);
+    states.resize(planets.size());
+    std::vector<unsigned char> placeholders(planets.size() * 6 * P * P), texels;
+    std::vector<signed char> placeholderNormals(planets.size() * 6 * PN * PN * 4), normals;
+    std::vector<std::vector<unsigned char>> placeholderMaxHeights(planets.size());
+    for(size_t i = 0; i < planets.size(); i++)
+    {
+        states[i].params = planetHeightmapParams(i);
+        bakeHeightmapFaces(pool, P, states[i].params, texels, normals, states[i].minValue, states[i].maxValue);
+        std::copy(texels.begin(), texels.end(), placeholders.begin() + i * texels.size());
+        std::copy(normals.begin(), normals.end(), placeholderNormals.begin() + i * normals.size());
+        maxHeightPyramid(texels, P, placeholderMaxHeights[i]);
+    }
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glGenTextures(1, &placeholderTexture);
+    glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, placeholderTexture);
+    glTexImage3D(GL_TEXTURE_CUBE_MAP_ARRAY, 0, GL_R8, P, P, 6 * planets.size(), 0, GL_RED, GL_UNSIGNED_BYTE, placeholders.data());
+    glGenerateMipmap(GL_TEXTURE_CUBE_MAP_ARRAY);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    glGenTextures(1, &placeholderNormalTexture);
+    glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, placeholderNormalTexture);
+    glTexImage3D(GL_TEXTURE_CUBE_MAP_ARRAY, 0, GL_RGBA8_SNORM, PN, PN, 6 * planets.size(), 0, GL_RGBA, GL_BYTE, placeholderNormals.data());
+    glGenerateMipmap(GL_TEXTURE_CUBE_MAP_ARRAY);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    // without max-reduced filtering a bilinear tap doesn't bound anything, main.frag then marches with fixed steps
+    maxReduction = glfwExtensionSupported("GL_ARB_texture_filter_minmax");
+    int placeholderMaxLevels = 0;
+    for(size_t s = P >> HEIGHTMAP_MAX_BASE_LEVEL; s > 0; s /= 2) placeholderMaxLevels++;
+    glGenTextures(1, &placeholderMaxTexture);
+    glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, placeholderMaxTexture);
+    glTexStorage3D(GL_TEXTURE_CUBE_MAP_ARRAY, placeholderMaxLevels, GL_R8, P >> HEIGHTMAP_MAX_BASE_LEVEL, P >> HEIGHTMAP_MAX_BASE_LEVEL, 6 * planets.size());
+    for(size_t i = 0; i < planets.size(); i++)
+    {
+        const unsigned char* maxHeights = placeholderMaxHeights[i].data();
+        for(int level = 0; level < placeholderMaxLevels; level++)
+        {
+            size_t s = P >> (HEIGHTMAP_MAX_BASE_LEVEL + level);
+            glTexSubImage3D(GL_TEXTURE_CUBE_MAP_ARRAY, level, 0, 0, 6 * i, s, s, 6, GL_RED, GL_UNSIGNED_BYTE, maxHeights);
+            maxHeights += 6 * s * s;
+        }
+    }
+    setMaxHeightFilter();
+
+    tilesPerFace = params.faceSize / HEIGHTMAP_TILE_SIZE;
+    nbLayers = static_cast<int>(std::min(planets.size(), params.residencyBudget / heightmapLayerBytes(params.faceSize, params.compressHeightmaps)));
+    layerPlanet.assign(nbLayers, -1);
+    tileFiles.assign(planets.size(), -1);
+    for(size_t face = 0; face < 6; face++)
+        for(size_t ti = 0; ti < tilesPerFace; ti++)
+            for(size_t tj = 0; tj < tilesPerFace; tj++)
+                tileDirections.push_back(cubeDirection(face, (ti + 0.5) * HEIGHTMAP_TILE_SIZE, (tj + 0.5) * HEIGHTMAP_TILE_SIZE, params.faceSize));
+
+    if(nbLayers > 0)
+    {
+        glGenTextures(1, &heightmapTexture);
+        glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, heightmapTexture);
+        if(params.compressHeightmaps)
+            glTexStorage3D(GL_TEXTURE_CUBE_MAP_ARRAY, COMPRESSED_TILE_LEVELS, GL_COMPRESSED_RED_RGTC1, params.faceSize, params.faceSize, 6 * nbLayers);
+        else
+            glTexStorage3D(GL_TEXTURE_CUBE_MAP_ARRAY, HEIGHTMAP_TILE_LEVELS, GL_R8, params.faceSize, params.faceSize, 6 * nbLayers);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+        const size_t N = normalMapFaceSize(params.faceSize);
+        glGenTextures(1, &normalTexture);
+        glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, normalTexture);
+        glTexStorage3D(GL_TEXTURE_CUBE_MAP_ARRAY, NORMAL_TILE_LEVELS, GL_RGBA8_SNORM, N, N, 6 * nbLayers);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+        glGenTextures(1, &maxHeightTexture);
+        glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, maxHeightTexture);
+        glTexStorage3D(GL_TEXTURE_CUBE_MAP_ARRAY, MAX_HEIGHT_TILE_LEVELS, GL_R8, params.faceSize >> HEIGHTMAP_MAX_BASE_LEVEL,
+                       params.faceSize >> HEIGHTMAP_MAX_BASE_LEVEL, 6 * nbLayers);
+        setMaxHeightFilter();
+
+        glGenTextures(1, &tileMaskTexture);
+        glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, tileMaskTexture);
+        glTexStorage3D(GL_TEXTURE_CUBE_MAP_ARRAY, 1, GL_R8, tilesPerFace, tilesPerFace, 6 * nbLayers);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    }
+    ring = std::make_unique<UploadRing>(params.uploadRingSize);
+    pages = std::make_unique<VirtualHeightmaps>(pool, params.faceSize, params.virtualFaceSize, params.pageBudget, nbLayers, planets.size(), params.cacheDir);
+
+    std::cout << "placeholder heightmaps baked in " << std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count()
+              << " ms, " << nbLayers << " full resolution layers of " << heightmapLayerBytes(params.faceSize, params.compressHeightmaps) / (1 << 20) << " MB"
+              << (params.compressHeightmaps ? " (BC4)" : "") << std::endl;
+}
+
+void PlanetHeightmaps::setMaxHeightFilter() const
+{
+    // a bilinear tap gives the max of the 2x2 texels around the direction, a level is never mixed with the next one
+    glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    if(maxReduction) glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_REDUCTION_MODE_ARB, GL_MAX);
+}
+
+PlanetHeightmaps::~PlanetHeightmaps()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    pending.clear();
+    idle.wait(lock, [this] { return inFlight == 0; });
+    lock.unlock();
+
+    for(int fd : tileFiles)
+        if(fd >= 0) close(fd);
+
+    glDeleteTextures(1, &placeholderTexture);
+    glDeleteTextures(1, &placeholderNormalTexture);
+    glDeleteTextures(1, &placeholderMaxTexture);
+    if(nbLayers > 0)
+    {
+        glDeleteTextures(1, &heightmapTexture);
+        glDeleteTextures(1, &normalTexture);
+        glDeleteTextures(1, &maxHeightTexture);
+        glDeleteTextures(1, &tileMaskTexture);
+    }
+}
+
+void PlanetHeightmaps::makeResident(size_t planet, int layer)
+{
+    PlanetState& state = states[planet];
+    state.layer = layer;
+    state.generation++;
+    state.tilesLeft = 6 * tilesPerFace * tilesPerFace;
+    state.residentSince = std::chrono::high_resolution_clock::now();
+    layerPlanet[layer] = planet;
+    layersChanged = true;
+    pages->attach(layer, planet, state.params, state.minValue, state.maxValue);
+
+    // none of its tiles are there yet
+    std::vector<unsigned char> zeros(6 * tilesPerFace * tilesPerFace, 0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, tileMaskTexture);
+    glTexSubImage3D(GL_TEXTURE_CUBE_MAP_ARRAY, 0, 0, 0, 6 * layer, tilesPerFace, tilesPerFace, 6, GL_RED, GL_UNSIGNED_BYTE, zeros.data());
+
+    // until a tile is uploaded main.frag samples the placeholder there, which the max-height pyramid of the layer doesn't know :
+    // it says the highest possible height so that the march never skips it
+    const size_t M = params.faceSize >> HEIGHTMAP_MAX_BASE_LEVEL;
+    std::vector<unsigned char> highest(6 * M * M, 255);
+    glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, maxHeightTexture);
+    for(int level = 0; level < MAX_HEIGHT_TILE_LEVELS; level++)
+        glTexSubImage3D(GL_TEXTURE_CUBE_MAP_ARRAY, level, 0, 0, 6 * layer, M >> level, M >> level, 6, GL_RED, GL_UNSIGNED_BYTE, highest.data());
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for(size_t face = 0; face < 6; face++)
+        for(size_t ti = 0; ti < tilesPerFace; ti++)
+            for(size_t tj = 0; tj < tilesPerFace; tj++)
+                pending.push_back(Tile{ planet, face, ti * HEIGHTMAP_TILE_SIZE, tj * HEIGHTMAP_TILE_SIZE, state.generation });
+}
+
+void PlanetHeightmaps::evict(size_t planet)
+{
+    PlanetState& state = states[planet];
+    pages->detach(state.layer);
+    layerPlanet[state.layer] = -1;
+    state.layer = -1;
+    layersChanged = true;
+    state.generation++;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    pending.erase(std::remove_if(pending.begin(), pending.end(), [planet](const Tile& t) { return t.planet == planet; }), pending.end());
+}
+
+void PlanetHeightmaps::update(const vec3& cameraPos, const PlanetSystem& planets)
+{
+    // the closest planets get the layers. A resident planet is only evicted for one at least 20% closer,
+    // so that the camera going back and forth between two planets doesn't bake them again and again
+    if(nbLayers > 0)
+    {
+        std::array<size_t, NB_PLANETS> order;
+        for(size_t i = 0; i < order.size(); i++) order[i] = i;
+        std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return surfaceDistance(cameraPos, planets, a) < surfaceDistance(cameraPos, planets, b); });
+
+        for(size_t k = 0; k < static_cast<size_t>(nbLayers); k++)
+        {
+            size_t planet = order[k];
+            if(states[planet].layer >= 0) continue;
+
+            auto freeLayer = std::find(layerPlanet.begin(), layerPlanet.end(), -1);
+            if(freeLayer != layerPlanet.end())
+            {
+                makeResident(planet, freeLayer - layerPlanet.begin());
+                continue;
+            }
+            // farthest resident planet
+            int layer = 0;
+            for(int l = 1; l < nbLayers; l++)
+                if(surfaceDistance(cameraPos, planets, layerPlanet[l]) > surfaceDistance(cameraPos, planets, layerPlanet[layer])) layer = l;
+            if(surfaceDistance(cameraPos, planets, planet) < 0.8f * surfaceDistance(cameraPos, planets, layerPlanet[layer]))
+            {
+                evict(layerPlanet[layer]);
+                makeResident(planet, layer);
+            }
+        }
+    }
+
+    std::vector<BakedTile> ready;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        snapshotPos = planets.pos;
+        snapshotRadius = planets.radius;
+        camera = cameraPos;
+
+        size_t n = std::min(baked.size(), static_cast<size_t>(params.maxUploadsPerFrame));
+        std::move(baked.begin(), baked.begin() + n, std::back_inserter(ready));
+        baked.erase(baked.begin(), baked.begin() + n);
+
+        // one job per worker at most, so that the tiles are picked as late as possible with the latest camera
+        for(; inFlight < pool.size() && inFlight < pending.size(); inFlight++)
+            pool.submit([this] { bakeNextTile(); });
+    }
+
+    for(size_t k = 0; k < ready.size(); k++)
+        if(!uploadTile(ready[k]))
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            std::move(ready.begin() + k, ready.end(), std::inserter(baked, baked.begin()));
+            break;
+        }
+    pages->update(params.maxPageUploadsPerFrame);
+}
+
+void PlanetHeightmaps::bakeNextTile()
+{
+    Tile tile;
+    float minValue, maxValue;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(pending.empty())
+        {
+            inFlight--;
+            idle.notify_all();
+            return;
+        }
+        // the tile whose center is the closest to the camera
+        auto priority = [this](const Tile& t) {
+            vec3 d = tileDirections[(t.face * tilesPerFace + t.i0 / HEIGHTMAP_TILE_SIZE) * tilesPerFace + t.j0 / HEIGHTMAP_TILE_SIZE];
+            return (snapshotPos[t.planet] + d * snapshotRadius[t.planet] - camera).length();
+        };
+        auto best = std::min_element(pending.begin(), pending.end(), [&](const Tile& a, const Tile& b) { return priority(a) < priority(b); });
+        tile = *best;
+        *best = pending.back();
+        pending.pop_back();
+        minValue = states[tile.planet].minValue;
+        maxValue = states[tile.planet].maxValue;
+    }
+
+    const size_t texelBytes = params.compressHeightmaps ? compressedTileBytes() : HEIGHTMAP_TILE_BYTES;
+    BakedTile result{ tile, std::vector<unsigned char>(texelBytes), std::vector<signed char>(NORMAL_TILE_BYTES),
+                      std::vector<unsigned char>(MAX_HEIGHT_TILE_BYTES) };
+    const uint32_t index = static_cast<uint32_t>((tile.face * tilesPerFace + tile.i0 / HEIGHTMAP_TILE_SIZE) * tilesPerFace + tile.j0 / HEIGHTMAP_TILE_SIZE);
+    const int fd = tileFile(tile.planet);
+    const off_t offset = static_cast<off_t>(index * tileRecordBytes());
+    const off_t normalsOffset = offset + TILE_HEADER_BYTES + texelBytes, maxOffset = normalsOffset + NORMAL_TILE_BYTES;
+
+    // a hole of the sparse file reads as zeros, which isn't a valid header
+    uint32_t header[4]{};
+    bool cached = fd >= 0 && pread(fd, header, TILE_HEADER_BYTES, offset) == static_cast<ssize_t>(TILE_HEADER_BYTES) && header[0] == TILE_RECORD_MAGIC
+               && header[1] == index && header[2] == HEIGHTMAP_BAKE_VERSION
+               && pread(fd, result.texels.data(), texelBytes, offset + TILE_HEADER_BYTES) == static_cast<ssize_t>(texelBytes)
+               && pread(fd, result.normals.data(), NORMAL_TILE_BYTES, normalsOffset) == static_cast<ssize_t>(NORMAL_TILE_BYTES)
+               && pread(fd, result.maxHeights.data(), MAX_HEIGHT_TILE_BYTES, maxOffset) == static_cast<ssize_t>(MAX_HEIGHT_TILE_BYTES);
+    if(!cached)
+    {
+        result.texels.resize(HEIGHTMAP_TILE_BYTES);
+        bakeHeightmapTile(params.faceSize, states[tile.planet].params, tile.face, tile.i0, tile.j0, minValue, maxValue, result.texels.data(), result.normals.data(),
+                          result.maxHeights.data());
+        if(params.compressHeightmaps)
+        {
+            std::vector<unsigned char> blocks(compressedTileBytes());
+            const unsigned char* texels = result.texels.data();
+            unsigned char* out = blocks.data();
+            int error = 0;
+            for(int level = 0; level < COMPRESSED_TILE_LEVELS; level++)
+            {
+                size_t s = HEIGHTMAP_TILE_SIZE >> level;
+                error = std::max(error, compressBC4(texels, s, s, s, out));
+                texels += s * s;
+                out += bc4Size(s, s);
+            }
+            result.texels = std::move(blocks);
+            // the decoded texels can be that much higher than the ones the pyramid was built from, and the GPU doesn't round them
+            for(auto& m : result.maxHeights) m = std::min(255, m + error + 1);
+        }
+        if(fd >= 0)
+        {
+            uint32_t written[4] = { TILE_RECORD_MAGIC, index, HEIGHTMAP_BAKE_VERSION, 0 };
+            if(pwrite(fd, result.texels.data(), texelBytes, offset + TILE_HEADER_BYTES) != static_cast<ssize_t>(texelBytes)
+               || pwrite(fd, result.normals.data(), NORMAL_TILE_BYTES, normalsOffset) != static_cast<ssize_t>(NORMAL_TILE_BYTES)
+               || pwrite(fd, result.maxHeights.data(), MAX_HEIGHT_TILE_BYTES, maxOffset) != static_cast<ssize_t>(MAX_HEIGHT_TILE_BYTES)
+               || pwrite(fd, written, TILE_HEADER_BYTES, offset) != static_cast<ssize_t>(TILE_HEADER_BYTES))
+                std::cerr << "can't write a tile to the tile file : " << strerror(errno) << std::endl;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    baked.push_back(std::move(result));
+    inFlight--;
+    idle.notify_all();
+}
+
+size_t PlanetHeightmaps::tileRecordBytes() const
+{
+    const size_t texelBytes = params.compressHeightmaps ? compressedTileBytes() : HEIGHTMAP_TILE_BYTES;
+    return (TILE_HEADER_BYTES + texelBytes + NORMAL_TILE_BYTES + MAX_HEIGHT_TILE_BYTES + 4095) / 4096 * 4096;
+}
+
+int PlanetHeightmaps::tileFile(size_t planet)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if(tileFiles[planet] < 0)
+    {
+        if(mkdir(params.cacheDir.c_str(), 0755) != 0 && errno != EEXIST) return -1;
+        // the tiles depend on the range of the placeholder and on their format too
+        const PlanetState& state = states[planet];
+        char name[64];
+        snprintf(name, sizeof(name), params.compressHeightmaps ? "/tiles-bc4-%016llx.bin" : "/tiles-%016llx.bin",
+                 static_cast<unsigned long long>(heightmapKey(params.faceSize, state.params, state.minValue, state.maxValue)));
+        tileFiles[planet] = open((params.cacheDir + name).c_str(), O_RDWR | O_CREAT, 0644);
+        if(tileFiles[planet] < 0) std::cerr << "can't open the tile file " << params.cacheDir + name << " : " << strerror(errno) << std::endl;
+    }
+    return tileFiles[planet];
+}
+
+bool PlanetHeightmaps::uploadTile(const BakedTile& b)
+{
+    PlanetState& state = states[b.tile.planet];
+    // the planet lost its layer since the tile was queued
+    if(b.tile.generation != state.generation) return true;
+
+    // the whole tile goes into the ring, the uploads below read it from there (pointers are offsets in the bound buffer)
+    size_t offset;
+    unsigned char* staging = ring->allocate(b.texels.size() + b.normals.size() + b.maxHeights.size(), offset);
+    if(!staging) return false;
+    memcpy(staging, b.texels.data(), b.texels.size());
+    memcpy(staging + b.texels.size(), b.normals.data(), b.normals.size());
+    memcpy(staging + b.texels.size() + b.normals.size(), b.maxHeights.data(), b.maxHeights.size());
+    ring->bind();
+    auto inRing = [offset](size_t k) { return reinterpret_cast<const unsigned char*>(offset + k); };
+
+    const int zoffset = 6 * state.layer + b.tile.face;
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, heightmapTexture);
+    const unsigned char* texels = inRing(0);
+    for(int level = 0; level < (params.compressHeightmaps ? COMPRESSED_TILE_LEVELS : HEIGHTMAP_TILE_LEVELS); level++)
+    {
+        size_t s = HEIGHTMAP_TILE_SIZE >> level;
+        if(params.compressHeightmaps)
+        {
+            glCompressedTexSubImage3D(GL_TEXTURE_CUBE_MAP_ARRAY, level, b.tile.j0 >> level, b.tile.i0 >> level, zoffset, s, s, 1, GL_COMPRESSED_RED_RGTC1,
+                                      bc4Size(s, s), texels);
+            texels += bc4Size(s, s);
+        }
+        else
+        {
+            glTexSubImage3D(GL_TEXTURE_CUBE_MAP_ARRAY, level, b.tile.j0 >> level, b.tile.i0 >> level, zoffset, s, s, 1, GL_RED, GL_UNSIGNED_BYTE, texels);
+            texels += s * s;
+        }
+    }
+
+    glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, normalTexture);
+    const signed char* normals = reinterpret_cast<const signed char*>(inRing(b.texels.size()));
+    for(int level = 0; level < NORMAL_TILE_LEVELS; level++)
+    {
+        size_t s = NORMAL_TILE_SIZE >> level;
+        glTexSubImage3D(GL_TEXTURE_CUBE_MAP_ARRAY, level, (b.tile.j0 / 2) >> level, (b.tile.i0 / 2) >> level, zoffset, s, s, 1, GL_RGBA, GL_BYTE, normals);
+        normals += 4 * s * s;
+    }
+
+    glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, maxHeightTexture);
+    const unsigned char* maxHeights = inRing(b.texels.size() + b.normals.size());
+    for(int level = 0; level < MAX_HEIGHT_TILE_LEVELS; level++)
+    {
+        const int shift = HEIGHTMAP_MAX_BASE_LEVEL + level;
+        size_t s = HEIGHTMAP_TILE_SIZE >> shift;
+        glTexSubImage3D(GL_TEXTURE_CUBE_MAP_ARRAY, level, b.tile.j0 >> shift, b.tile.i0 >> shift, zoffset, s, s, 1, GL_RED, GL_UNSIGNED_BYTE, maxHeights);
+        maxHeights += s * s;
+    }
+    ring->unbind();
+
+    const unsigned char one = 255;
+    glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, tileMaskTexture);
+    glTexSubImage3D(GL_TEXTURE_CUBE_MAP_ARRAY, 0, b.tile.j0 / HEIGHTMAP_TILE_SIZE, b.tile.i0 / HEIGHTMAP_TILE_SIZE, zoffset, 1, 1, 1, GL_RED, GL_UNSIGNED_BYTE, &one);
+
+    if(--state.tilesLeft == 0)
+        std::cout << "planet " << b.tile.planet << " : full resolution heightmap streamed in "
+                  << std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - state.residentSince).count() << " ms" << std::endl;
+    return true;
+}
+
+void PlanetHeightmaps::setUniforms(const MainUniforms& uniforms, int unit)
+{
+    glUniform1i(uniforms.heightmap, unit);
+    glUniform1i(uniforms.heightmapTiles, unit + 1);
+    glUniform1i(uniforms.placeholderHeightmap, unit + 2);
+    glUniform1i(uniforms.normalMap, unit + 3);
+    glUniform1i(uniforms.placeholderNormalMap, unit + 4);
+    glUniform1i(uniforms.maxHeight, unit + 5);
+    glUniform1i(uniforms.placeholderMaxHeight, unit + 6);
+    glUniform1i(uniforms.maxReduction, maxReduction);
+    glUniform1f(uniforms.heightmapFaceSize, params.faceSize);
+    glUniform1f(uniforms.placeholderFaceSize, params.placeholderFaceSize);
+    layersChanged = true;
+    pages->setUniforms(uniforms, unit + 7);
+}
+
+void PlanetHeightmaps::bind(const MainUniforms& uniforms, int unit, UploadStats& uploads)
+{
+    glActiveTexture(GL_TEXTURE0 + unit);
+    glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, heightmapTexture);
+    glActiveTexture(GL_TEXTURE0 + unit + 1);
+    glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, tileMaskTexture);
+    glActiveTexture(GL_TEXTURE0 + unit + 2);
+    glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, placeholderTexture);
+    glActiveTexture(GL_TEXTURE0 + unit + 3);
+    glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, normalTexture);
+    glActiveTexture(GL_TEXTURE0 + unit + 4);
+    glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, placeholderNormalTexture);
+    glActiveTexture(GL_TEXTURE0 + unit + 5);
+    glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, maxHeightTexture);
+    glActiveTexture(GL_TEXTURE0 + unit + 6);
+    glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, placeholderMaxTexture);
+
+    // the layers only change when a planet becomes resident or is evicted
+    if(layersChanged)
+    {
+        std::array<int, NB_PLANETS> layers;
+        for(size_t i = 0; i < layers.size(); i++) layers[i] = states[i].layer;
+        glUniform1iv(uniforms.heightmapLayer, layers.size(), layers.data());
+        uploads.add(1, sizeof(layers));
+        layersChanged = false;
+    }
+    pages->bind(uniforms, unit + 7, uploads);
+}
+
+void PlanetHeightmaps::endFrame()
+{
+    ring->endFrame();
+    pages->endFrame();
+}
+
+bool PlanetHeightmaps::fullDetail() const
+{
+    return std::all_of(layerPlanet.begin(), layerPlanet.end(), [this](int planet) { return planet >= 0 && states[planet].tilesLeft == 0; });
+}
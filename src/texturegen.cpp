@@ -1,5 +1,12 @@
 
 #include "../include/math.hpp"
+#include "../include/threadpool.hpp"
+#include "../include/noise.hpp"
+#include "../include/ktx.h"
+#include "../include/atmosphere.hpp"
+#include "../include/heightmap.hpp"
+#include "../include/bc4.hpp"
+#include "../include/pnm.h"
 
 #include <iostream>
 #include <fstream>
@@ -8,250 +15,886 @@
 #include <ctime>
 #include <vector>
 #include <string>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
 
-float atmosFalloff = 4.;
-float atmosRadius = 14.0;
-float planetRadius = 60.;
+#include <sys/resource.h>
 
-float nb_steps = 50.;
+// Bakes the optical depth table of one atmosphere (see atmosphere.hpp) as a single level R32F KTX file
+bool generateOpticalDepthTexture(ThreadPool& pool, const OpticalDepthParams& params, size_t resolution, const char* path, BakeTimings& timings)
+{
+    std::vector<float> od(resolution * resolution);
+
+    auto start = std::chrono::high_resolution_clock::now();
+    bakeOpticalDepthLUT(pool, params, resolution, od.data());
+    timings.compute = secondsSince(start);
+
+    std::cout << "max found : " << *std::max_element(od.begin(), od.end()) << " atmosphere radii" << std::endl;
+
+    start = std::chrono::high_resolution_clock::now();
+    KTXHeader header{};
+    memcpy(header.identifier, KTX_IDENTIFIER, KTX_IDENTIFIER_SIZE);
+    header.endianness = KTX_ENDIANNESS;
+    header.glType = 0x1406;               // GL_FLOAT
+    header.glTypeSize = 4;
+    header.glFormat = 0x1903;             // GL_RED
+    header.glInternalFormat = 0x822E;     // GL_R32F
+    header.glBaseInternalFormat = 0x1903; // GL_RED
+    header.pixelWidth = resolution;
+    header.pixelHeight = resolution;
+    header.numberOfFaces = 1;
+    header.numberOfMipmapLevels = 1;
+    uint32_t imageSize = od.size() * sizeof(float);
+
+    std::ofstream out(path, std::ios::binary);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(&imageSize), sizeof(imageSize));
+    out.write(reinterpret_cast<const char*>(od.data()), imageSize);
+    out.close();
+    timings.write = secondsSince(start);
+    if(!out)
+    {
+        std::cout << "Error while writing " << path << std::endl;
+        return false;
+    }
+    return true;
+}
 
-vec2 raySphere(vec3 rayPos, vec3 rayDir, vec3 sphPos, float radius)
+// ______________________________________ atmosphere benchmark ______________________________________
+// CPU copies of the in-scattering loop of atmosphere() in main.frag (planet at the origin, world units),
+// either with the old inner ray march for both optical depths or with the baked table
+
+// distance to the exit of a sphere centered at the origin, p being inside
+float sphereExit(const vec3& p, const vec3& dir, float radius)
 {
-    vec3 p = rayPos - sphPos;
-    float delta = 4. * (vec3::dot(p, rayDir) * vec3::dot(p, rayDir) - vec3::dot(rayDir, rayDir) * (vec3::dot(p, p) - radius * radius));
-    if(delta < 0.) return vec2(1e5, -1e5);
-    return vec2((-2. * vec3::dot(p, rayDir) - sqrt(delta)) / (2. * vec3::dot(rayDir, rayDir)), 
-                (-2. * vec3::dot(p, rayDir) + sqrt(delta)) / (2. * vec3::dot(rayDir, rayDir)));
+    float b = p.dot(dir), c = p.dot(p) - radius * radius;
+    return -b + sqrtf(std::max(0.f, b * b - c));
 }
 
-float densityAtPoint(float h)
+// old opticalDepth() of main.frag
+float marchOpticalDepth(const vec3& rayDir, const vec3& rayPos, float rayLength, float nbSteps, const OpticalDepthParams& params)
 {
-    return exp(-h * atmosFalloff) * (1. - h);
+    float dt = rayLength / nbSteps, depth = 0.;
+    for(float t = dt; t < rayLength; t += dt)
+        depth += dt * atmosphereDensity(((rayPos + rayDir * t).length() - params.planetRadius) / params.atmosRadius, params.falloff);
+    return depth;
 }
 
-float opticalDepth(float h, float cosTheta)
+struct AtmosphereRay
 {
-    vec3 start(0., planetRadius + h * atmosRadius, 0.);
-    vec3 rayDir(sqrtf(1. - cosTheta * cosTheta), cosTheta, 0.);
-    float rayLength = raySphere(start, rayDir, vec3(0., 0., 0.), planetRadius + atmosRadius).y;
+    vec3 start, dir;
+    float dist;
+};
 
-    float dt = rayLength / nb_steps;
-    vec3 p = start;
-    float opticalDepth = 0.;
-    for(float t = dt; t < rayLength; t += dt)
+// lut == nullptr : ray march with nbStepsJ steps
+vec3 inScattering(const AtmosphereRay& ray, const OpticalDepthParams& params, const vec3& color, const vec3& sun, float nbStepsI, float nbStepsJ, const float* lut)
+{
+    vec3 total;
+    if(ray.dist <= 0.) return total; // main.frag doesn't call atmosphere() for these rays
+    float idt = ray.dist / nbStepsI;
+    for(float t = idt; t <= ray.dist; t += idt)
     {
-        p = start + rayDir * t;
-        opticalDepth += dt * densityAtPoint(h);
+        vec3 p = ray.start + ray.dir * t;
+        vec3 up = p.normalize(), toLight = (sun - p).normalize();
+        float h = (p.length() - params.planetRadius) / params.atmosRadius;
+        float lightDepth, eyeDepth;
+        if(lut)
+        {
+            lightDepth = params.atmosRadius * sampleOpticalDepthLUT(lut, OPTICAL_DEPTH_LUT_SIZE, h, toLight.dot(up));
+            eyeDepth = params.atmosRadius * sampleOpticalDepthLUT(lut, OPTICAL_DEPTH_LUT_SIZE, h, -ray.dir.dot(up));
+        }
+        else
+        {
+            lightDepth = marchOpticalDepth(toLight, p, sphereExit(p, toLight, params.planetRadius + params.atmosRadius), nbStepsJ, params);
+            eyeDepth = marchOpticalDepth(ray.dir * -1.f, p, t, nbStepsJ, params);
+        }
+        total += vec3::exp(color * -(lightDepth + eyeDepth)) * color * (atmosphereDensity(h, params.falloff) * idt);
     }
-
-    return opticalDepth;
+    return total;
 }
 
+// same as atmosphere() in main.frag : the scattering of the whole ray minus what lies behind its end
+vec3 tableScattering(const AtmosphereRay& ray, const ScatteringParams& params, const vec3& sunPos, const float* opticalDepth, const vec3* scattering)
+{
+    if(ray.dist <= 0.) return vec3();
+    vec3 sun = (sunPos - ray.start).normalize();
+    vec3 end = ray.start + ray.dir * ray.dist;
+    vec3 total = sampleScatteringLUT(scattering, params, ray.start, ray.dir, sun);
+    if(end.length() < params.atmosphere.planetRadius + params.atmosphere.atmosRadius)
+    {
+        float h = (end.length() - params.atmosphere.planetRadius) / params.atmosphere.atmosRadius;
+        float toEye = params.atmosphere.atmosRadius * sampleOpticalDepthLUT(opticalDepth, OPTICAL_DEPTH_LUT_SIZE, h, -ray.dir.dot(end.normalize()));
+        total -= vec3::exp(params.beta * -toEye) * sampleScatteringLUT(scattering, params, end, ray.dir, sun);
+    }
+    return vec3(std::max(0.f, total.x), std::max(0.f, total.y), std::max(0.f, total.z));
+}
 
-// I tried to use this to bake the optical depth instead of having an inner loop in the atmosphere shader
-// but it didn't look great and also I only gained 0.002 ms of performance which is negligeable...
-// so I abandoned the idea of precomputing the atmosphere and am still doing it in real-time with riemann sum
-void generateOpticalDepthTexture()
+// Compares the O(NB_STEPS_i x NB_STEPS_j) ray march, the O(NB_STEPS_i) optical depth lookups and the constant cost scattering lookups
+// on random rays through the atmosphere of the first planet, against a ray march with many more steps.
+// Only the single scattered light is compared (not the fading of what's behind), the scattering table is baked without multiple scattering for this
+bool benchmarkAtmosphere(ThreadPool& pool)
 {
-    constexpr size_t RESOLUTION = 1024;
-    char img[RESOLUTION * RESOLUTION];
+    constexpr size_t NB_RAYS = 1 << 12;
+    constexpr float NB_STEPS_I = 9.01, NB_STEPS_J = 6.01, REFERENCE_STEPS = 128.;
+    // same as setupPlanets() and atmosphereParams() in main.cpp, with the default atmosScattering
+    ScatteringParams scatteringParams;
+    scatteringParams.atmosphere = OpticalDepthParams{ .planetRadius = 500.f + 0.463f * 64.f, .atmosRadius = 225., .falloff = 8.9 };
+    scatteringParams.beta = vec3(powf(400. / 748., 4) * 0.2, powf(400. / 602., 4) * 0.2, powf(400. / 427.9, 4) * 0.2);
+    const OpticalDepthParams& params = scatteringParams.atmosphere;
+    const vec3& color = scatteringParams.beta;
+    vec3 sun(0., 0., 20000.);
+    float outer = params.planetRadius + params.atmosRadius;
+
+    std::vector<AtmosphereRay> rays(NB_RAYS);
+    for(auto& ray : rays)
+    {
+        auto uniform = [] { return 2.f * rand() / (float)RAND_MAX - 1.f; };
+        vec3 origin = vec3(uniform(), uniform(), uniform()).normalize() * (3.f * outer);
+        vec3 target = vec3(uniform(), uniform(), uniform()) * outer;
+        ray.dir = (target - origin).normalize();
+        float b = origin.dot(ray.dir), delta = b * b - (origin.dot(origin) - outer * outer);
+        if(delta <= 0.) { ray.dist = 0.; continue; }
+        float tIn = -b - sqrtf(delta), tOut = -b + sqrtf(delta);
+        ray.start = origin + ray.dir * tIn;
+        // stop on the sea if the ray hits the planet
+        float deltaPlanet = b * b - (origin.dot(origin) - params.planetRadius * params.planetRadius);
+        ray.dist = (deltaPlanet > 0. ? -b - sqrtf(deltaPlanet) : tOut) - tIn;
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+    std::vector<float> lut(OPTICAL_DEPTH_LUT_SIZE * OPTICAL_DEPTH_LUT_SIZE);
+    bakeOpticalDepthLUT(pool, params, OPTICAL_DEPTH_LUT_SIZE, lut.data());
+    double bakeTime = secondsSince(start);
+
+    start = std::chrono::high_resolution_clock::now();
+    std::vector<vec3> multipleScattering(MULTIPLE_SCATTERING_SIZE * MULTIPLE_SCATTERING_SIZE);
+    bakeMultipleScatteringLUT(pool, scatteringParams, lut.data(), multipleScattering.data());
+    double multipleBakeTime = secondsSince(start);
+    start = std::chrono::high_resolution_clock::now();
+    std::vector<vec3> scattering(SCATTERING_LUT_TEXELS);
+    bakeScatteringLUT(pool, scatteringParams, lut.data(), nullptr, scattering.data());
+    double scatteringBakeTime = secondsSince(start);
+
+    std::vector<vec3> reference(NB_RAYS), marched(NB_RAYS), looked(NB_RAYS), tabled(NB_RAYS);
+    for(size_t k = 0; k < NB_RAYS; k++)
+        reference[k] = inScattering(rays[k], params, color, sun, REFERENCE_STEPS, REFERENCE_STEPS, nullptr);
+
+    start = std::chrono::high_resolution_clock::now();
+    for(size_t k = 0; k < NB_RAYS; k++)
+        marched[k] = inScattering(rays[k], params, color, sun, NB_STEPS_I, NB_STEPS_J, nullptr);
+    double marchTime = secondsSince(start);
+
+    start = std::chrono::high_resolution_clock::now();
+    for(size_t k = 0; k < NB_RAYS; k++)
+        looked[k] = inScattering(rays[k], params, color, sun, NB_STEPS_I, NB_STEPS_J, lut.data());
+    double lookupTime = secondsSince(start);
+
+    start = std::chrono::high_resolution_clock::now();
+    for(size_t k = 0; k < NB_RAYS; k++)
+        tabled[k] = tableScattering(rays[k], scatteringParams, sun, lut.data(), scattering.data());
+    double tableTime = secondsSince(start);
+
+    // error relative to the brightest ray, so that nearly black rays don't dominate
+    float maxLight = 0., marchError = 0., lookupError = 0., tableError = 0.;
+    for(size_t k = 0; k < NB_RAYS; k++)
+    {
+        maxLight = std::max(maxLight, reference[k].length());
+        marchError = std::max(marchError, (marched[k] - reference[k]).length());
+        lookupError = std::max(lookupError, (looked[k] - reference[k]).length());
+        tableError = std::max(tableError, (tabled[k] - reference[k]).length());
+    }
+
+    std::cout << "tables baked on " << pool.size() << " threads : optical depth " << 1e3 * bakeTime << " ms, multiple scattering " << 1e3 * multipleBakeTime
+              << " ms, scattering " << 1e3 * scatteringBakeTime << " ms" << std::endl;
+    std::cout << "ray march (" << NB_STEPS_I << " x " << NB_STEPS_J << " steps) : " << 1e9 * marchTime / NB_RAYS << " ns/ray, max error "
+              << 100. * marchError / maxLight << " %" << std::endl;
+    std::cout << "optical depth lookups (" << NB_STEPS_I << " steps) : " << 1e9 * lookupTime / NB_RAYS << " ns/ray, max error "
+              << 100. * lookupError / maxLight << " %, x" << marchTime / lookupTime << std::endl;
+    std::cout << "scattering lookups : " << 1e9 * tableTime / NB_RAYS << " ns/ray, max error "
+              << 100. * tableError / maxLight << " %, x" << marchTime / tableTime << std::endl;
+    return lookupError <= marchError && tableError <= marchError;
+}
 
-    float maxfound = 0.;
+// Checks the vectorized fbm kernels against the scalar fbm and times them octave by octave.
+// Returns false if a kernel is further than MAX_ULP from the scalar path
+bool benchmarkNoiseKernels()
+{
+    constexpr size_t N = 1 << 16;
+    constexpr int MAX_ULP = 4;
+    std::vector<float> x(N), y(N), z(N), ref(N), res(N);
+    for(size_t k = 0; k < N; k++)
+    {
+        // random directions, plus a few far away points to exercise the negative floors
+        vec3 d = vec3(rand() / (float)RAND_MAX - 0.5f, rand() / (float)RAND_MAX - 0.5f, rand() / (float)RAND_MAX - 0.5f).normalize();
+        if(k % 16 == 0) d *= 37.f;
+        x[k] = d.x; y[k] = d.y; z[k] = d.z;
+    }
 
-    for(int i = 0; i < RESOLUTION; i++)
+    const char* best = fbmBatchKernelName();
+    bool ok = true;
+    for(int octaves = 1; octaves <= 6; octaves++)
     {
-        for(int j = 0; j < RESOLUTION; j++)
+        double timings[3]{};
+        const char* kernels[3] = { "scalar", "sse2", "avx2" };
+        for(int k = 0; k < 3; k++)
         {
-            float h = static_cast<float>(j + 1) / static_cast<float>(RESOLUTION);
-            float cosTheta = 2.0 * static_cast<float>(i + 1) / static_cast<float>(RESOLUTION) - 1.;
-            float od = opticalDepth(h, cosTheta);
-            maxfound = std::max(maxfound, od);
-
-            img[i * RESOLUTION + j] = static_cast<char>(od * 255. / 134.);
+            if(!fbmBatchSelectKernel(kernels[k])) { timings[k] = -1.; continue; }
+            auto start = std::chrono::high_resolution_clock::now();
+            FBMParams params;
+            params.octaves = octaves;
+            fbmBatch(x.data(), y.data(), z.data(), k == 0 ? ref.data() : res.data(), N, params);
+            timings[k] = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+            if(k == 0) continue;
+
+            int64_t maxUlp = 0;
+            for(size_t i = 0; i < N; i++) maxUlp = std::max(maxUlp, ulpDistance(ref[i], res[i]));
+            if(maxUlp > MAX_ULP)
+            {
+                std::cout << kernels[k] << " is " << maxUlp << " ulp away from scalar with " << octaves << " octaves" << std::endl;
+                ok = false;
+            }
         }
+        std::cout << octaves << " octave(s) : scalar " << 1e9 * timings[0] / N << " ns/texel";
+        for(int k = 1; k < 3; k++)
+            if(timings[k] > 0.) std::cout << ", " << kernels[k] << " x" << timings[0] / timings[k];
+        std::cout << std::endl;
+    }
+    fbmBatchSelectKernel(best);
+    std::cout << (ok ? "vectorized kernels match the scalar fbm within " : "vectorized kernels DON'T match the scalar fbm within ") << MAX_ULP << " ulp" << std::endl;
+    return ok;
+}
+
+// face of d in a cube map, and the coordinates of its bilinear footprint in it (texel centers at integers), clamped at the edges of the face
+size_t cubeFootprint(vec3 d, size_t faceSize, float& x, float& y)
+{
+    // major axis then (sc, tc, ma) following the cube map face selection table of the GL spec
+    float ax = fabsf(d.x), ay = fabsf(d.y), az = fabsf(d.z), sc, tc, ma;
+    size_t face;
+    if(ax >= ay && ax >= az) { face = d.x > 0. ? 0 : 1; sc = d.x > 0. ? -d.z : d.z; tc = -d.y; ma = ax; }
+    else if(ay >= az)        { face = d.y > 0. ? 2 : 3; sc = d.x; tc = d.y > 0. ? d.z : -d.z; ma = ay; }
+    else                     { face = d.z > 0. ? 4 : 5; sc = d.z > 0. ? d.x : -d.x; tc = -d.y; ma = az; }
+    x = faceSize > 1 ? CLAMP((0.5f * (sc / ma + 1.f)) * faceSize - 0.5f, 0.f, faceSize - 1.001f) : 0.f;
+    y = faceSize > 1 ? CLAMP((0.5f * (tc / ma + 1.f)) * faceSize - 0.5f, 0.f, faceSize - 1.001f) : 0.f;
+    return face;
+}
+
+// bilinear fetch in a cube map whose faces are stacked like in bakeHeightmapFaces(), C channels of type T, clamped at the edges of the faces
+template <typename T, int C>
+void sampleCube(const T* texels, size_t faceSize, vec3 d, float* out)
+{
+    float x, y;
+    size_t face = cubeFootprint(d, faceSize, x, y);
+    size_t j = static_cast<size_t>(x), i = static_cast<size_t>(y);
+    float fx = x - j, fy = y - i;
+    const T* t00 = texels + C * ((face * faceSize + i) * faceSize + j);
+    if(faceSize == 1)
+    {
+        for(int c = 0; c < C; c++) out[c] = t00[c];
+        return;
+    }
+    const T* t10 = t00 + C * faceSize;
+    for(int c = 0; c < C; c++)
+        out[c] = (t00[c] * (1.f - fx) + t00[C + c] * fx) * (1.f - fy) + (t10[c] * (1.f - fx) + t10[C + c] * fx) * fy;
+}
+
+// Compares the normals of main.frag with the exact ones (analytic derivatives of the fbm, nothing quantized) on a planet like the ones of main.cpp :
+// - central differences of the heightmap, 4 bilinear samples 0.06 apart like shadePlanet() used to take
+// - one bilinear sample of the normal map
+bool benchmarkNormals(ThreadPool& pool)
+{
+    constexpr size_t FACE_SIZE = 2048, NB_NORMALS = 1 << 16;
+    constexpr float RADIUS = 650., AMPLITUDE = 65., EPS = 0.06;
+    FBMParams params;
+    params.setSeed(1);
+
+    auto start = std::chrono::high_resolution_clock::now();
+    std::vector<unsigned char> heights;
+    std::vector<signed char> normals;
+    float minValue, maxValue;
+    bakeHeightmapFaces(pool, FACE_SIZE, params, heights, normals, minValue, maxValue);
+    std::cout << "heightmap and normal map baked in " << secondsSince(start) << " s on " << pool.size() << " threads" << std::endl;
+
+    auto normalFromSlope = [&](const vec3& d, vec3 slope) {
+        slope -= d * slope.dot(d);
+        return (d - slope * (AMPLITUDE / RADIUS)).normalize();
+    };
+    auto angle = [](const vec3& a, const vec3& b) { return acosf(CLAMP(a.dot(b), -1.f, 1.f)) * 180.f / M_PIf; };
+
+    std::vector<vec3> directions(NB_NORMALS), exact(NB_NORMALS), differences(NB_NORMALS), baked(NB_NORMALS);
+    for(size_t k = 0; k < NB_NORMALS; k++)
+    {
+        vec3 d = vec3(rand() / (float)RAND_MAX - 0.5f, rand() / (float)RAND_MAX - 0.5f, rand() / (float)RAND_MAX - 0.5f).normalize();
+        vec3 g;
+        fbmd(d, g, params);
+        directions[k] = d;
+        exact[k] = normalFromSlope(d, g * (1.f / (maxValue - minValue)));
+    }
+
+    start = std::chrono::high_resolution_clock::now();
+    for(size_t k = 0; k < NB_NORMALS; k++)
+    {
+        const vec3& d = directions[k];
+        vec3 t1 = (fabsf(d.y) < 0.9f ? vec3(0., 1., 0.) : vec3(1., 0., 0.)).cross(d).normalize(), t2 = d.cross(t1);
+        const vec3 offsets[4] = { t1, t1 * -1.f, t2, t2 * -1.f };
+        float h[4];
+        for(int s = 0; s < 4; s++)
+            sampleCube<unsigned char, 1>(heights.data(), FACE_SIZE, d * RADIUS + offsets[s] * EPS, &h[s]);
+        // heights in [0, 1], per radian of the unit sphere
+        differences[k] = normalFromSlope(d, (t1 * (h[0] - h[1]) + t2 * (h[2] - h[3])) * (RADIUS / (2.f * EPS * 255.f)));
     }
+    double differencesTime = secondsSince(start);
 
-    std::cout << "max found : " << maxfound << std::endl;
+    start = std::chrono::high_resolution_clock::now();
+    for(size_t k = 0; k < NB_NORMALS; k++)
+    {
+        float n[4];
+        sampleCube<signed char, 4>(normals.data(), normalMapFaceSize(FACE_SIZE), directions[k], n);
+        baked[k] = normalFromSlope(directions[k], vec3(n[0], n[1], n[2]) * (HEIGHTMAP_SLOPE_SCALE / 127.f));
+    }
+    double bakedTime = secondsSince(start);
+
+    double differencesError = 0., bakedError = 0.;
+    float differencesMax = 0., bakedMax = 0.;
+    for(size_t k = 0; k < NB_NORMALS; k++)
+    {
+        differencesError += angle(differences[k], exact[k]);
+        differencesMax = std::max(differencesMax, angle(differences[k], exact[k]));
+        bakedError += angle(baked[k], exact[k]);
+        bakedMax = std::max(bakedMax, angle(baked[k], exact[k]));
+    }
 
-    std::ofstream out("output.pgm");
-    std::string sres = std::to_string(RESOLUTION);
-    out << "P5\n" << sres << " " << sres << "\n" << "255\n";
-    out.write(img, RESOLUTION * RESOLUTION);
+    std::cout << "central differences : 4 heightmap taps, " << 1e9 * differencesTime / NB_NORMALS << " ns/normal, error mean "
+              << differencesError / NB_NORMALS << " deg, max " << differencesMax << " deg" << std::endl;
+    std::cout << "normal map : 1 tap, " << 1e9 * bakedTime / NB_NORMALS << " ns/normal, error mean "
+              << bakedError / NB_NORMALS << " deg, max " << bakedMax << " deg" << std::endl;
+    return bakedError <= differencesError;
 }
 
-// found this on https://gist.github.com/patriciogonzalezvivo/670c22f3966e662d2f83
-float mod289(float x){return x - floor(x * (1.0 / 289.0)) * 289.0;}
-vec4 mod289(vec4 x){return x - vec4::floor(x * (1.0 / 289.0)) * 289.0;}
-vec4 perm(vec4 x){return mod289(((x * 34.0) + vec4(1.,1.,1.,1.)) * x);}
+// ______________________________________ terrain march benchmark ______________________________________
+
+// The heightmap of a resident planet as main.frag sees it : the mips of the full resolution heightmap and its max-height pyramid,
+// with the uniforms the marches depend on
+struct MarchedTerrain
+{
+    size_t faceSize;
+    std::vector<std::vector<unsigned char>> mips, maxLevels; // maxLevels[k] : level HEIGHTMAP_MAX_BASE_LEVEL + k
+    float radius, amplitude, pixelAngle;
+    mutable size_t steps = 0, taps = 0;
 
-float noise(vec3 p) {
-    vec3 a = vec3::floor(p);
-    vec3 d = p - a;
-    d = d * d * (vec3(3.,3.,3.) - d * 2.);
+    // textureLod of the heightmap, trilinear
+    float height(const vec3& d, float mip) const
+    {
+        taps++;
+        mip = std::min(mip, static_cast<float>(mips.size() - 1));
+        int l0 = static_cast<int>(mip), l1 = std::min(l0 + 1, static_cast<int>(mips.size() - 1));
+        float h0, h1;
+        sampleCube<unsigned char, 1>(mips[l0].data(), faceSize >> l0, d, &h0);
+        sampleCube<unsigned char, 1>(mips[l1].data(), faceSize >> l1, d, &h1);
+        return (h0 + (mip - l0) * (h1 - h0)) / 255.f;
+    }
 
-    vec4 b = vec4(a.x, a.x, a.y, a.y) + vec4(0.0, 1.0, 0.0, 1.0);
-    vec4 k1 = perm(vec4(b.x, b.y, b.x, b.y));
-    vec4 k2 = perm(vec4(k1.x, k1.y, k1.x, k1.y) + vec4(b.z, b.z, b.w, b.w));
+    // textureLod of the max-height pyramid, bilinear with GL_MAX reduction
+    float maxHeight(const vec3& d, int level) const
+    {
+        taps++;
+        const auto& texels = maxLevels[level - HEIGHTMAP_MAX_BASE_LEVEL];
+        const size_t s = faceSize >> level;
+        float x, y;
+        size_t face = cubeFootprint(d, s, x, y);
+        size_t j = static_cast<size_t>(x), i = static_cast<size_t>(y);
+        const unsigned char* t00 = texels.data() + (face * s + i) * s + j;
+        unsigned char m = s > 1 ? std::max(std::max(t00[0], t00[1]), std::max(t00[s], t00[s + 1])) : t00[0];
+        return m / 255.f;
+    }
 
-    vec4 c = k2 + vec4(a.z, a.z, a.z, a.z);
-    vec4 k3 = perm(c);
-    vec4 k4 = perm(c + vec4(1.,1.,1.,1.));
+    // same as terrainMip() and marchLevel() in main.frag
+    float mip(float dist) const { return std::max(0.f, log2f(dist * pixelAngle * faceSize / (radius * 1.5708f))); }
+    int marchLevel(float mip) const { return std::min(static_cast<int>(ceilf(mip)) + 1, HEIGHTMAP_TILE_LEVELS - 1); }
+};
 
-    vec4 o1 = vec4::fract(k3 * (1.0 / 41.0));
-    vec4 o2 = vec4::fract(k4 * (1.0 / 41.0));
+// rayCastMountains() of main.frag before the max-height pyramids : fixed steps of dt from the eye (at rayDist from rayPos) to maxt
+float marchFixed(const MarchedTerrain& terrain, const vec3& rayPos, const vec3& rayDir, float rayDist, float maxt, float dt)
+{
+    float lh = 0., ly = 0.;
+    for(float t = 0.001; t < maxt; t += dt)
+    {
+        terrain.steps++;
+        vec3 p = rayPos + rayDir * t;
+        float py = p.length() - terrain.radius;
+        float h = terrain.amplitude * terrain.height(p, terrain.mip(rayDist + t));
+        if(py < h) return t - dt + dt * (lh - ly) / (py - ly - h + lh);
+        lh = h;
+        ly = py;
+    }
+    return -1.;
+}
 
-    vec4 o3 = o2 * d.z + o1 * (1.0 - d.z);
-    vec2 o4 = vec2(o3.y, o3.w) * d.x + vec2(o3.x, o3.z) * (1.0 - d.x);
+// rayCastMountains() of main.frag, rayDir normalized
+float marchHierarchical(const MarchedTerrain& terrain, const vec3& rayPos, const vec3& rayDir, float rayDist, float maxt, float dt)
+{
+    const int topLevel = HEIGHTMAP_TILE_LEVELS - 1;
+    int level = topLevel, wait = 0, backoff = 1;
+    bool fine = false;
+    float lh = 0., ly = 0.;
+    for(float t = 0.001; t < maxt;)
+    {
+        terrain.steps++;
+        vec3 p = rayPos + rayDir * t;
+        float r = p.length();
+        vec3 d = p * (1.f / r);
+        float dist = rayDist + t, mip = terrain.mip(dist);
+        int m = terrain.marchLevel(mip);
+        int minLevel = std::max(HEIGHTMAP_MAX_BASE_LEVEL, static_cast<int>(floorf(log2f(3.f * (1 << m) + 3.f * dt * terrain.faceSize / r))) + 1);
+
+        if(level >= minLevel)
+        {
+            float uvRadius = (0.5f * (1 << level) - 1.5f * (1 << m)) * 2.f / terrain.faceSize;
+            float ma = std::max(std::max(fabsf(d.x), fabsf(d.y)), fabsf(d.z));
+            float faceDist2 = d.dot(d) / (ma * ma) - 1.f, faceSum = (fabsf(d.x) + fabsf(d.y) + fabsf(d.z)) / ma - 1.f;
+            float stretch = std::min(3.f, 1.f + faceDist2 + 2.f * uvRadius * faceSum + 2.f * uvRadius * uvRadius);
+            float bound = terrain.amplitude * (terrain.maxHeight(d, level) + 1.f / 255.f);
+            float clearance = std::min(std::min(r - terrain.radius - bound, r * sinf(uvRadius / stretch)), dist);
+            if(clearance > dt)
+            {
+                t += clearance;
+                level = std::min(level + 1, topLevel);
+                fine = false;
+                backoff = 1;
+            }
+            else if(level > minLevel) level--;
+            else
+            {
+                // near the surface : wait longer and longer before trying again
+                wait = backoff;
+                backoff = std::min(2 * backoff, 8);
+                level--;
+            }
+            continue;
+        }
 
-    return o4.y * d.y + o4.x * (1.0 - d.y);
+        float py = r - terrain.radius;
+        float h = terrain.amplitude * terrain.height(d, mip);
+        if(py < h)
+        {
+            if(!fine)
+            {
+                vec3 q = p - rayDir * dt;
+                ly = q.length() - terrain.radius;
+                lh = terrain.amplitude * terrain.height(q, mip);
+            }
+            return t - dt + dt * (lh - ly) / (py - ly - h + lh);
+        }
+        lh = h;
+        ly = py;
+        fine = true;
+        t += dt;
+        // the bound is above h, no skip can be longer than py - h
+        level = wait-- <= 0 && py - h > dt ? minLevel : minLevel - 1;
+    }
+    return -1.;
 }
 
-// float noise(vec3 p)
-// {
-//     return 0.;
-// }
-
-// sum of perlin noise for yellow noise (fractional brownian motion) : see https://iquilezles.org/articles/fbm/
-float fbm(vec3 x)
-{    
-    float G = 1.0 / 2.71828;
-    float f = 8.0;
-    float a = 1.0;
-    float t = 0.0;
-    int numOctaves = 6;
-    for( int i=0; i<numOctaves; i++ )
+// Marches rays from all over the place towards a planet like the ones of main.cpp with a full resolution heightmap, both ways :
+// - fixed steps, like rayCastMountains() used to (up to 700 of them)
+// - skipping the empty space with the max-height pyramid
+// and compares them with a march of steps 16 times smaller, which is as close to exact as it gets
+bool benchmarkMarch(ThreadPool& pool)
+{
+    constexpr size_t FACE_SIZE = 2048, NB_RAYS = 1 << 14;
+    constexpr float RADIUS = 650., AMPLITUDE = 65.;
+    FBMParams params;
+    params.setSeed(1);
+
+    auto start = std::chrono::high_resolution_clock::now();
+    MarchedTerrain terrain{ FACE_SIZE, {}, {}, RADIUS, AMPLITUDE, tanf(0.5f * 60.f * M_PIf / 180.f) / 384.f };
+    std::vector<unsigned char> texels, pyramid;
+    std::vector<signed char> normals;
+    float minValue, maxValue;
+    bakeHeightmapFaces(pool, FACE_SIZE, params, texels, normals, minValue, maxValue);
+    terrain.mips.push_back(texels);
+    for(int level = 1; level < HEIGHTMAP_TILE_LEVELS; level++)
+    {
+        const auto& src = terrain.mips.back();
+        const size_t s = FACE_SIZE >> level;
+        std::vector<unsigned char> dst(6 * s * s);
+        for(size_t i = 0; i < 6 * s; i++)
+            for(size_t j = 0; j < s; j++)
+            {
+                const unsigned char* t = src.data() + 2 * i * 2 * s + 2 * j;
+                dst[i * s + j] = (t[0] + t[1] + t[2 * s] + t[2 * s + 1] + 2) >> 2;
+            }
+        terrain.mips.push_back(std::move(dst));
+    }
+    maxHeightPyramid(texels, FACE_SIZE, pyramid);
+    for(size_t s = FACE_SIZE >> HEIGHTMAP_MAX_BASE_LEVEL, offset = 0; s > 0; offset += 6 * s * s, s /= 2)
+        terrain.maxLevels.emplace_back(pyramid.begin() + offset, pyramid.begin() + offset + 6 * s * s);
+    std::cout << "heightmap, mips and max-height pyramid baked in " << secondsSince(start) << " s on " << pool.size() << " threads" << std::endl;
+
+    struct Ray { vec3 pos, dir; float rayDist, maxt, dt; };
+    std::vector<Ray> rays;
+    auto random = [] { return rand() / (float)RAND_MAX; };
+    while(rays.size() < NB_RAYS)
     {
-        t += noise(x * f) * a;
-        f *= 2.0;
-        a *= G;
+        // eyes from the ground to far away, looking at the planet (often grazing it)
+        vec3 eye = vec3(random() - 0.5f, random() - 0.5f, random() - 0.5f).normalize() * (RADIUS + AMPLITUDE + powf(random(), 3.f) * 8000.f);
+        vec3 target = vec3(random() - 0.5f, random() - 0.5f, random() - 0.5f).normalize() * (RADIUS + AMPLITUDE * random());
+        vec3 dir = (target - eye).normalize();
+        // the segment of the ray in the sphere of the highest peaks and dt, like in main.frag
+        float b = eye.dot(dir), c = eye.dot(eye) - (RADIUS + AMPLITUDE) * (RADIUS + AMPLITUDE), delta = b * b - c;
+        if(delta <= 0.) continue;
+        float tstart = std::max(0.f, -b - sqrtf(delta)), tend = -b + sqrtf(delta);
+        if(tend <= tstart) continue;
+        float lod = 100. + 600. * (1. - CLAMP((eye.length() - 10000.f) / 20000.f, 0.f, 1.f));
+        rays.push_back(Ray{ eye + dir * tstart, dir, tstart, tend - tstart, std::max(0.025f, (tend - tstart) / lod) });
     }
-    return t;
+
+    struct Result { double time = 0.; size_t steps = 0, taps = 0, hits = 0, missed = 0, extra = 0, throughTaps = 0, through = 0; float maxError = 0.; };
+    std::vector<float> reference(NB_RAYS);
+    for(size_t k = 0; k < NB_RAYS; k++)
+        reference[k] = marchFixed(terrain, rays[k].pos, rays[k].dir, rays[k].rayDist, rays[k].maxt, rays[k].dt / 16.f);
+
+    auto run = [&](const char* name, auto march) {
+        Result result;
+        terrain.steps = terrain.taps = 0;
+        auto start = std::chrono::high_resolution_clock::now();
+        std::vector<float> hits(NB_RAYS);
+        std::vector<size_t> taps(NB_RAYS);
+        for(size_t k = 0; k < NB_RAYS; k++)
+        {
+            taps[k] = terrain.taps;
+            hits[k] = march(terrain, rays[k].pos, rays[k].dir, rays[k].rayDist, rays[k].maxt, rays[k].dt);
+            taps[k] = terrain.taps - taps[k];
+        }
+        result.time = secondsSince(start);
+        result.steps = terrain.steps;
+        result.taps = terrain.taps;
+        for(size_t k = 0; k < NB_RAYS; k++)
+        {
+            if(hits[k] >= 0.) result.hits++;
+            // the rays which go through the mountains without hitting them : the worst case of the fixed steps
+            if(reference[k] < 0.)
+            {
+                result.through++;
+                result.throughTaps += taps[k];
+            }
+            if(reference[k] >= 0. && hits[k] < 0.) result.missed++;
+            else if(reference[k] < 0. && hits[k] >= 0.) result.extra++;
+            else if(hits[k] >= 0.) result.maxError = std::max(result.maxError, fabsf(hits[k] - reference[k]) / rays[k].dt);
+        }
+        std::cout << name << " : " << static_cast<double>(terrain.steps) / NB_RAYS << " steps/ray, " << static_cast<double>(terrain.taps) / NB_RAYS
+                  << " taps/ray (" << static_cast<double>(result.throughTaps) / std::max<size_t>(result.through, 1) << " on the " << result.through
+                  << " rays which miss), " << 1e6 * result.time / NB_RAYS << " us/ray, " << result.hits << " hits, " << result.missed << " missed and "
+                  << result.extra << " extra against the reference, hit distance off by " << result.maxError << " dt at most" << std::endl;
+        return result;
+    };
+    Result fixed = run("fixed steps", marchFixed);
+    Result hierarchical = run("max-height pyramid", marchHierarchical);
+    return hierarchical.missed <= fixed.missed && hierarchical.steps < fixed.steps;
 }
 
-void generateSphericalFBMnoise()
+// Compresses a heightmap to BC4 with both encoders, decodes it back on the CPU and compares it with the original :
+// level 0 of the 6 faces and every mip, like compressHeightmapBC4() does
+bool benchmarkBC4(ThreadPool& pool)
 {
-    constexpr size_t RESOLUTION = 4096 * 4;
-    char* img = new char[RESOLUTION * RESOLUTION];
+    constexpr size_t FACE_SIZE = 1024;
+    FBMParams params;
+    params.setSeed(1);
+
+    auto start = std::chrono::high_resolution_clock::now();
+    std::vector<unsigned char> texels;
+    std::vector<signed char> normals;
+    float minValue, maxValue;
+    bakeHeightmapFaces(pool, FACE_SIZE, params, texels, normals, minValue, maxValue);
+    // the mips, each level with its 6 faces
+    std::vector<std::vector<unsigned char>> levels{ texels };
+    for(size_t s = FACE_SIZE / 2; s > 0; s /= 2)
+    {
+        const auto& src = levels.back();
+        std::vector<unsigned char> dst(6 * s * s);
+        for(size_t i = 0; i < 6 * s; i++)
+            for(size_t j = 0; j < s; j++)
+            {
+                const unsigned char* t = src.data() + 2 * i * 2 * s + 2 * j;
+                dst[i * s + j] = (t[0] + t[1] + t[2 * s] + t[2 * s + 1] + 2) >> 2;
+            }
+        levels.push_back(std::move(dst));
+    }
+    std::cout << "heightmap and mips baked in " << secondsSince(start) << " s on " << pool.size() << " threads" << std::endl;
 
-    float maxfound = 0.;
-    float minfound = INFINITY;
+    struct Result { double time = 0., rmse = 0.; int maxError = 0; size_t bytes = 0, texels = 0; };
+    auto run = [&](const char* name, bool highQuality) {
+        Result result;
+        double squares = 0.;
+        for(size_t level = 0; level < levels.size(); level++)
+        {
+            const size_t s = std::max<size_t>(1, FACE_SIZE >> level);
+            std::vector<unsigned char> blocks(6 * bc4Size(s, s)), decoded(s * s);
+            auto start = std::chrono::high_resolution_clock::now();
+            for(size_t face = 0; face < 6; face++)
+                result.maxError = std::max(result.maxError, compressBC4(pool, levels[level].data() + face * s * s, s, s, s, blocks.data() + face * bc4Size(s, s), highQuality));
+            result.time += secondsSince(start);
+            for(size_t face = 0; face < 6; face++)
+            {
+                decompressBC4(blocks.data() + face * bc4Size(s, s), s, s, decoded.data());
+                for(size_t k = 0; k < s * s; k++)
+                {
+                    double d = static_cast<double>(decoded[k]) - levels[level][face * s * s + k];
+                    squares += d * d;
+                }
+            }
+            result.bytes += blocks.size();
+            result.texels += 6 * s * s;
+        }
+        result.rmse = sqrt(squares / result.texels);
+        std::cout << name << " : " << result.time << " s (" << result.texels / result.time / 1e6 << " Mtexels/s), " << result.bytes / 1024 << " KB instead of "
+                  << result.texels / 1024 << " KB, error " << result.rmse << " rms, " << result.maxError << " at most (in 1/255)" << std::endl;
+        return result;
+    };
+    Result fast = run("BC4 fast", false);
+    Result high = run("BC4 high quality", true);
+    return high.rmse <= fast.rmse && high.maxError <= fast.maxError;
+}
 
-    for(int i = 0; i < RESOLUTION; i++)
+// Loads a big PGM (warm in the page cache) both ways and reads every pixel like the texture upload does :
+// - like read_ppm() used to, into a copy filled with fread
+// - with pnm_map(), the pixels are read in the mapped file
+bool benchmarkPNM()
+{
+    constexpr int SIZE = 8192, NB_RUNS = 5;
+    const char* path = "pnm-bench.pgm";
     {
-        for(int j = 0; j < RESOLUTION; j++)
+        std::ofstream out(path, std::ios::binary);
+        out << "P5\n# heightmap\n" << SIZE << " " << SIZE << "\n# 8 bits\n255\n";
+        std::vector<unsigned char> row(SIZE);
+        for(int i = 0; i < SIZE; i++)
         {
-            vec2 uv(static_cast<float>(j) / static_cast<float>(RESOLUTION), static_cast<float>(i) / static_cast<float>(RESOLUTION));
-            vec3 d(cosf(M_PI * (0.5 - uv.y)) * cosf(2. * M_PI * (uv.x - 0.5)), sinf(M_PI * (0.5 - uv.y)), cosf(M_PI * (0.5 - uv.y)) * sinf(2. * M_PI * (uv.x - 0.5)));
-            d.normalized();
-            float x = fbm(d);
-            minfound = std::min(minfound, x);
-            maxfound = std::max(maxfound, x);
-
-            img[i * RESOLUTION + j] = static_cast<char>(CLAMP((x - minfound) / (maxfound - minfound), 0.f, 1.f) * 255.);
+            for(int j = 0; j < SIZE; j++) row[j] = (i ^ j) & 0xFF;
+            out.write(reinterpret_cast<const char*>(row.data()), SIZE);
         }
-        std::cout << i << std::endl;
+        if(!out)
+        {
+            std::cout << "Can't write " << path << std::endl;
+            return false;
+        }
+    }
+
+    auto checksum = [](const unsigned char* pixels, size_t size) {
+        uint64_t sum = 0;
+        for(size_t k = 0; k < size; k++) sum += pixels[k];
+        return sum;
+    };
+    const size_t size = static_cast<size_t>(SIZE) * SIZE;
+    uint64_t copied = 0, mapped = 0;
+    double copyTime = 0., mapTime = 0.;
+    for(int run = 0; run < NB_RUNS; run++)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        FILE* file = fopen(path, "rb");
+        if(!file) return false;
+        fseek(file, 0, SEEK_END);
+        std::vector<unsigned char> data(ftell(file));
+        fseek(file, 0, SEEK_SET);
+        bool ok = fread(data.data(), 1, data.size(), file) == data.size();
+        fclose(file);
+        int width, height, channels;
+        size_t offset = ok ? pnm_parse_header(data.data(), data.size(), &width, &height, &channels) : 0;
+        if(offset == 0) return false;
+        copied = checksum(data.data() + offset, static_cast<size_t>(width) * height * channels);
+        copyTime += secondsSince(start);
+
+        start = std::chrono::high_resolution_clock::now();
+        PNMImage image;
+        if(!pnm_map(path, &image)) return false;
+        mapped = checksum(image.pixels, static_cast<size_t>(image.width) * image.height * image.channels);
+        pnm_unmap(&image);
+        mapTime += secondsSince(start);
     }
+    remove(path);
 
-    std::cout << "min : " << minfound << ", max : " << maxfound << std::endl;
+    std::cout << SIZE << "x" << SIZE << " PGM (" << size / (1 << 20) << " MB) : fread into a copy " << 1e3 * copyTime / NB_RUNS << " ms, mapped "
+              << 1e3 * mapTime / NB_RUNS << " ms (" << copyTime / mapTime << "x), " << size / (1 << 20) << " MB less memory" << std::endl;
+    return copied == mapped;
+}
 
-    std::ofstream out("output.pgm");
-    std::string sres = std::to_string(RESOLUTION);
-    out << "P5\n" << sres << " " << sres << "\n" << "255\n";
-    out.write(img, RESOLUTION * RESOLUTION);
-    delete[] img;
+void printUsage()
+{
+    std::cout << "usage : solar_texturegen [options]\n"
+                 "  --bake fbm|opticaldepth   what to bake (default fbm)\n"
+                 "  --resolution N            size of a cube face for fbm (default 4096), of the table for opticaldepth (default " << OPTICAL_DEPTH_LUT_SIZE << ")\n"
+                 "  --octaves N               fbm octaves (default 6, at most " << FBM_MAX_OCTAVES << ")\n"
+                 "  --frequency F             frequency of the first octave (default 8)\n"
+                 "  --gain G                  amplitude ratio between octaves (default 1/e)\n"
+                 "  --seed S                  0 gives the historical terrain (default 0)\n"
+                 "  --planet-radius R         opticaldepth : radius of the planet at sea level (default 60)\n"
+                 "  --atmos-radius R          opticaldepth : thickness of the atmosphere (default 14)\n"
+                 "  --falloff F               opticaldepth : density falloff (default 4)\n"
+                 "  --threads N               worker threads, 0 for one per core (default 0)\n"
+                 "  --output PATH             output file (default output.ktx), fbm also writes its normal map and max-height pyramid\n"
+                 "                            next to it (output-normals.ktx, output-max.ktx)\n"
+                 "  --cache DIR               fbm : bake into the cache directory of the renderer instead (see heightmap.hpp),\n"
+                 "                            nothing is baked if the same parameters are already there\n"
+                 "  --compress bc4|bc4-hq     fbm : also write the heightmap as BC4 next to it (output-bc4.ktx), bc4-hq searches better endpoints\n"
+                 "  --bench-noise             check and time the vectorized fbm kernels, then exit\n"
+                 "  --bench-atmosphere        compare the atmosphere ray march with the precomputed tables, then exit\n"
+                 "  --bench-normals           compare the terrain normals from central differences with the normal map, then exit\n"
+                 "  --bench-march             compare the terrain march with fixed steps and with the max-height pyramid, then exit\n"
+                 "  --bench-bc4               time both BC4 encoders on a heightmap and measure their error, then exit\n"
+                 "  --bench-pnm               compare loading a big PGM with fread and with pnm_map(), then exit\n";
 }
 
-// returns 3D value noise and its 3 derivatives
-// vec4 noised(vec3 x)
-// {
-//     vec3 p = vec3::floor(x);
-//     vec3 w = vec3::fract(x);
-
-//     vec3 u = w*w*w*(w*(w*6.0-15.0)+10.0);
-//     vec3 du = 30.0*w*w*(w*(w-1.0)+2.0);
-
-//     float a = myRandomMagic( p+vec3(0,0,0) );
-//     float b = myRandomMagic( p+vec3(1,0,0) );
-//     float c = myRandomMagic( p+vec3(0,1,0) );
-//     float d = myRandomMagic( p+vec3(1,1,0) );
-//     float e = myRandomMagic( p+vec3(0,0,1) );
-//     float f = myRandomMagic( p+vec3(1,0,1) );
-//     float g = myRandomMagic( p+vec3(0,1,1) );
-//     float h = myRandomMagic( p+vec3(1,1,1) );
-
-//     float k0 =   a;
-//     float k1 =   b - a;
-//     float k2 =   c - a;
-//     float k3 =   e - a;
-//     float k4 =   a - b - c + d;
-//     float k5 =   a - c - e + g;
-//     float k6 =   a - b - e + f;
-//     float k7 = - a + b + c - d + e - f - g + h;
-
-//     return vec4( -1.0+2.0*(k0 + k1*u.x + k2*u.y + k3*u.z + k4*u.x*u.y + k5*u.y*u.z + k6*u.z*u.x + k7*u.x*u.y*u.z),
-//                  2.0*du *vec3( k1 + k4*u.y + k6*u.z + k7*u.y*u.z,
-//                                k2 + k5*u.z + k4*u.x + k7*u.z*u.x,
-//                                k3 + k6*u.x + k5*u.y + k7*u.x*u.y ) );
-// }
-
-// // returns 3D fbm and its 3 derivatives
-// vec4 fbmNormal(vec3 x)
-// {
-//     float f = 1.98;  // could be 2.0
-//     float s = 0.49;  // could be 0.5
-//     float a = 0.0;
-//     float b = 0.5;
-//     int numOctaves = 6;
-//     vec3  d = vec3(0.0,0.0,0.0);
-//     mat3  m = mat3(1.0,0.0,0.0,
-//                    0.0,1.0,0.0,
-//                    0.0,0.0,1.0);
-//     for( int i=0; i<numOctaves; i++ )
-//     {
-//         vec4 n = noised(x);
-//         a += b*n.x;          // accumulate values
-//         d += b*m*n.yzw;      // accumulate derivatives
-//         b *= s;
-//         x = f*m3*x;
-//         m = f*m3i*m;
-//     }
-//     return vec4(a, d.x, d.y, d.z);
-// }
-
-// void generateSphericalFBMnormalMap()
-// {
-//     constexpr size_t RESOLUTION = 4096;
-//     char* img = new char[RESOLUTION * RESOLUTION];
-
-//     float maxfound = 0.;
-//     float minfound = INFINITY;
-
-//     for(int i = 0; i < RESOLUTION; i++)
-//     {
-//         for(int j = 0; j < RESOLUTION; j++)
-//         {
-//             vec2 uv(static_cast<float>(j) / static_cast<float>(RESOLUTION), static_cast<float>(i) / static_cast<float>(RESOLUTION));
-//             vec3 d(cosf(M_PI * (0.5 - uv.y)) * cosf(2. * M_PI * (uv.x - 0.5)), sinf(M_PI * (0.5 - uv.y)), cosf(M_PI * (0.5 - uv.y)) * sinf(2. * M_PI * (uv.x - 0.5)));
-//             d.normalized();
-//             vec3 n = fbmNormal(d);
-
-//             img[3 * (i * RESOLUTION + j)] = static_cast<char>(0.5 * (n.x + 1.) * 255.f);
-//             img[3 * (i * RESOLUTION + j + 1)] = static_cast<char>(0.5 * (n.y + 1.) * 255.f);
-//             img[3 * (i * RESOLUTION + j + 2)] = static_cast<char>(0.5 * (n.z + 1.) * 255.f);
-//         }
-//         std::cout << i << std::endl;
-//     }
-
-//     std::ofstream out("output.ppm");
-//     std::string sres = std::to_string(RESOLUTION);
-//     out << "P6\n" << sres << " " << sres << "\n" << "255\n";
-//     out.write(img, RESOLUTION * RESOLUTION);
-//     delete[] img;
-// }
-
-int main()
+int main(int argc, char** argv)
 {
     srand(time(NULL));
-    generateSphericalFBMnoise();
-    return 0;
-}
\ No newline at end of file
+
+    std::string bake = "fbm", output = "output.ktx", cacheDir, compress;
+    size_t resolution = 0;
+    unsigned int threads = 0, seed = 0;
+    FBMParams params;
+    OpticalDepthParams atmosParams;
+    bool benchAtmosphere = false, benchNormals = false, benchMarch = false, benchBC4 = false;
+
+    for(int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if(arg == "--bench-noise")
+            return benchmarkNoiseKernels() ? 0 : 1;
+        if(arg == "--bench-pnm")
+            return benchmarkPNM() ? 0 : 1;
+        if(arg == "--bench-atmosphere")
+        {
+            benchAtmosphere = true;
+            continue;
+        }
+        if(arg == "--bench-normals")
+        {
+            benchNormals = true;
+            continue;
+        }
+        if(arg == "--bench-march")
+        {
+            benchMarch = true;
+            continue;
+        }
+        if(arg == "--bench-bc4")
+        {
+            benchBC4 = true;
+            continue;
+        }
+        if(arg == "--help" || arg == "-h")
+        {
+            printUsage();
+            return 0;
+        }
+        if(i + 1 >= argc)
+        {
+            std::cout << "Missing value after " << arg << std::endl;
+            printUsage();
+            return 1;
+        }
+        const char* value = argv[++i];
+        if(arg == "--bake") bake = value;
+        else if(arg == "--resolution") resolution = strtoull(value, nullptr, 10);
+        else if(arg == "--octaves") params.octaves = atoi(value);
+        else if(arg == "--frequency") params.frequency = atof(value);
+        else if(arg == "--gain") params.gain = atof(value);
+        else if(arg == "--seed") seed = strtoul(value, nullptr, 10);
+        else if(arg == "--planet-radius") atmosParams.planetRadius = atof(value);
+        else if(arg == "--atmos-radius") atmosParams.atmosRadius = atof(value);
+        else if(arg == "--falloff") atmosParams.falloff = atof(value);
+        else if(arg == "--threads") threads = strtoul(value, nullptr, 10);
+        else if(arg == "--output") output = value;
+        else if(arg == "--cache") cacheDir = value;
+        else if(arg == "--compress") compress = value;
+        else
+        {
+            std::cout << "Unknown option " << arg << std::endl;
+            printUsage();
+            return 1;
+        }
+    }
+    params.setSeed(seed);
+
+    if(params.octaves < 1 || params.octaves > FBM_MAX_OCTAVES || params.frequency <= 0.f || params.gain <= 0.f)
+    {
+        std::cout << "Invalid fbm parameters" << std::endl;
+        return 1;
+    }
+
+    if(atmosParams.planetRadius <= 0.f || atmosParams.atmosRadius <= 0.f)
+    {
+        std::cout << "Invalid atmosphere parameters" << std::endl;
+        return 1;
+    }
+
+    if(!compress.empty() && compress != "bc4" && compress != "bc4-hq")
+    {
+        std::cout << "Unknown compression " << compress << std::endl;
+        printUsage();
+        return 1;
+    }
+
+    ThreadPool pool(threads);
+    if(benchAtmosphere)
+        return benchmarkAtmosphere(pool) ? 0 : 1;
+    if(benchNormals)
+        return benchmarkNormals(pool) ? 0 : 1;
+    if(benchMarch)
+        return benchmarkMarch(pool) ? 0 : 1;
+    if(benchBC4)
+        return benchmarkBC4(pool) ? 0 : 1;
+
+    BakeTimings timings;
+    bool ok = false;
+    auto start = std::chrono::high_resolution_clock::now();
+    if(bake == "fbm")
+    {
+        if(resolution == 0) resolution = 4096;
+        std::cout << "baking a " << resolution << "x" << resolution << " cube map fbm heightmap (" << params.octaves << " octaves, frequency " << params.frequency
+                  << ", gain " << params.gain << ", seed " << seed << ") on " << pool.size() << " threads with the " << fbmBatchKernelName() << " kernel" << std::endl;
+        if(cacheDir.empty())
+        {
+            std::string stem = output.size() > 4 && output.compare(output.size() - 4, 4, ".ktx") == 0 ? output.substr(0, output.size() - 4) : output;
+            ok = generateSphericalFBMnoise(pool, resolution, params, output.c_str(), timings, (stem + "-normals.ktx").c_str(), (stem + "-max.ktx").c_str());
+            if(ok && !compress.empty())
+            {
+                auto compressStart = std::chrono::high_resolution_clock::now();
+                int maxError = compressHeightmapBC4(pool, output.c_str(), (stem + "-bc4.ktx").c_str(), compress == "bc4-hq");
+                ok = maxError >= 0;
+                timings.compress = secondsSince(compressStart);
+                if(ok) std::cout << "BC4 written to " << stem << "-bc4.ktx, texels off by " << maxError << "/255 at most" << std::endl;
+            }
+        }
+        else
+        {
+            std::string path = bakeHeightmapCached(pool, cacheDir, resolution, params, &timings);
+            ok = !path.empty();
+            if(ok) std::cout << "cached as " << path << std::endl;
+        }
+    }
+    else if(bake == "opticaldepth")
+    {
+        if(resolution < 2) resolution = OPTICAL_DEPTH_LUT_SIZE;
+        std::cout << "baking a " << resolution << "x" << resolution << " optical depth table (planet radius " << atmosParams.planetRadius << ", atmosphere radius "
+                  << atmosParams.atmosRadius << ", falloff " << atmosParams.falloff << ") on " << pool.size() << " threads" << std::endl;
+        ok = generateOpticalDepthTexture(pool, atmosParams, resolution, output.c_str(), timings);
+    }
+    else
+    {
+        std::cout << "Unknown bake " << bake << std::endl;
+        printUsage();
+        return 1;
+    }
+    double total = secondsSince(start);
+
+    struct rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    size_t nbTexels = bake == "fbm" ? 6 * resolution * resolution : resolution * resolution;
+    std::cout << "timing : compute " << timings.compute << " s, normalize " << timings.normalize << " s, mips " << timings.mips << " s, write " << timings.write
+              << " s, normal map " << timings.normals << " s, BC4 " << timings.compress << " s, total " << total << " s (" << static_cast<double>(nbTexels) / total << " texels/s), peak RSS "
+              << usage.ru_maxrss / 1024 << " MB" << std::endl;
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,121 @@
+#include "threadpool.hpp"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(unsigned int nbThreads)
+{
+    if(nbThreads == 0) nbThreads = std::max(1u, std::thread::hardware_concurrency());
+
+    for(unsigned int i = 0; i < nbThreads; i++)
+        queues.push_back(std::make_unique<Queue>());
+
+    for(unsigned int i = 0; i < nbThreads; i++)
+        workers.emplace_back(&ThreadPool::workerLoop, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stopping = true;
+    }
+    wakeUp.notify_all();
+    for(auto& w : workers) w.join();
+}
+
+void ThreadPool::submit(std::function<void()> job)
+{
+    unsigned int id = nextQueue++ % queues.size();
+    {
+        // counted before the job is visible, otherwise a thief could pop it first and wrap queued below 0
+        // taking the lock so that a worker can't miss the notification between its check and its wait
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        queued++;
+    }
+    {
+        std::lock_guard<std::mutex> lock(queues[id]->mutex);
+        queues[id]->jobs.push_back(std::move(job));
+    }
+    wakeUp.notify_one();
+}
+
+bool ThreadPool::popOwn(unsigned int id, std::function<void()>& job)
+{
+    std::lock_guard<std::mutex> lock(queues[id]->mutex);
+    if(queues[id]->jobs.empty()) return false;
+    job = std::move(queues[id]->jobs.back());
+    queues[id]->jobs.pop_back();
+    queued--;
+    return true;
+}
+
+bool ThreadPool::steal(unsigned int thief, std::function<void()>& job)
+{
+    for(size_t k = 1; k <= queues.size(); k++)
+    {
+        auto& victim = *queues[(thief + k) % queues.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if(victim.jobs.empty()) continue;
+        job = std::move(victim.jobs.front());
+        victim.jobs.pop_front();
+        queued--;
+        return true;
+    }
+    return false;
+}
+
+void ThreadPool::workerLoop(unsigned int id)
+{
+    std::function<void()> job;
+    while(true)
+    {
+        if(popOwn(id, job) || steal(id, job))
+        {
+            job();
+            job = nullptr;
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        wakeUp.wait(lock, [this] { return stopping || queued > 0; });
+        if(stopping && queued == 0) return;
+    }
+}
+
+void ThreadPool::parallelFor(size_t n, const std::function<void(size_t)>& job)
+{
+    if(n == 0) return;
+
+    // remaining is only touched under doneMutex : the last job notifies before it releases the lock, so the caller
+    // can't see 0, return and destroy them while that job still uses them
+    size_t remaining = n;
+    std::mutex doneMutex;
+    std::condition_variable done;
+
+    for(size_t i = 0; i < n; i++)
+    {
+        submit([&, i] {
+            job(i);
+            std::lock_guard<std::mutex> lock(doneMutex);
+            if(--remaining == 0) done.notify_all();
+        });
+    }
+
+    // help the workers instead of sleeping, this also avoids a deadlock when called from inside a job
+    std::function<void()> other;
+    while(true)
+    {
+        {
+            std::lock_guard<std::mutex> lock(doneMutex);
+            if(remaining == 0) return;
+        }
+        if(steal(0, other))
+        {
+            other();
+            other = nullptr;
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(doneMutex);
+        done.wait(lock, [&] { return remaining == 0 || queued > 0; });
+    }
+}
@@ -0,0 +1,74 @@
+#include <glad.h>
+
+#include "uniforms.hpp"
+
+void MainUniforms::resolve(unsigned int program)
+{
+    auto location = [program](const char* name) { return glGetUniformLocation(program, name); };
+
+    time = location("time");
+    fov = location("fov");
+    pixelAngle = location("pixelAngle");
+    aspectRatio = location("aspectRatio");
+    cameraPos = location("cameraPos");
+    cameraRotation = location("cameraRotation");
+    planetBasis = location("planetBasis");
+    sunPos = location("sunPos");
+    sunRadius = location("sunRadius");
+    sunColor = location("sunColor");
+    sunCoronaStrength = location("sunCoronaStrength");
+
+    ambientCoef = location("ambientCoef");
+    diffuseCoef = location("diffuseCoef");
+    minDiffuse = location("minDiffuse");
+    penumbraCoef = location("penumbraCoef");
+    refractionindex = location("refractionindex");
+    fresnel = location("fresnel");
+    opticalDepthLUT = location("opticalDepthLUT");
+    scatteringLUT = location("scatteringLUT");
+
+    nbStars = location("nbStars");
+    starsDisplacement = location("starsDisplacement");
+    starSize = location("starSize");
+    starSizeVariation = location("starSizeVariation");
+    starVoidThreshold = location("starVoidThreshold");
+    starFlickering = location("starFlickering");
+
+    portalPlane1 = location("portalPlane1");
+    portalPlane2 = location("portalPlane2");
+    portalPos1 = location("portalPos1");
+    portalPos2 = location("portalPos2");
+    portalSize1 = location("portalSize1");
+    portalSize2 = location("portalSize2");
+    portalBasis1 = location("portalBasis1");
+    portalBasis2 = location("portalBasis2");
+
+    heightmap = location("heightmap");
+    heightmapTiles = location("heightmapTiles");
+    placeholderHeightmap = location("placeholderHeightmap");
+    normalMap = location("normalMap");
+    placeholderNormalMap = location("placeholderNormalMap");
+    maxHeight = location("maxHeight");
+    placeholderMaxHeight = location("placeholderMaxHeight");
+    maxReduction = location("maxReduction");
+    heightmapFaceSize = location("heightmapFaceSize");
+    placeholderFaceSize = location("placeholderFaceSize");
+    heightmapLayer = location("heightmapLayer");
+
+    virtualLevels = location("virtualLevels");
+    pageTable = location("pageTable");
+    pageHeights = location("pageHeights");
+    pageNormals = location("pageNormals");
+    virtualFaceSize = location("virtualFaceSize");
+    feedbackWidth = location("feedbackWidth");
+    virtualSlack = location("virtualSlack");
+}
+
+void UIUniforms::resolve(unsigned int program)
+{
+    time = glGetUniformLocation(program, "time");
+    aspectRatio = glGetUniformLocation(program, "aspectRatio");
+    tCharge = glGetUniformLocation(program, "tCharge");
+    tBulletTime = glGetUniformLocation(program, "tBulletTime");
+    tRewind = glGetUniformLocation(program, "tRewind");
+}
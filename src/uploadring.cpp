@@ -0,0 +1,72 @@
+#include <glad.h>
+
+#include "uploadring.hpp"
+
+// offsets stay aligned for every texel type
+constexpr size_t UPLOAD_ALIGNMENT = 64;
+
+UploadRing::UploadRing(size_t __size) : size(__size)
+{
+    const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+    glBufferStorage(GL_PIXEL_UNPACK_BUFFER, size, nullptr, flags);
+    mapped = static_cast<unsigned char*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, flags));
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+UploadRing::~UploadRing()
+{
+    for(const auto& f : fences) glDeleteSync(static_cast<GLsync>(f.sync));
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glDeleteBuffers(1, &buffer);
+}
+
+unsigned char* UploadRing::allocate(size_t bytes, size_t& offset)
+{
+    // the frames the GPU is done with give their space back
+    while(!fences.empty())
+    {
+        GLenum status = glClientWaitSync(static_cast<GLsync>(fences.front().sync), 0, 0);
+        if(status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) break;
+        glDeleteSync(static_cast<GLsync>(fences.front().sync));
+        tail = fences.front().end;
+        fences.pop_front();
+    }
+    if(fences.empty() && !allocatedThisFrame) head = tail = 0;
+
+    bytes = (bytes + UPLOAD_ALIGNMENT - 1) / UPLOAD_ALIGNMENT * UPLOAD_ALIGNMENT;
+    const bool empty = fences.empty() && !allocatedThisFrame;
+    // the space in use goes from tail to head, wrapping at the end. head never catches up with tail, so that head == tail means empty
+    if(empty || head > tail)
+    {
+        if(head + bytes <= size) offset = head;
+        else if(bytes < tail) offset = 0;
+        else return nullptr;
+    }
+    else if(head + bytes < tail) offset = head;
+    else return nullptr;
+
+    head = offset + bytes;
+    allocatedThisFrame = true;
+    return mapped + offset;
+}
+
+void UploadRing::bind() const
+{
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+}
+
+void UploadRing::unbind() const
+{
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+void UploadRing::endFrame()
+{
+    if(!allocatedThisFrame) return;
+    fences.push_back(Fence{ glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0), head });
+    allocatedThisFrame = false;
+}
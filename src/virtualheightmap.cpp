@@ -0,0 +1,411 @@
+#include <glad.h>
+
+#include "virtualheightmap.hpp"
+#include "heightmap.hpp"
+#include "threadpool.hpp"
+#include "uniforms.hpp"
+#include "init.h"
+
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <cmath>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// pages main.frag can name : 16 layers, 6 faces, 16 levels and 1024 x 1024 pages per face
+constexpr int PAGE_KEY_LAYER_SHIFT = 27, PAGE_KEY_FACE_SHIFT = 24, PAGE_KEY_LEVEL_SHIFT = 20;
+constexpr uint32_t PAGE_KEY_COORD_MASK = 0x3FF;
+constexpr size_t MAX_PAGES_PER_SIDE = 1024;
+
+// a request nobody asked for again in this many frames is dropped before it is loaded
+constexpr uint64_t REQUEST_LIFETIME = 60;
+
+// Page file : one record per page at a fixed offset, the header last written so that a record cut by a crash is baked again
+constexpr uint32_t PAGE_RECORD_MAGIC = 0x45474150; // "PAGE"
+constexpr size_t PAGE_HEADER_BYTES = 16;
+constexpr size_t PAGE_RECORD_BYTES = (PAGE_HEADER_BYTES + VIRTUAL_PAGE_BYTES + 4095) / 4096 * 4096;
+
+uint32_t pageKey(int layer, int face, int level, size_t py, size_t px)
+{
+    return static_cast<uint32_t>(layer) << PAGE_KEY_LAYER_SHIFT | static_cast<uint32_t>(face) << PAGE_KEY_FACE_SHIFT
+         | static_cast<uint32_t>(level) << PAGE_KEY_LEVEL_SHIFT | static_cast<uint32_t>(py) << 10 | static_cast<uint32_t>(px);
+}
+int pageKeyLayer(uint32_t key) { return key >> PAGE_KEY_LAYER_SHIFT; }
+int pageKeyFace(uint32_t key) { return (key >> PAGE_KEY_FACE_SHIFT) & 7; }
+int pageKeyLevel(uint32_t key) { return (key >> PAGE_KEY_LEVEL_SHIFT) & 15; }
+size_t pageKeyY(uint32_t key) { return (key >> 10) & PAGE_KEY_COORD_MASK; }
+size_t pageKeyX(uint32_t key) { return key & PAGE_KEY_COORD_MASK; }
+
+// record of a page in the page file of its planet : the levels one after the other, each one with its 6 faces
+size_t pageIndex(uint32_t key, size_t virtualFaceSize)
+{
+    size_t index = 0;
+    for(int level = 0; level < pageKeyLevel(key); level++)
+    {
+        size_t n = (virtualFaceSize >> level) / VIRTUAL_PAGE_SIZE;
+        index += 6 * n * n;
+    }
+    size_t n = (virtualFaceSize >> pageKeyLevel(key)) / VIRTUAL_PAGE_SIZE;
+    return index + (pageKeyFace(key) * n + pageKeyY(key)) * n + pageKeyX(key);
+}
+
+// How far a virtual height can be from the bilinear heights of the layer around it, in normalized heights :
+// the layer misses the slope of its fbm over half a texel diagonal (an angle of at most sqrt(2) / faceSize), and the pages have the octaves it doesn't.
+// Value noise is in [0, 1) with a gradient of at most 1.5 per axis (smoothstep), so an octave of amplitude a and frequency f moves by 1.5 sqrt(3) a f per radian
+float virtualSlack(const FBMParams& layerParams, const FBMParams& virtualParams, size_t faceSize, float range)
+{
+    float lipschitz = 0., tail = 0., amplitude = 1., frequency = layerParams.frequency;
+    for(int k = 0; k < virtualParams.octaves; k++, amplitude *= virtualParams.gain, frequency *= 2.f)
+    {
+        if(k < layerParams.octaves) lipschitz += 1.5f * sqrtf(3.f) * amplitude * frequency;
+        else tail += amplitude;
+    }
+    return (lipschitz * sqrtf(2.f) / faceSize + tail) / range + 1.f / 255.f;
+}
+
+FBMParams VirtualHeightmaps::virtualParams(const FBMParams& params, size_t faceSize, size_t virtualFaceSize)
+{
+    // one more octave per level, so that the finest level has as much detail per texel as the layer
+    FBMParams result = params;
+    for(size_t s = faceSize; s < virtualFaceSize && result.octaves < FBM_MAX_OCTAVES; s *= 2) result.octaves++;
+    return result;
+}
+
+VirtualHeightmaps::VirtualHeightmaps(ThreadPool& __pool, size_t __faceSize, size_t __virtualFaceSize, size_t pageBudget, int __nbLayers, size_t nbPlanets,
+                                     const std::string& __pageCacheDir)
+    : pool(__pool), faceSize(__faceSize), virtualFaceSize(std::min(__virtualFaceSize, MAX_PAGES_PER_SIDE * VIRTUAL_PAGE_SIZE)), nbLayers(__nbLayers),
+      pageCacheDir(__pageCacheDir)
+{
+    for(size_t s = faceSize; s < virtualFaceSize; s *= 2) levels++;
+    slack.assign(nbPlanets, 0.);
+    files.assign(nbPlanets, -1);
+    layers.resize(nbLayers);
+
+    int maxArrayLayers = 0;
+    glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxArrayLayers);
+    nbSlots = static_cast<int>(std::min<size_t>(pageBudget / VIRTUAL_PAGE_BYTES, std::min(maxArrayLayers, 65534)));
+    if(levels == 0 || nbLayers == 0 || nbSlots == 0 || (virtualFaceSize >> (levels - 1)) < VIRTUAL_PAGE_SIZE)
+    {
+        levels = 0;
+        return;
+    }
+    slotKeys.assign(nbSlots, UINT32_MAX);
+    slotFrames.assign(nbSlots, 0);
+
+    const size_t pagesPerSide = virtualFaceSize / VIRTUAL_PAGE_SIZE;
+    glGenTextures(1, &pageTable);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, pageTable);
+    glTexStorage3D(GL_TEXTURE_2D_ARRAY, levels, GL_R16UI, pagesPerSide, pagesPerSide, 6 * nbLayers);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    // the border of every page makes bilinear taps inside a page exact, the atlas never filters across two pages
+    glGenTextures(1, &heightAtlas);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, heightAtlas);
+    glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_R8, VIRTUAL_PAGE_STRIDE, VIRTUAL_PAGE_STRIDE, nbSlots);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    glGenTextures(1, &normalAtlas);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, normalAtlas);
+    glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_RGBA8_SNORM, VIRTUAL_PAGE_STRIDE, VIRTUAL_PAGE_STRIDE, nbSlots);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    feedbackWidth = (LOW_RES_W + FEEDBACK_BLOCK - 1) / FEEDBACK_BLOCK;
+    feedbackHeight = (LOW_RES_H + FEEDBACK_BLOCK - 1) / FEEDBACK_BLOCK;
+    glGenBuffers(NB_FEEDBACK_BUFFERS, feedbackBuffers);
+    for(int k = 0; k < NB_FEEDBACK_BUFFERS; k++)
+    {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, feedbackBuffers[k]);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, feedbackWidth * feedbackHeight * sizeof(uint32_t), nullptr, GL_STREAM_READ);
+        glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+    }
+
+    std::cout << "virtual heightmaps : " << levels << " levels up to " << virtualFaceSize << ", " << nbSlots << " resident pages of "
+              << VIRTUAL_PAGE_SIZE << " (" << nbSlots * VIRTUAL_PAGE_BYTES / (1 << 20) << " MB)" << std::endl;
+}
+
+VirtualHeightmaps::~VirtualHeightmaps()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    pending.clear();
+    idle.wait(lock, [this] { return inFlight == 0; });
+    lock.unlock();
+
+    for(int fd : files)
+        if(fd >= 0) close(fd);
+    if(levels == 0) return;
+    glDeleteTextures(1, &pageTable);
+    glDeleteTextures(1, &heightAtlas);
+    glDeleteTextures(1, &normalAtlas);
+    for(int k = 0; k < NB_FEEDBACK_BUFFERS; k++)
+        if(fences[k]) glDeleteSync(static_cast<GLsync>(fences[k]));
+    glDeleteBuffers(NB_FEEDBACK_BUFFERS, feedbackBuffers);
+}
+
+void VirtualHeightmaps::attach(int layer, size_t planet, const FBMParams& params, float minValue, float maxValue)
+{
+    if(levels == 0) return;
+    detach(layer);
+    LayerState& state = layers[layer];
+    state.planet = static_cast<int>(planet);
+    state.params = virtualParams(params, faceSize, virtualFaceSize);
+    state.minValue = minValue;
+    state.maxValue = maxValue;
+    slack[planet] = virtualSlack(params, state.params, faceSize, maxValue - minValue);
+    slackChanged = true;
+}
+
+void VirtualHeightmaps::detach(int layer)
+{
+    if(levels == 0) return;
+    LayerState& state = layers[layer];
+    state.planet = -1;
+    state.generation++;
+
+    // its pages go back to the free slots, and the page table of the layer is emptied
+    for(int slot = 0; slot < nbSlots; slot++)
+    {
+        if(slotKeys[slot] == UINT32_MAX || pageKeyLayer(slotKeys[slot]) != layer) continue;
+        resident.erase(slotKeys[slot]);
+        slotKeys[slot] = UINT32_MAX;
+    }
+    for(auto it = requested.begin(); it != requested.end();)
+        it = pageKeyLayer(*it) == layer ? requested.erase(it) : std::next(it);
+
+    const size_t pagesPerSide = virtualFaceSize / VIRTUAL_PAGE_SIZE;
+    std::vector<uint16_t> zeros(6 * pagesPerSide * pagesPerSide, 0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, pageTable);
+    for(int level = 0; level < levels; level++)
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, 6 * layer, pagesPerSide >> level, pagesPerSide >> level, 6, GL_RED_INTEGER, GL_UNSIGNED_SHORT, zeros.data());
+
+    std::lock_guard<std::mutex> lock(mutex);
+    pending.erase(std::remove_if(pending.begin(), pending.end(), [layer](const Request& r) { return pageKeyLayer(r.key) == layer; }), pending.end());
+}
+
+void VirtualHeightmaps::update(int maxUploads)
+{
+    if(levels == 0) return;
+
+    // the feedback written NB_FEEDBACK_BUFFERS frames ago, if the GPU is done with it : reading it never stalls
+    const int k = frame % NB_FEEDBACK_BUFFERS;
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, feedbackBuffers[k]);
+    if(fences[k])
+    {
+        GLenum status = glClientWaitSync(static_cast<GLsync>(fences[k]), 0, 0);
+        if(status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED)
+        {
+            const size_t count = feedbackWidth * feedbackHeight;
+            void* data = glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, count * sizeof(uint32_t), GL_MAP_READ_BIT);
+            if(data)
+            {
+                readFeedback(static_cast<const uint32_t*>(data), count);
+                glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+            }
+        }
+        glDeleteSync(static_cast<GLsync>(fences[k]));
+        fences[k] = nullptr;
+    }
+    glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+
+    std::vector<LoadedPage> ready;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        // the camera moved on from the pages nobody asked for lately
+        auto stale = std::remove_if(pending.begin(), pending.end(), [this](const Request& r) { return r.frame + REQUEST_LIFETIME < frame; });
+        for(auto it = stale; it != pending.end(); ++it) requested.erase(it->key);
+        pending.erase(stale, pending.end());
+
+        size_t n = std::min(loaded.size(), static_cast<size_t>(maxUploads));
+        std::move(loaded.begin(), loaded.begin() + n, std::back_inserter(ready));
+        loaded.erase(loaded.begin(), loaded.begin() + n);
+
+        for(; inFlight < pool.size() && inFlight < pending.size(); inFlight++)
+            pool.submit([this] { loadNextPage(); });
+    }
+
+    for(const auto& page : ready) uploadPage(page);
+}
+
+void VirtualHeightmaps::readFeedback(const uint32_t* requests, size_t count)
+{
+    std::vector<Request> fresh;
+    std::unordered_set<uint32_t> again; // already queued
+    for(size_t k = 0; k < count; k++)
+    {
+        if(requests[k] == 0) continue;
+        const uint32_t key = requests[k] - 1;
+        const int layer = pageKeyLayer(key);
+        if(layer >= nbLayers || layers[layer].planet < 0 || pageKeyLevel(key) >= levels || pageKeyFace(key) >= 6) continue;
+
+        auto it = resident.find(key);
+        if(it != resident.end()) slotFrames[it->second] = frame;
+        else if(requested.insert(key).second)
+        {
+            const LayerState& state = layers[layer];
+            fresh.push_back(Request{ key, static_cast<size_t>(state.planet), state.params, state.minValue, state.maxValue, state.generation, frame });
+        }
+        else again.insert(key);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for(auto& r : pending)
+        if(again.count(r.key)) r.frame = frame;
+    pending.insert(pending.end(), fresh.begin(), fresh.end());
+}
+
+int VirtualHeightmaps::pageFile(const Request& request)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if(files[request.planet] < 0)
+    {
+        if(mkdir(pageCacheDir.c_str(), 0755) != 0 && errno != EEXIST) return -1;
+        // the pages are normalized with the range of the placeholder, which depends on its face size
+        char name[64];
+        snprintf(name, sizeof(name), "/pages-%016llx.bin", static_cast<unsigned long long>(heightmapKey(virtualFaceSize, request.params, request.minValue, request.maxValue)));
+        files[request.planet] = open((pageCacheDir + name).c_str(), O_RDWR | O_CREAT, 0644);
+        if(files[request.planet] < 0) std::cerr << "can't open the page file " << pageCacheDir + name << " : " << strerror(errno) << std::endl;
+    }
+    return files[request.planet];
+}
+
+void VirtualHeightmaps::loadNextPage()
+{
+    Request request;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(pending.empty())
+        {
+            inFlight--;
+            idle.notify_all();
+            return;
+        }
+        // coarse levels first : they cover more of the screen, and the finer pages fall back to them meanwhile
+        auto best = std::max_element(pending.begin(), pending.end(), [](const Request& a, const Request& b) { return pageKeyLevel(a.key) < pageKeyLevel(b.key); });
+        request = *best;
+        *best = pending.back();
+        pending.pop_back();
+    }
+
+    const size_t S = VIRTUAL_PAGE_STRIDE * VIRTUAL_PAGE_STRIDE;
+    LoadedPage page{ request, std::vector<unsigned char>(S), std::vector<signed char>(4 * S) };
+    const uint32_t fileKey = request.key & ~(~0u << PAGE_KEY_LAYER_SHIFT); // the layer changes, the page doesn't
+    const int fd = pageFile(request);
+    const off_t offset = static_cast<off_t>(pageIndex(request.key, virtualFaceSize) * PAGE_RECORD_BYTES);
+
+    // a hole of the sparse file reads as zeros, which isn't a valid header
+    uint32_t header[4]{};
+    bool cached = fd >= 0 && pread(fd, header, PAGE_HEADER_BYTES, offset) == static_cast<ssize_t>(PAGE_HEADER_BYTES) && header[0] == PAGE_RECORD_MAGIC
+               && header[1] == fileKey && header[2] == HEIGHTMAP_BAKE_VERSION && pread(fd, page.heights.data(), S, offset + PAGE_HEADER_BYTES) == static_cast<ssize_t>(S)
+               && pread(fd, page.normals.data(), 4 * S, offset + PAGE_HEADER_BYTES + S) == static_cast<ssize_t>(4 * S);
+    if(!cached)
+    {
+        const int level = pageKeyLevel(request.key);
+        bakeHeightmapPage(virtualFaceSize >> level, request.params, pageKeyFace(request.key), pageKeyY(request.key) * VIRTUAL_PAGE_SIZE,
+                          pageKeyX(request.key) * VIRTUAL_PAGE_SIZE, VIRTUAL_PAGE_SIZE, request.minValue, request.maxValue, page.heights.data(), page.normals.data());
+        if(fd >= 0)
+        {
+            uint32_t written[4] = { PAGE_RECORD_MAGIC, fileKey, HEIGHTMAP_BAKE_VERSION, 0 };
+            if(pwrite(fd, page.heights.data(), S, offset + PAGE_HEADER_BYTES) != static_cast<ssize_t>(S)
+               || pwrite(fd, page.normals.data(), 4 * S, offset + PAGE_HEADER_BYTES + S) != static_cast<ssize_t>(4 * S)
+               || pwrite(fd, written, PAGE_HEADER_BYTES, offset) != static_cast<ssize_t>(PAGE_HEADER_BYTES))
+                std::cerr << "can't write a page to the page file : " << strerror(errno) << std::endl;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    loaded.push_back(std::move(page));
+    inFlight--;
+    idle.notify_all();
+}
+
+void VirtualHeightmaps::uploadPage(const LoadedPage& page)
+{
+    const uint32_t key = page.request.key;
+    const int layer = pageKeyLayer(key);
+    requested.erase(key);
+    // the layer went to another planet since the page was asked for
+    if(page.request.generation != layers[layer].generation) return;
+
+    // a free slot, or the one seen the longest time ago. Pages seen in the last frame stay, the page is asked for again later if it is still needed
+    int slot = 0;
+    for(int s = 0; s < nbSlots; s++)
+    {
+        if(slotKeys[s] == UINT32_MAX) { slot = s; break; }
+        if(slotFrames[s] < slotFrames[slot]) slot = s;
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, pageTable);
+    if(slotKeys[slot] != UINT32_MAX)
+    {
+        if(slotFrames[slot] + 1 >= frame) return;
+        const uint32_t old = slotKeys[slot];
+        const uint16_t none = 0;
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, pageKeyLevel(old), pageKeyX(old), pageKeyY(old), 6 * pageKeyLayer(old) + pageKeyFace(old), 1, 1, 1,
+                        GL_RED_INTEGER, GL_UNSIGNED_SHORT, &none);
+        resident.erase(old);
+    }
+
+    const uint16_t entry = slot + 1;
+    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, pageKeyLevel(key), pageKeyX(key), pageKeyY(key), 6 * layer + pageKeyFace(key), 1, 1, 1, GL_RED_INTEGER,
+                    GL_UNSIGNED_SHORT, &entry);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, heightAtlas);
+    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, slot, VIRTUAL_PAGE_STRIDE, VIRTUAL_PAGE_STRIDE, 1, GL_RED, GL_UNSIGNED_BYTE, page.heights.data());
+    glBindTexture(GL_TEXTURE_2D_ARRAY, normalAtlas);
+    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, slot, VIRTUAL_PAGE_STRIDE, VIRTUAL_PAGE_STRIDE, 1, GL_RGBA, GL_BYTE, page.normals.data());
+
+    slotKeys[slot] = key;
+    slotFrames[slot] = frame;
+    resident[key] = slot;
+}
+
+void VirtualHeightmaps::endFrame()
+{
+    if(levels == 0) return;
+    // the feedback of this frame is read back once the GPU went past this fence
+    const int k = frame % NB_FEEDBACK_BUFFERS;
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    fences[k] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    frame++;
+}
+
+void VirtualHeightmaps::setUniforms(const MainUniforms& uniforms, int unit)
+{
+    // the samplers are set even without pages, so that they never share a unit with samplers of other types
+    glUniform1i(uniforms.virtualLevels, levels);
+    glUniform1i(uniforms.pageTable, unit);
+    glUniform1i(uniforms.pageHeights, unit + 1);
+    glUniform1i(uniforms.pageNormals, unit + 2);
+    glUniform1f(uniforms.virtualFaceSize, virtualFaceSize);
+    glUniform1i(uniforms.feedbackWidth, feedbackWidth);
+    slackChanged = true;
+}
+
+void VirtualHeightmaps::bind(const MainUniforms& uniforms, int unit, UploadStats& uploads)
+{
+    glActiveTexture(GL_TEXTURE0 + unit);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, pageTable);
+    glActiveTexture(GL_TEXTURE0 + unit + 1);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, heightAtlas);
+    glActiveTexture(GL_TEXTURE0 + unit + 2);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, normalAtlas);
+    if(levels == 0) return;
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, feedbackBuffers[frame % NB_FEEDBACK_BUFFERS]);
+    // the slack of a planet only changes when it gets a layer
+    if(slackChanged)
+    {
+        glUniform1fv(uniforms.virtualSlack, slack.size(), slack.data());
+        uploads.add(1, slack.size() * sizeof(float));
+        slackChanged = false;
+    }
+}
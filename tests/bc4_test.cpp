@@ -0,0 +1,135 @@
+// Checks the BC4 encoder against its own decoder : flat blocks, gradients over the whole range, blocks which need the palette
+// with 0 and 255, images whose size isn't a multiple of 4, the error bound of the fast encoder, and that the worst error
+// returned by compressBC4 is the one decompressBC4 gives
+#include "bc4.hpp"
+#include "threadpool.hpp"
+
+#include <iostream>
+#include <vector>
+#include <cstdlib>
+#include <algorithm>
+
+// the fast encoder spreads 8 values from min to max : half a step of 1/7 of the range, plus the rounding of the palette
+int fastBound(const unsigned char texels[16])
+{
+    const auto range = std::minmax_element(texels, texels + 16);
+    return (*range.second - *range.first) / 14 + 1;
+}
+
+// largest difference between texels and their decoded block, the sum of the squared differences in *squared
+int blockError(const unsigned char texels[16], bool highQuality, unsigned char block[BC4_BLOCK_BYTES], int* squared = nullptr)
+{
+    unsigned char decoded[16];
+    encodeBC4Block(texels, block, highQuality);
+    decodeBC4Block(block, decoded);
+    int worst = 0, sum = 0;
+    for(int t = 0; t < 16; t++)
+    {
+        worst = std::max(worst, abs(texels[t] - decoded[t]));
+        sum += (texels[t] - decoded[t]) * (texels[t] - decoded[t]);
+    }
+    if(squared) *squared = sum;
+    return worst;
+}
+
+int main()
+{
+    bool ok = true;
+    unsigned char texels[16], block[BC4_BLOCK_BYTES];
+
+    // flat blocks are exact
+    for(int v = 0; v < 256; v++)
+        for(bool highQuality : { false, true })
+        {
+            std::fill(texels, texels + 16, v);
+            if(blockError(texels, highQuality, block) != 0)
+            {
+                std::cout << "flat block of " << v << " isn't exact" << (highQuality ? " (high quality)" : "") << std::endl;
+                ok = false;
+            }
+        }
+
+    // gradients from 0 to 255, in both directions, stay in the bound
+    for(bool highQuality : { false, true })
+        for(int reversed = 0; reversed < 2; reversed++)
+        {
+            for(int t = 0; t < 16; t++) texels[t] = reversed ? 255 - 17 * t : 17 * t;
+            int error = blockError(texels, highQuality, block);
+            if(error > fastBound(texels))
+            {
+                std::cout << "gradient 0..255 is " << error << " away, more than " << fastBound(texels) << std::endl;
+                ok = false;
+            }
+        }
+
+    // a narrow range with a few texels at 0 and 255 : only the r0 <= r1 palette keeps all of them close
+    for(int t = 0; t < 16; t++) texels[t] = 120 + t % 5;
+    texels[3] = 0;
+    texels[12] = 255;
+    int fastError = blockError(texels, false, block);
+    int error = blockError(texels, true, block);
+    if(block[0] > block[1] || error > 1 || error >= fastError)
+    {
+        std::cout << "the high quality encoder doesn't use 0 and 255 : endpoints " << int(block[0]) << ", " << int(block[1])
+                  << ", error " << error << " (fast " << fastError << ")" << std::endl;
+        ok = false;
+    }
+    // and the decoder gives them at indices 6 and 7
+    const unsigned char extremes[BC4_BLOCK_BYTES] = { 10, 20, 0xBE, 0xEF, 0xFB, 0xBE, 0xEF, 0xFB };
+    unsigned char decoded[16];
+    decodeBC4Block(extremes, decoded);
+    for(int t = 0; t < 16; t++)
+        if(decoded[t] != (t % 2 ? 255 : 0))
+        {
+            std::cout << "indices 6 and 7 of an r0 <= r1 block don't decode to 0 and 255" << std::endl;
+            ok = false;
+            break;
+        }
+
+    // random blocks : the fast encoder stays in the bound and the high quality one never has a larger squared error
+    srand(1);
+    for(int k = 0; k < 20000; k++)
+    {
+        int lo = rand() % 256, hi = lo + rand() % (256 - lo);
+        for(int t = 0; t < 16; t++) texels[t] = lo + rand() % (hi - lo + 1);
+        int fastSquared, highSquared;
+        int fast = blockError(texels, false, block, &fastSquared);
+        blockError(texels, true, block, &highSquared);
+        if(fast > fastBound(texels) || highSquared > fastSquared)
+        {
+            std::cout << "random block " << k << " : fast error " << fast << " (bound " << fastBound(texels) << "), squared error "
+                      << fastSquared << " fast, " << highSquared << " high quality" << std::endl;
+            ok = false;
+            break;
+        }
+    }
+
+    // whole images, sizes which aren't multiples of 4 included : the returned worst error is the one of the decoded image,
+    // and the pool gives the same blocks
+    ThreadPool pool(4);
+    const size_t sizes[][2] = { { 1, 1 }, { 2, 3 }, { 4, 4 }, { 5, 7 }, { 13, 6 }, { 64, 33 } };
+    for(const auto& size : sizes)
+        for(bool highQuality : { false, true })
+        {
+            const size_t width = size[0], height = size[1], rowStride = width + 3;
+            std::vector<unsigned char> image(rowStride * height), blocks(bc4Size(width, height)), poolBlocks(blocks.size()), decompressed(width * height);
+            for(size_t y = 0; y < height; y++)
+                for(size_t x = 0; x < width; x++) image[y * rowStride + x] = (x * 37 + y * 11 + rand() % 24) & 0xFF;
+
+            int worst = compressBC4(image.data(), width, height, rowStride, blocks.data(), highQuality);
+            int poolWorst = compressBC4(pool, image.data(), width, height, rowStride, poolBlocks.data(), highQuality);
+            decompressBC4(blocks.data(), width, height, decompressed.data());
+            int actual = 0;
+            for(size_t y = 0; y < height; y++)
+                for(size_t x = 0; x < width; x++) actual = std::max(actual, abs(image[y * rowStride + x] - decompressed[y * width + x]));
+            if(worst != actual || poolWorst != worst || poolBlocks != blocks)
+            {
+                std::cout << width << "x" << height << (highQuality ? " high quality" : "") << " : compressBC4 says " << worst
+                          << " (pool " << poolWorst << "), decompressBC4 gives " << actual << std::endl;
+                ok = false;
+            }
+        }
+
+    std::cout << (ok ? "bc4 : ok" : "bc4 : FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
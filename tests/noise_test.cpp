@@ -0,0 +1,79 @@
+// Checks the vectorized fbm kernels against the scalar fbm (the same comparison as solar_texturegen --bench-noise, without the timings)
+// and that a seed always gives the same terrain, seed 0 being the historical one
+#include "noise.hpp"
+
+#include <iostream>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+
+// same tolerance as benchmarkNoiseKernels()
+constexpr int MAX_ULP = 4;
+
+int main()
+{
+    constexpr size_t N = 1 << 12;
+    std::vector<float> x(N), y(N), z(N), ref(N), res(N);
+    srand(1);
+    for(size_t k = 0; k < N; k++)
+    {
+        // random directions, plus a few far away points to exercise the negative floors
+        vec3 d = vec3(rand() / (float)RAND_MAX - 0.5f, rand() / (float)RAND_MAX - 0.5f, rand() / (float)RAND_MAX - 0.5f).normalize();
+        if(k % 16 == 0) d *= 37.f;
+        x[k] = d.x; y[k] = d.y; z[k] = d.z;
+    }
+
+    bool ok = true;
+    const char* best = fbmBatchKernelName();
+    const char* kernels[3] = { "scalar", "sse2", "avx2" };
+    for(unsigned int seed : { 0u, 1u, 7u })
+        for(int octaves = 1; octaves <= 6; octaves++)
+        {
+            FBMParams params;
+            params.octaves = octaves;
+            params.setSeed(seed);
+            fbmBatchSelectKernel("scalar");
+            fbmBatch(x.data(), y.data(), z.data(), ref.data(), N, params);
+            for(int k = 1; k < 3; k++)
+            {
+                if(!fbmBatchSelectKernel(kernels[k]))
+                {
+                    if(seed == 0 && octaves == 1) std::cout << kernels[k] << " : not supported by this CPU, skipped" << std::endl;
+                    continue;
+                }
+                fbmBatch(x.data(), y.data(), z.data(), res.data(), N, params);
+                int64_t maxUlp = 0;
+                for(size_t i = 0; i < N; i++) maxUlp = std::max(maxUlp, ulpDistance(ref[i], res[i]));
+                if(maxUlp > MAX_ULP)
+                {
+                    std::cout << kernels[k] << " is " << maxUlp << " ulp away from scalar with " << octaves << " octaves, seed " << seed << std::endl;
+                    ok = false;
+                }
+            }
+        }
+    fbmBatchSelectKernel(best);
+
+    // a seed gives the same offsets and the same values every time, seed 0 gives the unseeded terrain and other seeds another one
+    FBMParams unseeded, seed0, a, b, other;
+    seed0.setSeed(0);
+    a.setSeed(42);
+    b.setSeed(42);
+    other.setSeed(43);
+    bool sameAB = memcmp(a.offsets, b.offsets, sizeof(a.offsets)) == 0;
+    bool same0 = true, differs = false;
+    for(size_t k = 0; k < N; k++)
+    {
+        vec3 p(x[k], y[k], z[k]);
+        float fa = fbm(p, a), fb = fbm(p, b);
+        if(memcmp(&fa, &fb, sizeof(float)) != 0) sameAB = false;
+        if(fbm(p, seed0) != fbm(p, unseeded)) same0 = false;
+        if(fbm(p, other) != fa) differs = true;
+    }
+    if(!sameAB) { std::cout << "seed 42 doesn't give the same fbm twice" << std::endl; ok = false; }
+    if(!same0) { std::cout << "seed 0 doesn't give the unseeded fbm" << std::endl; ok = false; }
+    if(!differs) { std::cout << "seeds 42 and 43 give the same fbm" << std::endl; ok = false; }
+
+    std::cout << (ok ? "fbm kernels and seeds : ok" : "fbm kernels and seeds : FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
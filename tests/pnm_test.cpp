@@ -0,0 +1,67 @@
+// Checks pnm_parse_header on headers in memory : P5 and P6, comments around every field, the maxval other than 255,
+// width x height too big and payloads shorter than the header says are refused
+#include "pnm.h"
+
+#include <iostream>
+#include <string>
+
+bool ok = true;
+
+// header followed by payload bytes of pixels. expected is the offset of the pixels, 0 if it must be refused
+void check(const std::string& header, size_t payload, size_t expected, int width = 0, int height = 0, int channels = 0)
+{
+    std::string file = header + std::string(payload, '#');
+    int w = -1, h = -1, c = -1;
+    size_t offset = pnm_parse_header(reinterpret_cast<const unsigned char*>(file.data()), file.size(), &w, &h, &c);
+    if(offset != expected || (expected && (w != width || h != height || c != channels)))
+    {
+        std::cout << "\"" << header << "\" + " << payload << " bytes : offset " << offset << " (" << w << "x" << h << "x" << c << "), expected "
+                  << expected << " (" << width << "x" << height << "x" << channels << ")" << std::endl;
+        ok = false;
+    }
+}
+
+int main()
+{
+    // P5 and P6, the pixels right after the single whitespace which ends the header
+    check("P5 3 2 255\n", 6, 11, 3, 2, 1);
+    check("P6 3 2 255\n", 18, 11, 3, 2, 3);
+    check("P6\n3\t2\r255 ", 18, 11, 3, 2, 3);
+    // more payload than needed is fine, the first pixels can look like whitespace or a comment
+    check("P5 3 2 255\n", 100, 11, 3, 2, 1);
+    check("P5 1 1 255\n\n", 0, 11, 1, 1, 1);
+
+    // comments before and after each field
+    const std::string commented = "P6# after the magic\n# before the width\n3# after the width\n# before the height\n2 # after the height\n"
+                                  "# before maxval\n255# after maxval\n";
+    check(commented, 18, commented.size(), 3, 2, 3);
+    check("P5#\n3#\n2#\n255#\n", 6, 15, 3, 2, 1);
+    check("P5 3 2 # a\n# b\n255\n", 6, 19, 3, 2, 1);
+
+    // maxval other than 255 : 16 bits or less than 8 bits
+    check("P5 3 2 65535\n", 12, 0);
+    check("P5 3 2 15\n", 6, 0);
+    check("P5 3 2 0\n", 6, 0);
+
+    // broken headers
+    check("P4 3 2 255\n", 6, 0);
+    check("P3 3 2 255\n", 18, 0);
+    check("P5 0 2 255\n", 0, 0);
+    check("P5 3 2 255", 0, 0);
+    check("P5 3 2", 0, 0);
+    check("P5 3 x 255\n", 6, 0);
+
+    // width x height which overflows, an int or the file
+    check("P5 4294967296 1 255\n", 16, 0);
+    check("P5 99999999999999999999 1 255\n", 16, 0);
+    check("P6 2147483647 2147483647 255\n", 64, 0);
+    check("P6 65536 65536 255\n", 64, 0);
+
+    // payload shorter than the header says
+    check("P5 3 2 255\n", 5, 0);
+    check("P6 3 2 255\n", 17, 0);
+    check("P6 3 2 255\n", 6, 0);
+
+    std::cout << (ok ? "pnm header : ok" : "pnm header : FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,40 @@
+// Stress test of ThreadPool::parallelFor : many calls with a few jobs each, so that the last job of a call often finishes
+// while the caller is checking whether it is done (the completion state lives on the caller's stack). Best run under TSan
+#include "threadpool.hpp"
+
+#include <iostream>
+#include <vector>
+#include <atomic>
+
+int main()
+{
+    constexpr int NB_CALLS = 20000;
+    ThreadPool pool(4);
+    bool ok = true;
+
+    for(int call = 0; call < NB_CALLS && ok; call++)
+    {
+        const size_t n = 1 + call % 4;
+        std::vector<int> hits(n, 0);
+        pool.parallelFor(n, [&](size_t i) { hits[i]++; });
+        for(size_t i = 0; i < n; i++)
+            if(hits[i] != 1)
+            {
+                std::cout << "call " << call << " : job " << i << " ran " << hits[i] << " times" << std::endl;
+                ok = false;
+            }
+    }
+
+    // from inside jobs, where the caller is itself a worker
+    std::atomic<size_t> total{ 0 };
+    for(int call = 0; call < NB_CALLS / 10; call++)
+        pool.parallelFor(3, [&](size_t) { pool.parallelFor(2, [&](size_t) { total++; }); });
+    if(total != static_cast<size_t>(NB_CALLS / 10) * 3 * 2)
+    {
+        std::cout << "nested calls ran " << total << " jobs instead of " << NB_CALLS / 10 * 3 * 2 << std::endl;
+        ok = false;
+    }
+
+    std::cout << (ok ? "parallelFor : ok" : "parallelFor : FAILED") << std::endl;
+    return ok ? 0 : 1;
+}